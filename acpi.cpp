@@ -0,0 +1,203 @@
+#include "acpi.h"
+#include "paging.h"
+
+struct AcpiRsdp
+// Root system description pointer (the ACPI 1.0 part).
+{
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oemId[6];
+    uint8_t revision;
+    uint32_t rsdtAddress;
+} __attribute__((packed));
+
+static bool SignatureIs(const char* a, const char* b, uint32_t length)
+{
+    for(uint32_t i = 0; i < length; ++i)
+    {
+        if(a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+static bool ChecksumValid(const void* data, uint32_t length)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for(uint32_t i = 0; i < length; ++i)
+        sum += bytes[i];
+    return sum == 0;
+}
+
+static bool MapFirmware(uint32_t address, uint32_t length)
+// ACPI tables normally sit in reserved memory at the top of RAM, which the page
+// fault handler doesn't map on demand.
+{
+    PageManager* paging = PageManager::ActivePageManager;
+    if(paging == 0)
+        return true;
+    // Paging is off: everything is reachable.
+
+    uint32_t end = address + length;
+    for(uint32_t page = address & ~(PageManager::PageSize - 1); page < end; page += PageManager::PageSize)
+    {
+        if(paging->Translate(page) != 0)
+            continue;
+        if(!paging->MapPage(page, page, 0))
+            return false;
+        // Read-only identity mapping.
+    }
+    return true;
+}
+
+static const AcpiRsdp* ScanForRsdp(uint32_t start, uint32_t length)
+{
+    // The RSDP is on a 16-byte boundary.
+    for(uint32_t address = start; address + sizeof(AcpiRsdp) <= start + length; address += 16)
+    {
+        const AcpiRsdp* rsdp = (const AcpiRsdp*)address;
+        if(SignatureIs(rsdp->signature, "RSD PTR ", 8) && ChecksumValid(rsdp, sizeof(AcpiRsdp)))
+            return rsdp;
+    }
+    return 0;
+}
+
+static const AcpiTableHeader* MapTable(uint32_t address)
+{
+    if(address == 0 || !MapFirmware(address, sizeof(AcpiTableHeader)))
+        return 0;
+    const AcpiTableHeader* table = (const AcpiTableHeader*)address;
+    if(!MapFirmware(address, table->length) || !ChecksumValid(table, table->length))
+        return 0;
+    return table;
+}
+
+const AcpiTableHeader* FindAcpiTable(const char* signature)
+{
+    // The first KiB of the EBDA (its segment is stored at 0x40E) or 0xE0000-0xFFFFF.
+    uint32_t ebda = (uint32_t)(*(const uint16_t*)0x40E) << 4;
+    const AcpiRsdp* rsdp = 0;
+    if(ebda >= 0x80000 && ebda < 0xA0000)
+        rsdp = ScanForRsdp(ebda, 1024);
+    if(rsdp == 0)
+        rsdp = ScanForRsdp(0xE0000, 0x20000);
+    if(rsdp == 0)
+        return 0;
+
+    const AcpiTableHeader* rsdt = MapTable(rsdp->rsdtAddress);
+    if(rsdt == 0 || !SignatureIs(rsdt->signature, "RSDT", 4))
+        return 0;
+    // Even ACPI 2.0 firmware provides the RSDT; the XSDT only adds 64-bit pointers.
+
+    const uint32_t* entries = (const uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(AcpiTableHeader)) / 4;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        const AcpiTableHeader* table = MapTable(entries[i]);
+        if(table != 0 && SignatureIs(table->signature, signature, 4))
+            return table;
+    }
+    return 0;
+}
+
+Madt::Madt()
+{
+    valid = false;
+    localApicAddress = 0xFEE00000;
+    hasPic = true;
+    processorCount = 0;
+    ioApicCount = 0;
+    for(uint32_t irq = 0; irq < 16; ++irq)
+    {
+        isaRoutes[irq].gsi = irq;
+        isaRoutes[irq].activeLow = false;
+        isaRoutes[irq].levelTriggered = false;
+    }
+}
+
+Madt::~Madt()
+{
+}
+
+bool Madt::Parse()
+{
+    const AcpiTableHeader* table = FindAcpiTable("APIC");
+    if(table == 0)
+        return false;
+
+    // After the header: the local APIC address, flags, then variable-length entries.
+    const uint8_t* data = (const uint8_t*)(table + 1);
+    localApicAddress = *(const uint32_t*)data;
+    hasPic = *(const uint32_t*)(data + 4) & 0x1;
+
+    uint16_t overridden = 0;
+    const uint8_t* entry = data + 8;
+    const uint8_t* end = (const uint8_t*)table + table->length;
+    while(entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end)
+    {
+        switch(entry[0])
+        {
+            case 0:     // Processor local APIC.
+                if((*(const uint32_t*)(entry + 4) & 0x1) && processorCount < MaxProcessors)
+                {
+                    processors[processorCount].acpiId = entry[2];
+                    processors[processorCount].apicId = entry[3];
+                    processorCount++;
+                }
+                break;
+
+            case 1:     // IOAPIC.
+                if(ioApicCount < MaxIoApics)
+                {
+                    ioApics[ioApicCount].id = entry[2];
+                    ioApics[ioApicCount].address = *(const uint32_t*)(entry + 4);
+                    ioApics[ioApicCount].gsiBase = *(const uint32_t*)(entry + 8);
+                    ioApicCount++;
+                }
+                break;
+
+            case 2:     // Interrupt source override, e.g. the PIT's IRQ0 arriving on GSI 2.
+            {
+                uint8_t irq = entry[3];
+                uint16_t flags = *(const uint16_t*)(entry + 8);
+                if(entry[2] == 0 && irq < 16)
+                {
+                    isaRoutes[irq].gsi = *(const uint32_t*)(entry + 4);
+                    isaRoutes[irq].activeLow = (flags & 0x3) == 0x3;
+                    isaRoutes[irq].levelTriggered = ((flags >> 2) & 0x3) == 0x3;
+                    // 00 means "conforms to the bus", which for ISA is active high, edge.
+                    overridden |= 1 << irq;
+                }
+                break;
+            }
+
+            case 5:     // 64-bit local APIC address override.
+                if(*(const uint32_t*)(entry + 8) == 0)
+                    localApicAddress = *(const uint32_t*)(entry + 4);
+                break;
+        }
+        entry += entry[1];
+    }
+
+    // An override takes the pin away from the IRQ that would have had it by
+    // identity (with IRQ0 on GSI 2, IRQ2 has no pin of its own).
+    for(uint32_t irq = 0; irq < 16; ++irq)
+    {
+        if(overridden & (1 << irq))
+            continue;
+        for(uint32_t other = 0; other < 16; ++other)
+        {
+            if((overridden & (1 << other)) && isaRoutes[other].gsi == isaRoutes[irq].gsi)
+                isaRoutes[irq].gsi = NoGsi;
+        }
+    }
+
+    valid = ioApicCount > 0;
+    return valid;
+}
+
+bool Madt::Valid()
+{
+    return valid;
+}
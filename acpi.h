@@ -0,0 +1,84 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "types.h"
+
+struct AcpiTableHeader
+// Common header of every ACPI system description table.
+{
+    char signature[4];
+    uint32_t length;            // Including this header.
+    uint8_t revision;
+    uint8_t checksum;           // All bytes of the table add up to 0.
+    char oemId[6];
+    char oemTableId[8];
+    uint32_t oemRevision;
+    uint32_t creatorId;
+    uint32_t creatorRevision;
+} __attribute__((packed));
+
+const AcpiTableHeader* FindAcpiTable(const char* signature);
+// Locates the RSDP in the EBDA or the BIOS area, then the table with the given
+// signature through the RSDT. Tables outside the identity-mapped kernel region
+// are mapped read-only on the way (paging must be on). Returns 0 if not found
+// or if a checksum is wrong.
+
+class Madt
+// The multiple APIC description table ("APIC"): where the local APICs and
+// IOAPICs are and how ISA IRQs are wired to the IOAPIC inputs (global system
+// interrupts, GSIs).
+{
+public:
+    static const uint32_t MaxProcessors = 16;
+    static const uint32_t MaxIoApics = 4;
+
+    struct Processor
+    {
+        uint8_t acpiId;
+        uint8_t apicId;
+    };
+
+    struct IoApicEntry
+    {
+        uint8_t id;
+        uint32_t address;
+        uint32_t gsiBase;       // First GSI served by this IOAPIC.
+    };
+
+    static const uint32_t NoGsi = 0xFFFFFFFF;
+
+    struct IsaRoute
+    {
+        uint32_t gsi;           // NoGsi if the IRQ isn't wired to any IOAPIC input.
+        bool activeLow;
+        bool levelTriggered;
+    };
+
+private:
+    bool valid;
+
+public:
+    uint32_t localApicAddress;
+    bool hasPic;
+    // The legacy 8259s are present too (and must be masked).
+
+    Processor processors[MaxProcessors];
+    uint32_t processorCount;
+    // Enabled processors, the boot processor included.
+
+    IoApicEntry ioApics[MaxIoApics];
+    uint32_t ioApicCount;
+
+    IsaRoute isaRoutes[16];
+    // Identity (IRQ n = GSI n, edge, active high) unless an interrupt source override says otherwise.
+
+    Madt();
+    ~Madt();
+
+    bool Parse();
+    // Reads the table; returns false if there is none.
+
+    bool Valid();
+};
+
+#endif
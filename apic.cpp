@@ -0,0 +1,278 @@
+#include "apic.h"
+#include "paging.h"
+#include "timer.h"
+#include "arith.h"
+
+LocalApic* LocalApic::ActiveLocalApic = 0;
+
+static inline void WriteMsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr" : : "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint64_t ReadMsr(uint32_t msr)
+{
+    uint32_t low, high;
+    __asm__ volatile("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static const uint32_t ApicBaseMsr = 0x1B;
+static const uint32_t TscDeadlineMsr = 0x6E0;
+
+static void MapRegisters(uint32_t physicalAddress)
+{
+    if(PageManager::ActivePageManager != 0)
+        PageManager::ActivePageManager->MapPage(physicalAddress, physicalAddress,
+            PageManager::PageWritable | PageManager::PageCacheDisable | PageManager::PageWriteThrough);
+    // Device registers must not be cached.
+}
+
+LocalApic::LocalApic(uint32_t physicalAddress)
+{
+    MapRegisters(physicalAddress);
+    registers = (volatile uint32_t*)physicalAddress;
+    tscDeadline = false;
+    timerKHz = 0;
+    tscKHz = 0;
+
+    uint64_t base = ReadMsr(ApicBaseMsr);
+    if(!(base & 0x800))
+        WriteMsr(ApicBaseMsr, base | 0x800);
+    // Bit 11: global enable (the firmware normally leaves it on).
+
+    ActiveLocalApic = this;
+}
+
+LocalApic::~LocalApic()
+{
+    if(ActiveLocalApic == this)
+        ActiveLocalApic = 0;
+}
+
+bool LocalApic::Supported()
+{
+    unsigned int eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    return edx & (1 << 9);
+}
+
+void LocalApic::Enable()
+{
+    Write(0x080, 0);                            // Task priority 0: accept every vector.
+    Write(Lint0Lvt, 0x10000);                   // Masked: no ExtINT from the 8259s.
+    Write(Lint1Lvt, 0x10000);
+    Write(ErrorLvt, 0x10000);
+    Write(TimerLvt, 0x10000);
+    Write(SpuriousRegister, 0x100 | SpuriousVector);
+    // Bit 8 software-enables the APIC.
+}
+
+uint8_t LocalApic::Id()
+{
+    return Read(IdRegister) >> 24;
+}
+
+void LocalApic::SendIpi(uint8_t apicId, uint32_t command)
+{
+    Write(InterruptCommandHigh, (uint32_t)apicId << 24);
+    Write(InterruptCommandLow, command);
+    // Writing the low half sends the IPI.
+    while(Read(InterruptCommandLow) & (1 << 12))
+        __asm__ volatile("pause");
+    // Delivery status: still pending.
+}
+
+bool LocalApic::StartTimer(uint8_t vector, uint64_t tscFrequency)
+{
+    if(tscFrequency < 1000)
+        return false;
+    tscKHz = (uint32_t)DivU64(tscFrequency, 1000);
+
+    unsigned int eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    tscDeadline = ecx & (1 << 24);
+
+    if(tscDeadline)
+    {
+        Write(TimerLvt, vector | (2 << 17));    // TSC-deadline mode.
+        __asm__ volatile("mfence" : : : "memory");
+        // The mode switch must be visible before the first write to the deadline MSR.
+        return true;
+    }
+
+    Write(TimerDivide, 0x3);                    // Divide the bus clock by 16.
+    if(timerKHz == 0)
+    {
+        // Count down from the maximum for 10 ms of TSC time to learn the counter's rate.
+        Write(TimerLvt, 0x10000 | vector);      // One-shot, masked while measuring.
+        Write(TimerInitialCount, 0xFFFFFFFF);
+        uint64_t start = TimerDriver::ReadTSC();
+        while(TimerDriver::ReadTSC() - start < (uint64_t)tscKHz * 10)
+            __asm__ volatile("pause");
+        timerKHz = (0xFFFFFFFF - Read(TimerCurrentCount)) / 10;
+    }
+    // All CPUs share the bus clock, so the other CPUs reuse the boot CPU's measurement.
+
+    Write(TimerInitialCount, 0);
+    Write(TimerLvt, vector);                    // One-shot, unmasked.
+    return timerKHz != 0;
+}
+
+void LocalApic::ArmTimer(uint64_t tscDeadline)
+{
+    if(this->tscDeadline)
+    {
+        WriteMsr(TscDeadlineMsr, tscDeadline == 0 ? 1 : tscDeadline);
+        // 0 would disarm; a deadline in the past fires immediately.
+        return;
+    }
+
+    uint64_t now = TimerDriver::ReadTSC();
+    uint64_t delta = tscDeadline > now ? tscDeadline - now : 1;
+    if(delta > 0xFFFFFFFF)
+        delta = 0xFFFFFFFF;
+    uint64_t count = DivU64(delta * timerKHz, tscKHz);
+    if(count == 0)
+        count = 1;
+    if(count > 0xFFFFFFFF)
+        count = 0xFFFFFFFF;
+    Write(TimerInitialCount, (uint32_t)count);
+}
+
+void LocalApic::StopTimer()
+{
+    if(tscDeadline)
+        WriteMsr(TscDeadlineMsr, 0);
+    else
+        Write(TimerInitialCount, 0);
+}
+
+bool LocalApic::TscDeadlineMode()
+{
+    return tscDeadline;
+}
+
+IoApic::IoApic(uint32_t physicalAddress, uint32_t gsiBase)
+{
+    MapRegisters(physicalAddress);
+    registers = (volatile uint32_t*)physicalAddress;
+    this->gsiBase = gsiBase;
+    inputs = ((Read(0x01) >> 16) & 0xFF) + 1;
+    // Version register: bits 16-23 hold the index of the last redirection entry.
+
+    for(uint32_t pin = 0; pin < inputs; ++pin)
+        Write(0x10 + 2 * pin, 0x10000);
+    // Everything masked until it is routed and claimed.
+}
+
+IoApic::~IoApic()
+{
+}
+
+uint32_t IoApic::Read(uint8_t index)
+{
+    registers[0] = index;
+    return registers[4];
+}
+
+void IoApic::Write(uint8_t index, uint32_t value)
+{
+    registers[0] = index;
+    registers[4] = value;
+}
+
+bool IoApic::Serves(uint32_t gsi)
+{
+    return gsi >= gsiBase && gsi < gsiBase + inputs;
+}
+
+void IoApic::Route(uint32_t gsi, uint8_t vector, uint8_t apicId, bool activeLow, bool levelTriggered)
+{
+    uint8_t pin = gsi - gsiBase;
+    uint32_t low = vector | 0x10000;            // Fixed delivery, physical destination, masked.
+    if(activeLow)
+        low |= 1 << 13;
+    if(levelTriggered)
+        low |= 1 << 15;
+    Write(0x10 + 2 * pin + 1, (uint32_t)apicId << 24);
+    Write(0x10 + 2 * pin, low);
+}
+
+void IoApic::SetMasked(uint32_t gsi, bool masked)
+{
+    uint8_t index = 0x10 + 2 * (gsi - gsiBase);
+    uint32_t low = Read(index);
+    Write(index, masked ? (low | 0x10000) : (low & ~0x10000u));
+}
+
+ApicController::ApicController(Madt* madt, uint8_t vectorOffset, ProgrammableInterruptController* pic)
+: localApic(madt->localApicAddress)
+{
+    this->madt = madt;
+
+    pic->MaskAll();
+    localApic.Enable();
+
+    ioApicCount = 0;
+    for(uint32_t i = 0; i < madt->ioApicCount; ++i)
+        ioApics[ioApicCount++] = new IoApic(madt->ioApics[i].address, madt->ioApics[i].gsiBase);
+
+    uint8_t bootCpu = localApic.Id();
+    for(uint8_t irq = 0; irq < 16; ++irq)
+    {
+        const Madt::IsaRoute* route = &madt->isaRoutes[irq];
+        IoApic* ioApic = ForGsi(route->gsi);
+        if(ioApic != 0)
+            ioApic->Route(route->gsi, vectorOffset + irq, bootCpu, route->activeLow, route->levelTriggered);
+    }
+}
+
+ApicController::~ApicController()
+{
+    for(uint32_t i = 0; i < ioApicCount; ++i)
+        delete ioApics[i];
+}
+
+IoApic* ApicController::ForGsi(uint32_t gsi)
+{
+    for(uint32_t i = 0; i < ioApicCount; ++i)
+    {
+        if(ioApics[i]->Serves(gsi))
+            return ioApics[i];
+    }
+    return 0;
+}
+
+void ApicController::Mask(uint8_t irq)
+{
+    if(irq >= 16)
+        return;
+    IoApic* ioApic = ForGsi(madt->isaRoutes[irq].gsi);
+    if(ioApic != 0)
+        ioApic->SetMasked(madt->isaRoutes[irq].gsi, true);
+}
+
+void ApicController::Unmask(uint8_t irq)
+{
+    if(irq >= 16)
+        return;
+    IoApic* ioApic = ForGsi(madt->isaRoutes[irq].gsi);
+    if(ioApic != 0)
+        ioApic->SetMasked(madt->isaRoutes[irq].gsi, false);
+}
+
+bool ApicController::IsSpurious(uint8_t irq)
+{
+    return false;
+}
+
+void ApicController::EndOfInterrupt(uint8_t irq)
+{
+    localApic.EndOfInterrupt();
+}
+
+LocalApic* ApicController::Local()
+{
+    return &localApic;
+}
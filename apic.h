@@ -0,0 +1,146 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "types.h"
+#include "interruptcontroller.h"
+#include "acpi.h"
+#include "pic.h"
+
+class LocalApic
+// The calling CPU's local APIC, reached through its memory-mapped registers
+// (every CPU sees its own APIC at the same address). Provides the EOI, which is
+// a single MMIO store instead of port I/O, and a per-CPU timer that is armed
+// for an absolute TSC deadline: in TSC-deadline mode when the CPU has it,
+// otherwise by converting the deadline into a one-shot count.
+{
+    volatile uint32_t* registers;
+
+    bool tscDeadline;
+    // CPUID.01h:ECX bit 24: the timer can fire at a TSC value.
+
+    uint32_t timerKHz;
+    // Rate of the one-shot counter (bus clock / 16), measured against the TSC.
+
+    uint32_t tscKHz;
+
+    inline uint32_t Read(uint32_t offset)
+    {
+        return registers[offset / 4];
+    }
+
+    inline void Write(uint32_t offset, uint32_t value)
+    {
+        registers[offset / 4] = value;
+    }
+
+public:
+    static const uint32_t SpuriousVector = 0xFF;
+    // Spurious interrupts need no EOI; the IDT entry for 0xFF is a bare `iret`.
+
+    // Register offsets.
+    static const uint32_t IdRegister = 0x020;
+    static const uint32_t EoiRegister = 0x0B0;
+    static const uint32_t SpuriousRegister = 0x0F0;
+    static const uint32_t InterruptCommandLow = 0x300;
+    static const uint32_t InterruptCommandHigh = 0x310;
+    static const uint32_t TimerLvt = 0x320;
+    static const uint32_t Lint0Lvt = 0x350;
+    static const uint32_t Lint1Lvt = 0x360;
+    static const uint32_t ErrorLvt = 0x370;
+    static const uint32_t TimerInitialCount = 0x380;
+    static const uint32_t TimerCurrentCount = 0x390;
+    static const uint32_t TimerDivide = 0x3E0;
+
+    static LocalApic* ActiveLocalApic;
+
+    LocalApic(uint32_t physicalAddress);
+    // Maps the registers uncached. `Enable` must still run on every CPU that uses it.
+
+    ~LocalApic();
+
+    static bool Supported();
+    // CPUID.01h:EDX bit 9.
+
+    void Enable();
+    // Software-enables this CPU's APIC with the spurious vector, masks LINT0/LINT1
+    // (the 8259 path) and the timer.
+
+    uint8_t Id();
+    // APIC ID of the calling CPU.
+
+    inline void EndOfInterrupt()
+    {
+        Write(EoiRegister, 0);
+    }
+
+    void SendIpi(uint8_t apicId, uint32_t command);
+    // Writes the interrupt command register and waits until it was delivered.
+
+    bool StartTimer(uint8_t vector, uint64_t tscFrequency);
+    // Sets up the calling CPU's timer for `ArmTimer`, calibrating the one-shot
+    // counter the first time. Returns false if the TSC frequency is unknown.
+
+    void ArmTimer(uint64_t tscDeadline);
+    // One interrupt when the TSC reaches `tscDeadline` (right away if it already has).
+
+    void StopTimer();
+
+    bool TscDeadlineMode();
+};
+
+class IoApic
+// One IOAPIC: a redirection table entry per input pin (GSI) that says which
+// vector, on which CPU, with which trigger mode and polarity.
+{
+    volatile uint32_t* registers;
+    // Index register at +0x00, data window at +0x10.
+
+    uint32_t gsiBase;
+    uint32_t inputs;
+
+    uint32_t Read(uint8_t index);
+    void Write(uint8_t index, uint32_t value);
+
+public:
+    IoApic(uint32_t physicalAddress, uint32_t gsiBase);
+    ~IoApic();
+
+    bool Serves(uint32_t gsi);
+
+    void Route(uint32_t gsi, uint8_t vector, uint8_t apicId, bool activeLow, bool levelTriggered);
+    // Programs the entry of `gsi`, leaving it masked.
+
+    void SetMasked(uint32_t gsi, bool masked);
+};
+
+class ApicController : public InterruptController
+// Interrupt delivery through the IOAPIC(s) and the local APIC, configured from
+// the MADT. ISA IRQ n is routed to the boot CPU at vector offset + n, exactly
+// like the 8259s deliver it, so handlers don't change. The 8259s are masked.
+{
+    Madt* madt;
+    LocalApic localApic;
+
+    IoApic* ioApics[Madt::MaxIoApics];
+    uint32_t ioApicCount;
+
+    IoApic* ForGsi(uint32_t gsi);
+
+public:
+    ApicController(Madt* madt, uint8_t vectorOffset, ProgrammableInterruptController* pic);
+    // Maps and enables the APICs, routes ISA IRQs 0-15 (masked) and masks `pic`.
+
+    ~ApicController();
+
+    virtual void Mask(uint8_t irq);
+    virtual void Unmask(uint8_t irq);
+
+    virtual bool IsSpurious(uint8_t irq);
+    // Always false: the local APIC uses its own spurious vector.
+
+    virtual void EndOfInterrupt(uint8_t irq);
+
+    LocalApic* Local();
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include "types.h"
+
+// 64-bit helpers for a kernel that is linked without libgcc.
+// A plain `uint64_t / uint32_t` makes g++ emit a call to __udivdi3, which we don't have,
+// so divisions go through `divl` directly.
+
+// Divides a 64-bit value by a 32-bit divisor, returning the full 64-bit quotient.
+// The optional `remainder` receives `n % d`.
+static inline uint64_t DivU64(uint64_t n, uint32_t d, uint32_t* remainder = 0)
+{
+    uint32_t high = (uint32_t)(n >> 32);
+    uint32_t low = (uint32_t)n;
+    uint32_t quotientHigh = high / d;
+    uint32_t r = high % d;
+    uint32_t quotientLow;
+    // `divl` divides edx:eax by the operand. Since r < d the quotient fits in 32 bits.
+    __asm__("divl %4" : "=a" (quotientLow), "=d" (r) : "a" (low), "d" (r), "rm" (d));
+    if(remainder != 0)
+        *remainder = r;
+    return ((uint64_t)quotientHigh << 32) | quotientLow;
+}
+
+// Computes (a * mult) >> shift without losing the upper bits of the 96-bit product.
+// `shift` must be in the range 0..32.
+static inline uint64_t MulShift64(uint64_t a, uint32_t mult, uint8_t shift)
+{
+    uint64_t low = (uint64_t)(uint32_t)a * mult;
+    uint64_t high = (uint64_t)(uint32_t)(a >> 32) * mult;
+    if(shift == 0)
+        return (high << 32) + low;
+    return (high << (32 - shift)) + (low >> shift);
+}
+
+#endif
@@ -0,0 +1,606 @@
+#include "ata.h"
+#include "heap.h"
+#include "memory.h"
+
+// Status register bits.
+static const uint8_t StatusBusy = 0x80;
+static const uint8_t StatusDeviceFault = 0x20;
+static const uint8_t StatusDataRequest = 0x08;
+static const uint8_t StatusError = 0x01;
+
+// Commands.
+static const uint8_t CommandReadSectors = 0x20;
+static const uint8_t CommandWriteSectors = 0x30;
+static const uint8_t CommandFlushCache = 0xE7;
+static const uint8_t CommandIdentify = 0xEC;
+
+static inline uint32_t SaveAndDisableInterrupts()
+{
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+    return eflags;
+}
+
+static inline void RestoreInterrupts(uint32_t eflags)
+{
+    __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+}
+
+AtaDriver::AtaDriver(InterruptManager* manager, bool master, uint16_t portBase, uint16_t controlBase, uint8_t irq)
+: InterruptHandler(manager, manager->HardwareInterruptOffset() + irq),
+  dataPort(portBase),
+  errorPort(portBase + 1),
+  sectorCountPort(portBase + 2),
+  lbaLowPort(portBase + 3),
+  lbaMidPort(portBase + 4),
+  lbaHighPort(portBase + 5),
+  devicePort(portBase + 6),
+  commandPort(portBase + 7),
+  controlPort(controlBase),
+  lock("ata")
+{
+    this->master = master;
+    sectorCount = 0;
+    model[0] = '\0';
+    inflight = 0;
+    sectorsLeft = 0;
+    transferCursor = 0;
+    lastBlock = 0xFFFFFFFF;
+    hits = 0;
+    misses = 0;
+    readAheads = 0;
+    writeBacks = 0;
+    errors = 0;
+    cacheMemory = 0;
+    newest = 0;
+    oldest = 0;
+
+    for(uint32_t i = 0; i < HashBuckets; ++i)
+        buckets[i] = 0;
+
+    present = Identify();
+    if(present)
+        cacheMemory = new uint8_t[CacheBlocks * BlockSize];
+    if(cacheMemory == 0)
+    {
+        present = false;
+        return;
+    }
+
+    // All blocks start out empty in LRU order.
+    for(uint32_t i = 0; i < CacheBlocks; ++i)
+    {
+        CacheBlock* block = &blocks[i];
+        block->number = 0xFFFFFFFF;
+        block->data = cacheMemory + i * BlockSize;
+        block->state = BlockEmpty;
+        block->dirty = false;
+        block->users = 0;
+        block->hashNext = 0;
+        block->newer = i == 0 ? 0 : &blocks[i - 1];
+        block->older = i == CacheBlocks - 1 ? 0 : &blocks[i + 1];
+    }
+    newest = &blocks[0];
+    oldest = &blocks[CacheBlocks - 1];
+
+    controlPort.Write(0x00);
+    // nIEN = 0: the drive raises IRQ14 for every sector and at the end of commands.
+}
+
+AtaDriver::~AtaDriver()
+{
+    if(present)
+        Flush();
+    delete[] cacheMemory;
+}
+
+uint8_t AtaDriver::WaitNotBusy()
+{
+    uint8_t status = controlPort.Read();
+    for(uint32_t spin = 0; (status & StatusBusy) && spin < PollLimit; ++spin)
+        status = controlPort.Read();
+    return status;
+}
+
+bool AtaDriver::WaitDataRequest()
+{
+    uint8_t status = WaitNotBusy();
+    for(uint32_t spin = 0; !(status & (StatusDataRequest | StatusError | StatusDeviceFault)) && spin < PollLimit; ++spin)
+        status = controlPort.Read();
+    return (status & StatusDataRequest) && !(status & (StatusBusy | StatusError | StatusDeviceFault));
+}
+
+void AtaDriver::Reset()
+{
+    controlPort.Write(0x04);
+    for(int i = 0; i < 50; ++i)
+        controlPort.Read();
+    // SRST must stay set for at least 5 us.
+    controlPort.Write(0x00);
+    WaitNotBusy();
+}
+
+void AtaDriver::SelectDevice(uint32_t lba)
+{
+    devicePort.Write(0xE0 | (master ? 0x00 : 0x10) | ((lba >> 24) & 0x0F));
+    for(int i = 0; i < 4; ++i)
+        controlPort.Read();
+    // Each read of the alternate status register takes about 100 ns.
+}
+
+bool AtaDriver::Identify()
+{
+    controlPort.Write(0x02);
+    // nIEN = 1: no interrupt for IDENTIFY, it is polled.
+
+    SelectDevice(0);
+    sectorCountPort.Write(0);
+    lbaLowPort.Write(0);
+    lbaMidPort.Write(0);
+    lbaHighPort.Write(0);
+    commandPort.Write(CommandIdentify);
+
+    uint8_t status = commandPort.Read();
+    if(status == 0x00 || status == 0xFF)
+        return false;
+    // No drive (or no controller at all: the bus floats high).
+
+    status = WaitNotBusy();
+    if(status & StatusBusy)
+        return false;
+    if(lbaMidPort.Read() != 0 || lbaHighPort.Read() != 0)
+        return false;
+    // ATAPI and SATA devices put a signature here; they need other commands.
+
+    if(!WaitDataRequest())
+        return false;
+
+    uint16_t identify[256];
+    dataPort.ReadString(identify, 256);
+
+    // Words 27-46: model name, two characters per word with the first in the high byte.
+    for(int i = 0; i < 20; ++i)
+    {
+        model[2 * i] = identify[27 + i] >> 8;
+        model[2 * i + 1] = identify[27 + i] & 0xFF;
+    }
+    model[40] = '\0';
+    for(int i = 39; i >= 0 && model[i] == ' '; --i)
+        model[i] = '\0';
+
+    sectorCount = identify[60] | ((uint32_t)identify[61] << 16);
+    // Words 60-61: sectors addressable with 28-bit LBA.
+    return sectorCount != 0;
+}
+
+void AtaDriver::StartRead(CacheBlock* block)
+{
+    uint32_t lba = block->number * BlockSectors;
+    WaitNotBusy();
+    SelectDevice(lba);
+    sectorCountPort.Write(BlockSectors);
+    lbaLowPort.Write(lba & 0xFF);
+    lbaMidPort.Write((lba >> 8) & 0xFF);
+    lbaHighPort.Write((lba >> 16) & 0xFF);
+
+    inflight = block;
+    sectorsLeft = BlockSectors;
+    transferCursor = block->data;
+    commandPort.Write(CommandReadSectors);
+}
+
+void AtaDriver::StartNext()
+{
+    CacheBlock* block;
+    if(inflight == 0 && readQueue.Pop(&block))
+        StartRead(block);
+}
+
+void AtaDriver::Service()
+{
+    uint8_t status = commandPort.Read();
+    // Also acknowledges the drive's interrupt.
+    CacheBlock* block = inflight;
+    if(block == 0 || (status & StatusBusy))
+        return;
+
+    if(status & (StatusError | StatusDeviceFault))
+    {
+        block->state = BlockError;
+        errors++;
+        inflight = 0;
+        StartNext();
+        return;
+    }
+
+    if(!(status & StatusDataRequest))
+        return;
+
+    dataPort.ReadString(transferCursor, SectorSize / 2);
+    transferCursor += SectorSize;
+    if(--sectorsLeft != 0)
+        return;
+
+    block->state = BlockValid;
+    inflight = 0;
+    StartNext();
+    // Keep the drive busy with the next queued block right away.
+}
+
+unsigned int AtaDriver::HandleInterrupt(unsigned int esp)
+{
+    IrqSpinLockGuard guard(&lock);
+    Service();
+    return esp;
+}
+
+bool AtaDriver::Queue(CacheBlock* block)
+{
+    if(!readQueue.Push(block))
+        return false;
+    block->state = BlockLoading;
+    StartNext();
+    return true;
+}
+
+void AtaDriver::WaitFor(CacheBlock* block)
+{
+    while(true)
+    {
+        uint32_t eflags = SaveAndDisableInterrupts();
+        lock.Lock();
+        bool done = block->state != BlockLoading;
+        bool serviced = false;
+        if(!done)
+        {
+            uint8_t status = controlPort.Read();
+            if(!(status & StatusBusy) && (status & (StatusDataRequest | StatusError)))
+            {
+                Service();
+                serviced = true;
+            }
+            // Covers waiting with interrupts off (e.g. before they are activated),
+            // interrupts that were acknowledged here first and an IRQ that goes
+            // to another CPU.
+        }
+        lock.Unlock();
+
+        if(!done && !serviced && (eflags & 0x200))
+            __asm__ volatile("sti; hlt");
+        // `sti` only takes effect after `hlt`, so an interrupt arriving in between still wakes us.
+
+        RestoreInterrupts(eflags);
+        if(done)
+            return;
+    }
+}
+
+void AtaDriver::WaitIdle()
+{
+    uint32_t spin = 0;
+    while(inflight != 0)
+    {
+        uint8_t status = controlPort.Read();
+        if(!(status & StatusBusy) && (status & (StatusDataRequest | StatusError)))
+        {
+            Service();
+            spin = 0;
+        }
+        else if(++spin == PollLimit)
+        {
+            inflight->state = BlockError;
+            errors++;
+            inflight = 0;
+            Reset();
+            StartNext();
+            spin = 0;
+        }
+        // A drive that stopped answering fails the block instead of hanging us.
+    }
+    // Service starts the queued reads one after another until none is left.
+}
+
+bool AtaDriver::WriteBack(CacheBlock* block)
+{
+    WaitIdle();
+    // The whole transfer is polled; the IRQ handler only sees an idle drive.
+
+    uint32_t lba = block->number * BlockSectors;
+    WaitNotBusy();
+    SelectDevice(lba);
+    sectorCountPort.Write(BlockSectors);
+    lbaLowPort.Write(lba & 0xFF);
+    lbaMidPort.Write((lba >> 8) & 0xFF);
+    lbaHighPort.Write((lba >> 16) & 0xFF);
+    commandPort.Write(CommandWriteSectors);
+
+    bool ok = true;
+    for(uint32_t i = 0; i < BlockSectors && ok; ++i)
+    {
+        controlPort.Read();
+        if(!WaitDataRequest())
+            ok = false;
+        // An error, or a drive that never asks for the data; the block stays dirty.
+        else
+            dataPort.WriteString(block->data + i * SectorSize, SectorSize / 2);
+    }
+    uint8_t status = WaitNotBusy();
+    if(status & (StatusBusy | StatusError | StatusDeviceFault))
+        ok = false;
+    commandPort.Read();
+    if(!ok)
+        Reset();
+    // Aborts what is left of the command, so the drive takes the next one.
+
+    if(ok)
+    {
+        block->dirty = false;
+        writeBacks++;
+    }
+    else
+        errors++;
+    return ok;
+}
+
+AtaDriver::CacheBlock* AtaDriver::Lookup(uint32_t number)
+{
+    for(CacheBlock* block = buckets[number % HashBuckets]; block != 0; block = block->hashNext)
+    {
+        if(block->number == number)
+            return block;
+    }
+    return 0;
+}
+
+void AtaDriver::Touch(CacheBlock* block)
+{
+    if(block == newest)
+        return;
+
+    // Unlink...
+    block->newer->older = block->older;
+    if(block->older != 0)
+        block->older->newer = block->newer;
+    else
+        oldest = block->newer;
+
+    // ...and put it in front.
+    block->newer = 0;
+    block->older = newest;
+    newest->newer = block;
+    newest = block;
+}
+
+void AtaDriver::Unhash(CacheBlock* block)
+{
+    if(block->number == 0xFFFFFFFF)
+        return;
+    CacheBlock** link = &buckets[block->number % HashBuckets];
+    while(*link != block)
+        link = &(*link)->hashNext;
+    *link = block->hashNext;
+    block->number = 0xFFFFFFFF;
+}
+
+void AtaDriver::Hash(CacheBlock* block, uint32_t number)
+{
+    block->number = number;
+    block->hashNext = buckets[number % HashBuckets];
+    buckets[number % HashBuckets] = block;
+}
+
+AtaDriver::CacheBlock* AtaDriver::Evict(bool allowDirty)
+{
+    for(CacheBlock* block = oldest; block != 0; block = block->newer)
+    {
+        if(block->state == BlockLoading || block->users != 0)
+            continue;
+        if(block->dirty)
+        {
+            if(!allowDirty || !WriteBack(block))
+                continue;
+        }
+        Unhash(block);
+        block->state = BlockEmpty;
+        return block;
+    }
+    return 0;
+}
+
+void AtaDriver::ReadAhead(uint32_t number)
+{
+    uint32_t blockCount = sectorCount / BlockSectors;
+    for(uint32_t i = 1; i <= ReadAheadBlocks; ++i)
+    {
+        uint32_t next = number + i;
+        if(next >= blockCount)
+            return;
+        if(Lookup(next) != 0)
+            continue;
+
+        CacheBlock* block = Evict(false);
+        // Speculative reads don't push dirty data out.
+        if(block == 0)
+            return;
+        Hash(block, next);
+        if(!Queue(block))
+        {
+            Unhash(block);
+            return;
+        }
+        // The queue is full of earlier read-ahead already.
+        readAheads++;
+    }
+}
+
+AtaDriver::CacheBlock* AtaDriver::GetBlock(uint32_t number, bool load)
+{
+    CacheBlock* block;
+    {
+        IrqSpinLockGuard guard(&lock);
+        bool sequential = number == lastBlock + 1 || number == lastBlock;
+        lastBlock = number;
+
+        block = Lookup(number);
+        if(block != 0 && block->state != BlockError)
+            hits++;
+        else
+        {
+            misses++;
+            if(block == 0)
+            {
+                block = Evict(true);
+                if(block == 0)
+                    return 0;
+                Hash(block, number);
+            }
+            if(!load)
+                block->state = BlockValid;
+            else if(!Queue(block))
+            {
+                WaitIdle();
+                Queue(block);
+            }
+            // Only read-ahead fills the queue; wait for the drive to catch up.
+        }
+        Touch(block);
+        block->users++;
+
+        if(sequential && load)
+            ReadAhead(number);
+        // Queued behind this block, so they load while the caller works on it.
+    }
+
+    WaitFor(block);
+    if(block->state == BlockError)
+    {
+        Unpin(block, false);
+        return 0;
+    }
+    return block;
+}
+
+void AtaDriver::Unpin(CacheBlock* block, bool dirty)
+{
+    IrqSpinLockGuard guard(&lock);
+    if(dirty)
+        block->dirty = true;
+    block->users--;
+}
+
+bool AtaDriver::Read(uint32_t sector, void* buffer, uint32_t count)
+{
+    if(!present || sector + count > sectorCount || sector + count < sector)
+        return false;
+
+    uint8_t* out = (uint8_t*)buffer;
+    while(count > 0)
+    {
+        uint32_t offset = sector % BlockSectors;
+        uint32_t chunk = BlockSectors - offset;
+        if(chunk > count)
+            chunk = count;
+
+        CacheBlock* block = GetBlock(sector / BlockSectors, true);
+        if(block == 0)
+            return false;
+        kmemcpy(out, block->data + offset * SectorSize, chunk * SectorSize);
+        Unpin(block, false);
+
+        out += chunk * SectorSize;
+        sector += chunk;
+        count -= chunk;
+    }
+    return true;
+}
+
+bool AtaDriver::Write(uint32_t sector, const void* buffer, uint32_t count)
+{
+    if(!present || sector + count > sectorCount || sector + count < sector)
+        return false;
+
+    const uint8_t* in = (const uint8_t*)buffer;
+    while(count > 0)
+    {
+        uint32_t offset = sector % BlockSectors;
+        uint32_t chunk = BlockSectors - offset;
+        if(chunk > count)
+            chunk = count;
+
+        CacheBlock* block = GetBlock(sector / BlockSectors, chunk != BlockSectors);
+        // A block that is overwritten completely doesn't have to be read first.
+        if(block == 0)
+            return false;
+        kmemcpy(block->data + offset * SectorSize, in, chunk * SectorSize);
+        Unpin(block, true);
+
+        in += chunk * SectorSize;
+        sector += chunk;
+        count -= chunk;
+    }
+    return true;
+}
+
+bool AtaDriver::Flush()
+{
+    if(!present)
+        return false;
+
+    IrqSpinLockGuard guard(&lock);
+    bool ok = true;
+    for(uint32_t i = 0; i < CacheBlocks; ++i)
+    {
+        if(blocks[i].dirty && !WriteBack(&blocks[i]))
+            ok = false;
+    }
+
+    WaitIdle();
+    WaitNotBusy();
+    SelectDevice(0);
+    commandPort.Write(CommandFlushCache);
+    controlPort.Read();
+    uint8_t status = WaitNotBusy();
+    commandPort.Read();
+
+    return ok && !(status & (StatusError | StatusDeviceFault));
+}
+
+bool AtaDriver::Present()
+{
+    return present;
+}
+
+uint32_t AtaDriver::SectorCount()
+{
+    return sectorCount;
+}
+
+const char* AtaDriver::Model()
+{
+    return model;
+}
+
+uint32_t AtaDriver::CacheHits()
+{
+    return hits;
+}
+
+uint32_t AtaDriver::CacheMisses()
+{
+    return misses;
+}
+
+uint32_t AtaDriver::ReadAheads()
+{
+    return readAheads;
+}
+
+uint32_t AtaDriver::WriteBacks()
+{
+    return writeBacks;
+}
+
+uint32_t AtaDriver::Errors()
+{
+    return errors;
+}
@@ -0,0 +1,205 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "types.h"
+#include "interrupts.h"
+#include "port.h"
+#include "ringbuffer.h"
+#include "spinlock.h"
+
+class AtaDriver : public InterruptHandler
+// PIO driver for one ATA disk on an IDE channel (primary master by default),
+// with a block cache in front of it.
+// The disk is read in 4 KiB blocks. Cached blocks are kept in LRU order and found
+// through a small hash table, and writes only dirty the cached copy; dirty blocks
+// go to the disk when they are evicted or on `Flush`. Reads are asynchronous
+// underneath: queued block loads are started one after another from the IRQ
+// handler, which also moves each sector out of the drive as it becomes ready. A
+// sequential reader therefore has the next blocks already on the way (read-ahead)
+// instead of paying the full device latency for each one.
+// Tasks on any CPU may use it at the same time: `lock` covers the cache, the
+// read queue and the drive, and a block stays in the cache while a caller copies
+// from or into it.
+{
+public:
+    static const uint32_t SectorSize = 512;
+    static const uint32_t BlockSectors = 8;
+    static const uint32_t BlockSize = SectorSize * BlockSectors;
+    static const uint32_t CacheBlocks = 64;         // 256 KiB of cache.
+    static const uint32_t ReadAheadBlocks = 4;
+
+private:
+    enum BlockState
+    {
+        BlockEmpty,
+        BlockLoading,       // Queued or being transferred.
+        BlockValid,
+        BlockError          // The read failed; the block is reloaded on the next access.
+    };
+
+    struct CacheBlock
+    {
+        uint32_t number;            // Block number on the disk.
+        uint8_t* data;
+        volatile uint8_t state;     // BlockState, changed by the IRQ handler.
+        bool dirty;
+        uint8_t users;              // Callers copying from or into `data`; not evicted meanwhile.
+        CacheBlock* newer;          // LRU list, most recently used first.
+        CacheBlock* older;
+        CacheBlock* hashNext;
+    };
+
+    static const uint32_t HashBuckets = 64;
+
+    Port16Bit dataPort;
+    // Data register (base + 0), 16 bits wide.
+
+    Port8Bit errorPort;
+    // Error (read) / features (write) register (base + 1).
+
+    Port8Bit sectorCountPort;
+    // Sector count (base + 2).
+
+    Port8Bit lbaLowPort;
+    Port8Bit lbaMidPort;
+    Port8Bit lbaHighPort;
+    // LBA bits 0-23 (base + 3 to base + 5).
+
+    Port8Bit devicePort;
+    // Drive select, LBA mode and LBA bits 24-27 (base + 6).
+
+    Port8Bit commandPort;
+    // Command (write) / status (read) register (base + 7). Reading it acknowledges the interrupt.
+
+    Port8Bit controlPort;
+    // Device control (write) / alternate status (read), e.g. 0x3F6. Reading it
+    // does not acknowledge the interrupt, so it is used for polling.
+
+    bool master;
+    bool present;
+    uint32_t sectorCount;
+    char model[41];
+
+    CacheBlock blocks[CacheBlocks];
+    CacheBlock* buckets[HashBuckets];
+    CacheBlock* newest;
+    CacheBlock* oldest;
+    uint8_t* cacheMemory;
+
+    SpinLock lock;
+    // Taken with IrqSpinLockGuard by callers and by the IRQ handler, which may
+    // run on another CPU. Everything below that says "`lock` held" runs with
+    // interrupts off.
+
+    RingBuffer<CacheBlock*, 16> readQueue;
+    // Blocks waiting for the drive, started in order by the IRQ handler.
+
+    CacheBlock* volatile inflight;
+    // Block whose read command the drive is executing, 0 if idle.
+
+    volatile uint32_t sectorsLeft;
+    uint8_t* transferCursor;
+
+    uint32_t lastBlock;
+    // Last block requested by a reader, to detect sequential access.
+
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readAheads;
+    uint32_t writeBacks;
+    volatile uint32_t errors;
+
+    static const uint32_t PollLimit = 0x100000;
+    // Status reads before a polled wait gives up, roughly 100 ms.
+
+    uint8_t WaitNotBusy();
+    // Polls the alternate status register until BSY clears (or a timeout); returns the status.
+
+    bool WaitDataRequest();
+    // Polls until the drive sets DRQ for a PIO transfer. False on an error, a
+    // device fault or a timeout.
+
+    void Reset();
+    // Software reset of the channel, to abort a command the drive got stuck in.
+
+    void SelectDevice(uint32_t lba);
+    // Selects the drive in LBA mode and waits the 400 ns the status register needs to follow.
+
+    bool Identify();
+    // Sends IDENTIFY DEVICE and reads the model and capacity.
+
+    void StartRead(CacheBlock* block);
+    // Issues READ SECTORS for a block (`lock` held).
+
+    void StartNext();
+    // Starts the next queued block if the drive is idle (`lock` held).
+
+    void Service();
+    // Handles a status change of the running command: transfers a ready sector,
+    // completes the block, or fails it (`lock` held).
+
+    bool Queue(CacheBlock* block);
+    // Marks a block as loading and hands it to the drive (`lock` held). Returns
+    // false, leaving the block alone, if the read queue is full.
+
+    void WaitFor(CacheBlock* block);
+    // Sleeps until a loading block is done (without `lock`). Works with
+    // interrupts off by polling.
+
+    void WaitIdle();
+    // Polls until the drive has finished every queued read (`lock` held).
+
+    bool WriteBack(CacheBlock* block);
+    // Writes a dirty block to the disk with WRITE SECTORS (`lock` held).
+
+    CacheBlock* Lookup(uint32_t number);
+    void Touch(CacheBlock* block);
+    void Unhash(CacheBlock* block);
+    void Hash(CacheBlock* block, uint32_t number);
+
+    CacheBlock* Evict(bool allowDirty);
+    // Frees the least recently used block that isn't loading or pinned. A dirty
+    // victim is written back first, unless `allowDirty` is false, in which case
+    // it is skipped.
+
+    void ReadAhead(uint32_t number);
+    // Queues the blocks following `number` that aren't cached yet.
+
+    CacheBlock* GetBlock(uint32_t number, bool load);
+    // Returns the cached block, loading it unless `load` is false (the caller
+    // overwrites all of it), and pins it until `Unpin`. Returns 0 on a read error.
+
+    void Unpin(CacheBlock* block, bool dirty);
+    // Done with a block from GetBlock; `dirty` if the caller wrote into it.
+
+public:
+    AtaDriver(InterruptManager* manager, bool master = true, uint16_t portBase = 0x1F0, uint16_t controlBase = 0x3F6, uint8_t irq = 14);
+    // Identifies the drive and allocates the cache. The primary channel uses
+    // 0x1F0/0x3F6 and IRQ14, the secondary 0x170/0x376 and IRQ15.
+
+    ~AtaDriver();
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+
+    bool Read(uint32_t sector, void* buffer, uint32_t count);
+    // Reads `count` sectors through the cache.
+
+    bool Write(uint32_t sector, const void* buffer, uint32_t count);
+    // Writes `count` sectors into the cache; they reach the disk later.
+
+    bool Flush();
+    // Writes all dirty blocks and flushes the drive's own write cache.
+
+    bool Present();
+    uint32_t SectorCount();
+    const char* Model();
+
+    uint32_t CacheHits();
+    uint32_t CacheMisses();
+    uint32_t ReadAheads();
+    // Blocks queued speculatively.
+    uint32_t WriteBacks();
+    uint32_t Errors();
+};
+
+#endif
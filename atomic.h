@@ -0,0 +1,34 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "types.h"
+
+// Locked read-modify-write operations for data shared between CPUs. Each one is
+// a full barrier for both the CPU and the compiler. Plain loads and stores of
+// aligned 32-bit words are atomic on x86 already.
+
+static inline bool AtomicCompareAndSwap(volatile uint32_t* target, uint32_t expected, uint32_t desired)
+// Stores `desired` if `*target` still holds `expected`; returns whether it did.
+{
+    uint8_t swapped;
+    __asm__ volatile("lock cmpxchgl %3, %1; sete %0"
+                     : "=q" (swapped), "+m" (*target), "+a" (expected)
+                     : "r" (desired)
+                     : "memory", "cc");
+    return swapped;
+}
+
+static inline uint32_t AtomicFetchAdd(volatile uint32_t* target, uint32_t value)
+// Adds `value` and returns the old contents.
+{
+    __asm__ volatile("lock xaddl %0, %1" : "+r" (value), "+m" (*target) : : "memory", "cc");
+    return value;
+}
+
+static inline void CpuRelax()
+// Spin-wait hint: `pause` saves power and avoids the memory-order flush when the spin ends.
+{
+    __asm__ volatile("pause" : : : "memory");
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "console.h"
+#include "memory.h"
+
+VgaConsole* VgaConsole::ActiveConsole = 0;
+
+VgaConsole::VgaConsole()
+: lock("console")
+{
+    video = (volatile uint16_t*)0xb8000;
+    attribute = (VgaBlack << 4) | VgaLightGrey;
+    hardwareCursor = 0xFFFF;
+    Clear();
+    ActiveConsole = this;
+}
+
+VgaConsole::~VgaConsole()
+{
+    if(ActiveConsole == this)
+        ActiveConsole = 0;
+}
+
+void VgaConsole::Scroll()
+{
+    kmemmove(shadow, shadow + Width, (Height - 1) * Width * sizeof(uint16_t));
+
+    // The blank row goes a dword (two cells) at a time; kmemset only repeats single bytes.
+    uint32_t blank = ((uint32_t)attribute << 8 | ' ') * 0x00010001;
+    uint32_t* dst = (uint32_t*)(shadow + (Height - 1) * Width);
+    uint32_t count = Width / 2;
+    __asm__ volatile("rep stosl" : "+D" (dst), "+c" (count) : "a" (blank) : "memory");
+
+    dirtyRows = (1u << Height) - 1;
+}
+
+void VgaConsole::PutCharLocked(char c)
+{
+    switch(c)
+    {
+        case '\n':
+            col = 0;
+            row++;
+            break;
+
+        case '\r':
+            col = 0;
+            break;
+
+        case '\t':
+            col = (col + 8) & ~7;
+            // Advance to the next multiple of 8; wraps below like any other character.
+            break;
+
+        case '\b':
+            if(col > 0)
+                col--;
+            else if(row > 0)
+            {
+                row--;
+                col = Width - 1;
+            }
+            shadow[Width * row + col] = (uint16_t)attribute << 8 | ' ';
+            dirtyRows |= 1u << row;
+            break;
+
+        default:
+            shadow[Width * row + col] = (uint16_t)attribute << 8 | (uint8_t)c;
+            dirtyRows |= 1u << row;
+            col++;
+            break;
+    }
+
+    if(col >= Width)
+    {
+        col = 0;
+        row++;
+    }
+    if(row >= Height)
+    {
+        Scroll();
+        row = Height - 1;
+    }
+}
+
+void VgaConsole::PutChar(char c)
+{
+    IrqSpinLockGuard guard(&lock);
+    PutCharLocked(c);
+}
+
+void VgaConsole::Write(const char* str)
+{
+    IrqSpinLockGuard guard(&lock);
+    for(int i = 0; str[i] != '\0'; ++i)
+        PutCharLocked(str[i]);
+}
+
+void VgaConsole::Write(const char* str, uint32_t length)
+{
+    IrqSpinLockGuard guard(&lock);
+    for(uint32_t i = 0; i < length; ++i)
+        PutCharLocked(str[i]);
+}
+
+void VgaConsole::SetColor(VgaColor foreground, VgaColor background)
+{
+    attribute = (background << 4) | (foreground & 0x0F);
+}
+
+void VgaConsole::SetAttribute(uint8_t attribute)
+{
+    this->attribute = attribute;
+}
+
+uint8_t VgaConsole::Attribute()
+{
+    return attribute;
+}
+
+void VgaConsole::Clear()
+{
+    IrqSpinLockGuard guard(&lock);
+    uint32_t blank = ((uint32_t)attribute << 8 | ' ') * 0x00010001;
+    uint32_t* dst = (uint32_t*)shadow;
+    uint32_t count = Width * Height / 2;
+    __asm__ volatile("rep stosl" : "+D" (dst), "+c" (count) : "a" (blank) : "memory");
+    row = 0;
+    col = 0;
+    dirtyRows = (1u << Height) - 1;
+}
+
+void VgaConsole::Flush()
+{
+    if(dirtyRows == 0)
+        return;
+
+    // Take the dirty set atomically. A row that is written again while we copy it
+    // gets marked dirty again and is simply copied on the next flush.
+    uint32_t rows = 0;
+    __asm__ volatile("xchgl %0, %1" : "+r" (rows), "+m" (dirtyRows) : : "memory");
+
+    while(rows != 0)
+    {
+        uint32_t r;
+        __asm__("bsfl %1, %0" : "=r" (r) : "rm" (rows));
+        rows &= rows - 1;
+
+        kmemcpy((uint16_t*)(video + Width * r), shadow + Width * r, Width * sizeof(uint16_t));
+    }
+
+    uint16_t position = Width * row + col;
+    if(position != hardwareCursor)
+        MoveHardwareCursor(position);
+}
+
+bool VgaConsole::Pending()
+{
+    return dirtyRows != 0 || Width * row + col != hardwareCursor;
+}
+
+void VgaConsole::Run()
+{
+    Flush();
+}
+
+void VgaConsole::MoveHardwareCursor(uint16_t position)
+{
+    CrtcIndexPort::Write(0x0F);                 // Cursor location low register.
+    CrtcDataPort::Write(position & 0xFF);
+    CrtcIndexPort::Write(0x0E);                 // Cursor location high register.
+    CrtcDataPort::Write((position >> 8) & 0xFF);
+    hardwareCursor = position;
+}
@@ -0,0 +1,121 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "types.h"
+#include "port.h"
+#include "staticport.h"
+#include "idle.h"
+#include "kprintf.h"
+#include "spinlock.h"
+
+enum VgaColor
+{
+    VgaBlack = 0,
+    VgaBlue = 1,
+    VgaGreen = 2,
+    VgaCyan = 3,
+    VgaRed = 4,
+    VgaMagenta = 5,
+    VgaBrown = 6,
+    VgaLightGrey = 7,
+    VgaDarkGrey = 8,
+    VgaLightBlue = 9,
+    VgaLightGreen = 10,
+    VgaLightCyan = 11,
+    VgaLightRed = 12,
+    VgaLightMagenta = 13,
+    VgaYellow = 14,
+    VgaWhite = 15
+};
+
+class VgaConsole : public KPrintfSink, public DeferredWork
+// 80x25 VGA text console.
+// All output goes to a shadow copy of the screen in RAM; rows that changed are
+// marked dirty and copied to video memory by `Flush`, so printing (even from an
+// interrupt handler) only touches normal memory and the slow MMIO writes are batched.
+// The idle loop calls `Flush` (as `Run`) whenever something changed.
+{
+public:
+    static const uint16_t Width = 80;
+    static const uint16_t Height = 25;
+
+private:
+    uint16_t shadow[Width * Height] __attribute__((aligned(4)));
+    // Character/attribute pairs, laid out exactly like video memory.
+
+    volatile uint16_t* video;
+    // The text mode framebuffer at 0xb8000.
+
+    volatile uint32_t dirtyRows;
+    // Bit n is set when row n of `shadow` differs from video memory.
+
+    uint16_t row;
+    uint16_t col;
+    // Position where the next character goes.
+
+    uint16_t hardwareCursor;
+    // Cell the CRTC cursor was last moved to, to skip redundant port writes.
+
+    uint8_t attribute;
+    // Attribute byte (background << 4 | foreground) for new characters.
+
+    typedef StaticPort<0x3D4> CrtcIndexPort;
+    // CRTC index register (I/O port 0x3D4).
+
+    typedef StaticPort<0x3D5> CrtcDataPort;
+    // CRTC data register (I/O port 0x3D5).
+
+    SpinLock lock;
+    // Guards the shadow buffer and the position; held with interrupts off, as
+    // interrupt handlers print too.
+
+    void PutCharLocked(char c);
+    // Writes one character; `lock` must be held.
+
+    void Scroll();
+    // Moves every row up by one and blanks the last row.
+
+    void MoveHardwareCursor(uint16_t position);
+    // Programs the CRTC cursor location registers (0x0E/0x0F).
+
+public:
+    static VgaConsole* ActiveConsole;
+    // Console used by `printf`, set by the constructor.
+
+    VgaConsole();
+    // Clears the screen and takes over video memory.
+
+    ~VgaConsole();
+
+    void PutChar(char c);
+    // Writes a character, handling '\n', '\r', '\t' and '\b'.
+
+    void Write(const char* str);
+    // Writes a NUL-terminated string.
+
+    virtual void Write(const char* str, uint32_t length);
+    // Writes `length` characters of `str`. This is also the `kprintf` sink entry point.
+
+    void SetColor(VgaColor foreground, VgaColor background);
+    // Sets the colours used for characters written from now on.
+
+    void SetAttribute(uint8_t attribute);
+    // Sets the raw attribute byte used for characters written from now on.
+
+    uint8_t Attribute();
+    // Returns the current attribute byte.
+
+    void Clear();
+    // Blanks the whole screen and moves the cursor home.
+
+    void Flush();
+    // Copies the dirty rows to video memory and updates the hardware cursor.
+
+    virtual bool Pending();
+    // Whether rows are dirty or the cursor moved since the last `Flush`.
+
+    virtual void Run();
+    // Same as `Flush`.
+};
+
+#endif
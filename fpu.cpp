@@ -0,0 +1,158 @@
+#include "fpu.h"
+#include "smp.h"
+#include "multitasking.h"
+
+static const uint32_t Cr0MonitorCoprocessor = 0x02;
+static const uint32_t Cr0Emulation = 0x04;
+static const uint32_t Cr0TaskSwitched = 0x08;
+static const uint32_t Cr0NumericError = 0x20;
+static const uint32_t Cr4OsFxsr = 0x200;
+static const uint32_t Cr4OsXmmExceptions = 0x400;
+
+static inline void SetTaskSwitched()
+{
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    if(!(cr0 & Cr0TaskSwitched))
+        __asm__ volatile("mov %0, %%cr0" : : "r" (cr0 | Cr0TaskSwitched) : "memory");
+    // Writing CR0 serializes the CPU; skip it when TS is still set from the last switch.
+}
+
+uint8_t FpuManager::initialState[FpuManager::StateSize] __attribute__((aligned(16)));
+FpuManager* FpuManager::ActiveFpuManager = 0;
+
+FpuManager::FpuManager(InterruptManager* manager)
+: InterruptHandler(manager, DeviceNotAvailableVector)
+{
+    enabled = Supported();
+    unsigned int eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    sse = enabled && (edx & (1 << 25)) && (edx & (1 << 26));
+    // SSE and SSE2 together; the kernel has no use for SSE alone.
+
+    if(!enabled)
+        return;
+    InitializeCpu();
+
+    __asm__ volatile("clts; fninit" : : : "memory");
+    Save(initialState);
+    SetTaskSwitched();
+    ActiveFpuManager = this;
+}
+
+FpuManager::~FpuManager()
+{
+    if(ActiveFpuManager == this)
+        ActiveFpuManager = 0;
+}
+
+bool FpuManager::Supported()
+{
+    unsigned int eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    return (edx & (1 << 0)) && (edx & (1 << 24));
+}
+
+bool FpuManager::Enabled()
+{
+    return enabled;
+}
+
+bool FpuManager::SseEnabled()
+{
+    return sse;
+}
+
+void FpuManager::InitializeCpu()
+{
+    if(!enabled)
+        return;
+
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    cr0 &= ~Cr0Emulation;
+    cr0 |= Cr0MonitorCoprocessor | Cr0NumericError | Cr0TaskSwitched;
+    // MP makes `wait` honour TS too; NE reports FPU errors as #MF instead of through the 8259.
+    __asm__ volatile("mov %0, %%cr0" : : "r" (cr0) : "memory");
+
+    if(sse)
+    {
+        uint32_t cr4;
+        __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+        cr4 |= Cr4OsFxsr | Cr4OsXmmExceptions;
+        __asm__ volatile("mov %0, %%cr4" : : "r" (cr4));
+    }
+}
+
+void FpuManager::SwitchTask(Cpu* cpu, Task* outgoing)
+{
+    if(cpu->fpuOwner == outgoing && cpu->fpuDirty)
+    {
+        if(outgoing->state == Task::Finished)
+        {
+            cpu->fpuOwner = 0;
+            cpu->fpuDirty = false;
+        }
+        else if(!outgoing->pinned && SmpManager::ActiveSmpManager->CpuCount() > 1)
+        {
+            Save(outgoing->fpuState);
+            cpu->fpuDirty = false;
+        }
+        // The registers stay valid for the task, so coming back here costs no restore.
+    }
+    SetTaskSwitched();
+}
+
+uint32_t FpuManager::Acquire()
+{
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+    __asm__ volatile("clts");
+
+    Cpu* cpu = Cpu::Current();
+    if(cpu != 0 && cpu->fpuOwner != 0)
+    {
+        if(cpu->fpuDirty)
+            Save(cpu->fpuOwner->fpuState);
+        cpu->fpuOwner = 0;
+        cpu->fpuDirty = false;
+    }
+    // Its state is in memory now; the next #NM loads it back.
+    return eflags;
+}
+
+void FpuManager::Release(uint32_t eflags)
+{
+    SetTaskSwitched();
+    __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+}
+
+unsigned int FpuManager::HandleInterrupt(unsigned int esp)
+{
+    Cpu* cpu = Cpu::Current();
+    TaskManager* manager = TaskManager::Current();
+    __asm__ volatile("clts");
+    if(manager == 0)
+        return esp;
+    // No tasks yet: whoever runs owns the FPU.
+
+    Task* task = manager->CurrentTask();
+
+    if(cpu->fpuOwner == task && task->fpuCpu == cpu)
+    {
+        cpu->fpuDirty = true;
+        return esp;
+    }
+    // This CPU's registers still hold the task's state.
+
+    if(cpu->fpuOwner != 0 && cpu->fpuDirty)
+        Save(cpu->fpuOwner->fpuState);
+    Restore(task->fpuUsed ? task->fpuState : initialState);
+
+    task->fpuUsed = true;
+    task->fpuCpu = cpu;
+    cpu->fpuOwner = task;
+    cpu->fpuDirty = true;
+    return esp;
+    // The faulting instruction is retried with TS clear.
+}
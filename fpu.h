@@ -0,0 +1,79 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+#include "interrupts.h"
+
+class Cpu;
+class Task;
+
+class FpuManager : public InterruptHandler
+// Turns on the x87 FPU and SSE and switches their state between tasks lazily.
+// Every task switch sets CR0.TS, so the first FPU or SSE instruction a task
+// runs raises #NM (exception 0x07). Only then does the handler save the state
+// of the task that last used this CPU's FPU and load the current task's. A task
+// that never touches the FPU never costs a 512-byte FXSAVE.
+// A task that may move to another CPU has its state saved when it is switched
+// out after using the FPU, because the other CPU can't reach these registers.
+{
+public:
+    static const uint32_t StateSize = 512;
+    // FXSAVE area.
+
+    static const uint8_t DeviceNotAvailableVector = 0x07;
+
+private:
+    static uint8_t initialState[StateSize] __attribute__((aligned(16)));
+    // State right after `fninit`, loaded for a task's first FPU instruction.
+
+    bool enabled;
+    bool sse;
+
+    static inline void Save(uint8_t* state)
+    {
+        __asm__ volatile("fxsave (%0)" : : "r" (state) : "memory");
+    }
+
+    static inline void Restore(const uint8_t* state)
+    {
+        __asm__ volatile("fxrstor (%0)" : : "r" (state) : "memory");
+    }
+
+public:
+    static FpuManager* ActiveFpuManager;
+
+    FpuManager(InterruptManager* manager);
+    // Enables the FPU (and SSE if present) on the calling CPU. Must come before
+    // the other processors start.
+
+    ~FpuManager();
+
+    static bool Supported();
+    // An FPU with FXSAVE/FXRSTOR.
+
+    bool Enabled();
+
+    bool SseEnabled();
+    // SSE and SSE2 instructions may be used (through #NM like any FPU use).
+
+    void InitializeCpu();
+    // Sets CR0 and CR4 up on the calling CPU and leaves TS set.
+
+    void SwitchTask(Cpu* cpu, Task* outgoing);
+    // Called by the scheduler when `outgoing` leaves the CPU: sets TS and, if the
+    // task used the FPU and may run elsewhere next, saves its state.
+
+    uint32_t Acquire();
+    // Lets kernel code use the FPU/SSE registers: disables interrupts, saves the
+    // registers' owner if needed and clears TS. Returns the flags for `Release`.
+    // Keep the section short; the registers hold nothing of value afterwards.
+
+    void Release(uint32_t eflags);
+    // Sets TS again, so the current task's next FPU instruction reloads its
+    // state, and restores the interrupt flag.
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+    // #NM: hands the FPU to the current task.
+};
+
+#endif
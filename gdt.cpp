@@ -5,8 +5,13 @@ GDT::GDT()
     // Initializing the segment selectors with specific parameters.
     : nullSegmentSelector(0, 0, 0),                      // null segment with base 0, limit 0, type 0
       unusedSegmentSelector(0, 0, 0),                    // unused segment with base 0, limit 0, type 0
-      codeSegmentSelector(0, 64 * 1024 * 1024, 0x9A),    // code segment with base 0, 64MB limit, type 0x9A (code segment, read/write, accessed)
-      dataSegmentSelector(0, 64 * 1024 * 1024, 0x92)     // data segment with base 0, 64MB limit, type 0x92 (data segment, read/write, accessed)
+      codeSegmentSelector(0, 0xFFFFFFFF, 0x9A),          // code segment with base 0, 4GB limit, type 0x9A (code segment, read/write, accessed)
+      dataSegmentSelector(0, 0xFFFFFFFF, 0x92),          // data segment with base 0, 4GB limit, type 0x92 (data segment, read/write, accessed)
+      // Flat segments: the page tables (seen at 0xFFC00000), MMIO and RAM above 64MB must all be reachable
+      userCodeSegmentSelector(0, 0xFFFFFFFF, 0xFA),      // user code segment, like the code segment with DPL 3
+      userDataSegmentSelector(0, 0xFFFFFFFF, 0xF2),      // user data segment, like the data segment with DPL 3
+      perCpuSegmentSelector(0, 0xFFFFFFFF, 0x92),        // per-CPU segment, flat until SetPerCpuBase gives it its block
+      taskStateSegmentSelector(0, 0, 0)                  // no TSS until SetTaskStateSegment
 {
     unsigned int i[2];
     i[1] = (unsigned int)this;                       // Store the address of this GDT object in i[1]
@@ -31,6 +36,53 @@ unsigned short int GDT::CSS()
     return (unsigned char *)&codeSegmentSelector - (unsigned char *)this;  // Calculate the offset of the code segment
 }
 
+// Returns the offset of the per-CPU Segment Selector (PSS) within the GDT object
+unsigned short int GDT::PSS()
+{
+    return (unsigned char *)&perCpuSegmentSelector - (unsigned char *)this;  // Same offset in every CPU's GDT
+}
+
+// Returns the selector of the user code segment, with the requested privilege level 3
+unsigned short int GDT::UserCSS()
+{
+    return ((unsigned char *)&userCodeSegmentSelector - (unsigned char *)this) | 3;
+}
+
+// Returns the selector of the user data segment, with the requested privilege level 3
+unsigned short int GDT::UserDSS()
+{
+    return ((unsigned char *)&userDataSegmentSelector - (unsigned char *)this) | 3;
+}
+
+// Points the per-CPU segment at a block of `size` bytes and loads %gs with it
+void GDT::SetPerCpuBase(unsigned int base, unsigned int size)
+{
+    perCpuSegmentSelector = SD(base, size, 0x92);    // Byte granular for sizes up to 64KB
+    asm volatile("mov %0, %%gs" : : "r"(PSS()));     // Loading the selector reads the new descriptor
+}
+
+// Installs `tss` as this CPU's task state segment
+void GDT::SetTaskStateSegment(TaskStateSegment* tss)
+{
+    taskStateSegmentSelector = SD((unsigned int)tss, sizeof(TaskStateSegment) - 1, 0x89);  // 32-bit TSS, available
+    unsigned short int selector = (unsigned char *)&taskStateSegmentSelector - (unsigned char *)this;
+    asm volatile("ltr %0" : : "r"(selector));        // Marks the descriptor busy, so it is rebuilt above before every load
+}
+
+// Reloads the segment registers from this GDT (a descriptor is only read when its selector is loaded)
+void GDT::LoadSegments()
+{
+    asm volatile("pushl %0\n"
+                 "pushl $1f\n"
+                 "lret\n"                            // Far return to the next instruction to reload cs
+                 "1:\n"
+                 "mov %1, %%ds\n"
+                 "mov %1, %%es\n"
+                 "mov %1, %%fs\n"
+                 "mov %1, %%ss"
+                 : : "r"((unsigned int)CSS()), "r"((unsigned int)DSS()) : "memory");
+}
+
 // Constructor for SD (Segment Descriptor) class
 SD::SD(unsigned int base, unsigned int limit, unsigned char type)
 {
@@ -38,6 +90,8 @@ SD::SD(unsigned int base, unsigned int limit, unsigned char type)
 
     // Set the 6th byte based on the limit size (16-bit or 32-bit address space)
     target[6] = (limit <= 65536) ? 0x40 : 0xC0;   // If limit <= 65536, set it to 16-bit address, else 32-bit
+    if (!(type & 0x10))
+        target[6] &= ~0x40;                        // System descriptors (TSS) have no default size bit
 
     // Adjust the limit if it's greater than 65536 (for 32-bit address space)
     if (limit > 65536) {
@@ -59,6 +113,15 @@ SD::SD(unsigned int base, unsigned int limit, unsigned char type)
     target[5] = type;
 }
 
+// Zeroes the TSS; only ss0, esp0 and the I/O map base are ever used
+TaskStateSegment::TaskStateSegment()
+{
+    unsigned char *target = (unsigned char *)this;
+    for (unsigned int i = 0; i < sizeof(TaskStateSegment); ++i)
+        target[i] = 0;
+    ioMapBase = sizeof(TaskStateSegment);
+}
+
 // Returns the base address of the segment described by this SD object
 unsigned int SD::Base()
 {
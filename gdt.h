@@ -16,6 +16,31 @@ class SD
         unsigned int Limit();
 } __attribute__((packed)); // Ensures that the structure is packed without padding between fields
 
+// 32-bit Task State Segment. The kernel doesn't switch tasks through it; it only
+// holds the stack (ss0:esp0) the CPU switches to when an interrupt or sysenter
+// leaves ring 3. Each CPU has its own, see Cpu::tss.
+class TaskStateSegment
+{
+    public:
+        unsigned int previousTask;
+        unsigned int esp0;             // Kernel stack of the running task, updated on every task switch
+        unsigned int ss0;              // Kernel data selector
+        unsigned int esp1;
+        unsigned int ss1;
+        unsigned int esp2;
+        unsigned int ss2;
+        unsigned int cr3;
+        unsigned int eip;
+        unsigned int eflags;
+        unsigned int eax, ecx, edx, ebx, esp, ebp, esi, edi;
+        unsigned int es, cs, ss, ds, fs, gs;
+        unsigned int ldt;
+        unsigned short int trap;
+        unsigned short int ioMapBase;  // Points past the segment limit: no I/O port is open to ring 3
+
+        TaskStateSegment();
+} __attribute__((packed));
+
 class GDT
 {
     private:
@@ -23,10 +48,20 @@ class GDT
         SD unusedSegmentSelector;
         SD codeSegmentSelector;
         SD dataSegmentSelector;
+        SD userCodeSegmentSelector;    // Ring 3 code; sysexit expects it 16 bytes after the kernel code segment
+        SD userDataSegmentSelector;    // Ring 3 data and stack, 24 bytes after the kernel code segment
+        SD perCpuSegmentSelector;      // Data segment over the CPU's own per-CPU block, loaded into %gs
+        SD taskStateSegmentSelector;   // The CPU's TSS, see SetTaskStateSegment
     public:
         GDT();
         ~GDT();
         unsigned short int CSS();
         unsigned short int DSS();
+        unsigned short int PSS();
+        unsigned short int UserCSS();                               // Ring 3 code selector, RPL 3 included
+        unsigned short int UserDSS();                               // Ring 3 data selector, RPL 3 included
+        void SetPerCpuBase(unsigned int base, unsigned int size);  // Points the per-CPU segment at `base` and loads it into %gs
+        void SetTaskStateSegment(TaskStateSegment* tss);            // Points the TSS descriptor at `tss` and loads the task register
+        void LoadSegments();                                        // Reloads cs, ds, es, fs and ss with this GDT's flat selectors
 };
 #endif
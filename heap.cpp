@@ -0,0 +1,310 @@
+#include "heap.h"
+#include "kprintf.h"
+#include "arith.h"
+
+KernelHeap* KernelHeap::ActiveHeap = 0;
+
+static const char* const ClassLockNames[KernelHeap::SizeClassCount] = {
+    "heap 16", "heap 32", "heap 64", "heap 128", "heap 256", "heap 512", "heap 1024", "heap 2048"
+};
+
+KernelHeap::KernelHeap(PhysicalMemoryManager* pmm)
+{
+    this->pmm = pmm;
+    for(uint32_t i = 0; i < SizeClassCount; ++i)
+    {
+        caches[i].partial = 0;
+        caches[i].empty = 0;
+        caches[i].statistics.objectSize = MinimumClassSize << i;
+        caches[i].statistics.allocations = 0;
+        caches[i].statistics.hits = 0;
+        caches[i].statistics.misses = 0;
+        caches[i].statistics.frees = 0;
+        caches[i].statistics.liveObjects = 0;
+        caches[i].statistics.slabs = 0;
+        caches[i].lock.SetName(ClassLockNames[i]);
+    }
+    bytesLive = 0;
+    bytesReserved = 0;
+    largeAllocations = 0;
+    largeFrees = 0;
+    failures = 0;
+    ActiveHeap = this;
+}
+
+KernelHeap::~KernelHeap()
+{
+    if(ActiveHeap == this)
+        ActiveHeap = 0;
+}
+
+uint32_t KernelHeap::SizeClassIndex(uint32_t size)
+{
+    if(size <= MinimumClassSize)
+        return 0;
+    uint32_t highest;
+    __asm__("bsrl %1, %0" : "=r" (highest) : "rm" (size - 1));
+    // 2^(highest + 1) is the smallest power of two >= size; class 0 is 2^4.
+    return highest + 1 - 4;
+}
+
+void KernelHeap::Push(SizeClass* cache, SlabHeader* slab)
+{
+    slab->prev = 0;
+    slab->next = cache->partial;
+    if(cache->partial != 0)
+        cache->partial->prev = slab;
+    cache->partial = slab;
+}
+
+void KernelHeap::Unlink(SizeClass* cache, SlabHeader* slab)
+{
+    if(slab->prev != 0)
+        slab->prev->next = slab->next;
+    else
+        cache->partial = slab->next;
+    if(slab->next != 0)
+        slab->next->prev = slab->prev;
+    slab->next = 0;
+    slab->prev = 0;
+}
+
+KernelHeap::SlabHeader* KernelHeap::CreateSlab(uint32_t sizeClass)
+{
+    const uint32_t frames = SlabSize / PhysicalMemoryManager::FrameSize;
+    uint32_t address = pmm->AllocateFrames(frames, frames);
+    // Aligning the slab to its size is what lets `Free` find the header by masking.
+    if(address == 0)
+        return 0;
+
+    SlabHeader* slab = (SlabHeader*)address;
+    slab->magic = SlabMagic;
+    slab->sizeClass = sizeClass;
+    slab->frames = frames;
+    slab->size = 0;
+    slab->freeList = 0;
+    slab->nextUnused = sizeof(SlabHeader);
+    // Objects are carved off lazily, so a new slab touches only its first page.
+    slab->inUse = 0;
+    slab->next = 0;
+    slab->prev = 0;
+
+    caches[sizeClass].statistics.slabs++;
+    AtomicFetchAdd(&bytesReserved, SlabSize);
+    return slab;
+}
+
+void* KernelHeap::Allocate(uint32_t size)
+{
+    if(size == 0)
+        size = 1;
+    if(size > MaximumClassSize)
+        return AllocateLarge(size);
+
+    uint32_t index = SizeClassIndex(size);
+    SizeClass* cache = &caches[index];
+    uint32_t objectSize = cache->statistics.objectSize;
+
+    IrqSpinLockGuard guard(&cache->lock);
+    // The heap is used from tasks and from interrupt handlers alike.
+
+    SlabHeader* slab = cache->partial;
+    if(slab != 0)
+        cache->statistics.hits++;
+    else
+    {
+        cache->statistics.misses++;
+        slab = cache->empty;
+        if(slab != 0)
+            cache->empty = 0;
+        else
+            slab = CreateSlab(index);
+        if(slab == 0)
+        {
+            AtomicFetchAdd(&failures, 1);
+            return 0;
+        }
+        Push(cache, slab);
+    }
+
+    void* object;
+    if(slab->freeList != 0)
+    {
+        object = slab->freeList;
+        slab->freeList = *(void**)object;
+    }
+    else
+    {
+        object = (uint8_t*)slab + slab->nextUnused;
+        slab->nextUnused += objectSize;
+    }
+    slab->inUse++;
+
+    if(slab->freeList == 0 && slab->nextUnused + objectSize > SlabSize)
+        Unlink(cache, slab);
+    // The slab is full now; it goes back on the list when an object is freed.
+
+    cache->statistics.allocations++;
+    cache->statistics.liveObjects++;
+    AtomicFetchAdd(&bytesLive, objectSize);
+    return object;
+}
+
+void* KernelHeap::AllocateLarge(uint32_t size)
+{
+    const uint32_t alignFrames = SlabSize / PhysicalMemoryManager::FrameSize;
+    uint32_t frames = (size + sizeof(SlabHeader) + PhysicalMemoryManager::FrameSize - 1) / PhysicalMemoryManager::FrameSize;
+
+    uint32_t address = pmm->AllocateFrames(frames, alignFrames);
+    // The same alignment as a slab, so `Free` can mask any heap pointer to its header.
+    if(address == 0)
+    {
+        AtomicFetchAdd(&failures, 1);
+        return 0;
+    }
+
+    SlabHeader* block = (SlabHeader*)address;
+    block->magic = LargeMagic;
+    block->sizeClass = 0;
+    block->frames = frames;
+    block->size = size;
+    block->freeList = 0;
+    block->nextUnused = 0;
+    block->inUse = 1;
+    block->next = 0;
+    block->prev = 0;
+
+    AtomicFetchAdd(&largeAllocations, 1);
+    AtomicFetchAdd(&bytesLive, size);
+    AtomicFetchAdd(&bytesReserved, frames * PhysicalMemoryManager::FrameSize);
+
+    return block + 1;
+}
+
+void KernelHeap::Free(void* pointer)
+{
+    if(pointer == 0)
+        return;
+
+    SlabHeader* slab = (SlabHeader*)((uint32_t)pointer & ~(SlabSize - 1));
+
+    if(slab->magic == LargeMagic)
+    {
+        uint32_t frames = slab->frames;
+        AtomicFetchAdd(&largeFrees, 1);
+        AtomicFetchAdd(&bytesLive, -slab->size);
+        AtomicFetchAdd(&bytesReserved, -(frames * PhysicalMemoryManager::FrameSize));
+
+        slab->magic = 0;
+        pmm->FreeFrames((uint32_t)slab, frames);
+        return;
+    }
+
+    if(slab->magic != SlabMagic)
+        return;
+    // Not a heap pointer; ignoring it is safer than corrupting a free list.
+
+    SizeClass* cache = &caches[slab->sizeClass];
+    uint32_t objectSize = cache->statistics.objectSize;
+
+    IrqSpinLockGuard guard(&cache->lock);
+
+    bool wasFull = slab->freeList == 0 && slab->nextUnused + objectSize > SlabSize;
+
+    *(void**)pointer = slab->freeList;
+    slab->freeList = pointer;
+    slab->inUse--;
+
+    cache->statistics.frees++;
+    cache->statistics.liveObjects--;
+    AtomicFetchAdd(&bytesLive, -objectSize);
+
+    if(wasFull)
+        Push(cache, slab);
+
+    if(slab->inUse == 0)
+    {
+        // Keep one empty slab per class for the next burst, give the rest back.
+        Unlink(cache, slab);
+        if(cache->empty == 0)
+            cache->empty = slab;
+        else
+        {
+            slab->magic = 0;
+            cache->statistics.slabs--;
+            AtomicFetchAdd(&bytesReserved, -SlabSize);
+            pmm->FreeFrames((uint32_t)slab, SlabSize / PhysicalMemoryManager::FrameSize);
+        }
+    }
+}
+
+uint32_t KernelHeap::BytesLive()
+{
+    return bytesLive;
+}
+
+uint32_t KernelHeap::BytesReserved()
+{
+    return bytesReserved;
+}
+
+void KernelHeap::Statistics(uint32_t sizeClass, SizeClassStatistics* statistics)
+{
+    if(sizeClass >= SizeClassCount)
+        return;
+    IrqSpinLockGuard guard(&caches[sizeClass].lock);
+    *statistics = caches[sizeClass].statistics;
+}
+
+void KernelHeap::DumpStatistics()
+{
+    kprintf("heap: %u bytes live, %u bytes reserved", bytesLive, bytesReserved);
+    if(bytesReserved != 0)
+        kprintf(", %u%% fragmentation", 100 - (uint32_t)DivU64((uint64_t)bytesLive * 100, bytesReserved));
+    kprintf("\n");
+
+    for(uint32_t i = 0; i < SizeClassCount; ++i)
+    {
+        SizeClassStatistics& s = caches[i].statistics;
+        if(s.allocations == 0)
+            continue;
+        kprintf("  %4u: %u live, %u slabs, %u allocs, %u%% hit\n",
+                s.objectSize, s.liveObjects, s.slabs, s.allocations,
+                (uint32_t)DivU64((uint64_t)s.hits * 100, s.allocations));
+    }
+    kprintf("  large: %u allocs, %u frees, %u failures\n", largeAllocations, largeFrees, failures);
+}
+
+
+void* operator new(size_t size) noexcept
+{
+    if(KernelHeap::ActiveHeap == 0)
+        return 0;
+    return KernelHeap::ActiveHeap->Allocate(size);
+}
+
+void* operator new[](size_t size) noexcept
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer)
+{
+    if(KernelHeap::ActiveHeap != 0)
+        KernelHeap::ActiveHeap->Free(pointer);
+}
+
+void operator delete[](void* pointer)
+{
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t)
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, size_t)
+{
+    operator delete(pointer);
+}
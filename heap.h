@@ -0,0 +1,125 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "types.h"
+#include "pmm.h"
+#include "spinlock.h"
+
+class KernelHeap
+// Kernel heap on top of the physical frame allocator.
+// Small objects come from per-size-class slab caches: every slab is a naturally
+// aligned 16 KiB block holding objects of one size, so `Free` finds the slab (and
+// with it the size class) by masking the pointer, and allocating or freeing is a
+// free-list push/pop. Anything larger than the biggest class gets its own run of
+// frames with the same header layout. Every size class has its own lock, so CPUs
+// allocating different sizes don't wait for each other; the byte counters are
+// updated atomically.
+{
+public:
+    static const uint32_t SlabSize = 16 * 1024;
+    static const uint32_t SizeClassCount = 8;
+    // Classes are 16, 32, ..., 2048 bytes.
+
+    static const uint32_t MinimumClassSize = 16;
+    static const uint32_t MaximumClassSize = MinimumClassSize << (SizeClassCount - 1);
+
+    struct SizeClassStatistics
+    {
+        uint32_t objectSize;
+        uint32_t allocations;   // Successful allocations.
+        uint32_t hits;          // Allocations served from a slab that already existed.
+        uint32_t misses;        // Allocations that had to create a new slab.
+        uint32_t frees;
+        uint32_t liveObjects;
+        uint32_t slabs;         // Slabs currently owned by this class.
+    };
+
+private:
+    struct SlabHeader
+    {
+        uint32_t magic;         // SlabMagic or LargeMagic; catches frees of foreign pointers.
+        uint32_t sizeClass;     // Index into `caches` (small slabs only).
+        uint32_t frames;        // Frames backing this block (large blocks only).
+        uint32_t size;          // Requested size (large blocks only).
+        void* freeList;         // Freed objects, linked through their first word.
+        uint32_t nextUnused;    // Offset of the first never-used object.
+        uint32_t inUse;         // Objects handed out from this slab.
+        SlabHeader* next;
+        SlabHeader* prev;       // Links in the class's list of slabs with free objects.
+    } __attribute__((aligned(16)));
+
+    struct SizeClass
+    {
+        SlabHeader* partial;    // Slabs with at least one free object.
+        SlabHeader* empty;      // One completely free slab kept around to avoid thrashing the PMM.
+        SizeClassStatistics statistics;
+        SpinLock lock;          // Guards the lists and statistics; held with interrupts off.
+    };
+
+    static const uint32_t SlabMagic = 0x51AB51AB;
+    static const uint32_t LargeMagic = 0x1A26E000;
+
+    PhysicalMemoryManager* pmm;
+    SizeClass caches[SizeClassCount];
+
+    volatile uint32_t bytesLive;        // Bytes handed out (rounded to the size class for small objects).
+    volatile uint32_t bytesReserved;    // Bytes of frames owned by the heap.
+    volatile uint32_t largeAllocations;
+    volatile uint32_t largeFrees;
+    volatile uint32_t failures;
+
+    static uint32_t SizeClassIndex(uint32_t size);
+    // Smallest class that fits `size` (which must be <= MaximumClassSize).
+
+    SlabHeader* CreateSlab(uint32_t sizeClass);
+    void Unlink(SizeClass* cache, SlabHeader* slab);
+    void Push(SizeClass* cache, SlabHeader* slab);
+
+    void* AllocateLarge(uint32_t size);
+
+public:
+    static KernelHeap* ActiveHeap;
+    // Heap behind operator new/delete, set by the constructor.
+
+    KernelHeap(PhysicalMemoryManager* pmm);
+    ~KernelHeap();
+
+    void* Allocate(uint32_t size);
+    // Returns 16-byte aligned memory for `size` bytes, or 0.
+
+    void Free(void* pointer);
+    // Releases memory from `Allocate`; 0 is ignored.
+
+    uint32_t BytesLive();
+    uint32_t BytesReserved();
+    // Fragmentation is 1 - BytesLive() / BytesReserved().
+
+    void Statistics(uint32_t sizeClass, SizeClassStatistics* statistics);
+    // Copies the counters of one size class.
+
+    void DumpStatistics();
+    // Prints the per-class counters with `kprintf`.
+};
+
+void* operator new(size_t size) noexcept;
+void* operator new[](size_t size) noexcept;
+void operator delete(void* pointer);
+void operator delete[](void* pointer);
+void operator delete(void* pointer, size_t size);
+void operator delete[](void* pointer, size_t size);
+// Global operators backed by KernelHeap::ActiveHeap. There are no exceptions, so
+// `new` returns 0 when memory runs out; being noexcept tells the compiler so and
+// keeps the callers' null checks.
+
+inline void* operator new(size_t, void* pointer) noexcept
+{
+    return pointer;
+}
+
+inline void* operator new[](size_t, void* pointer) noexcept
+{
+    return pointer;
+}
+// Placement new: constructs an object in memory the caller already owns.
+
+#endif
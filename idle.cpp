@@ -0,0 +1,117 @@
+#include "idle.h"
+#include "timer.h"
+#include "multitasking.h"
+
+DeferredWork::DeferredWork()
+{
+}
+
+DeferredWork::~DeferredWork()
+{
+}
+
+bool DeferredWork::Pending()
+{
+    return false;
+}
+
+void DeferredWork::Run()
+{
+}
+
+IdleLoop::IdleLoop(TimerDriver* timer, bool tickless)
+{
+    this->timer = timer;
+    this->tickless = tickless;
+    workCount = 0;
+    halts = 0;
+    ticklessHalts = 0;
+}
+
+IdleLoop::~IdleLoop()
+{
+}
+
+bool IdleLoop::AddWork(DeferredWork* item)
+{
+    if(workCount == MaxWork)
+        return false;
+    work[workCount++] = item;
+    return true;
+}
+
+bool IdleLoop::AnyPending()
+{
+    for(uint32_t i = 0; i < workCount; ++i)
+    {
+        if(work[i]->Pending())
+            return true;
+    }
+    return false;
+}
+
+void IdleLoop::RunPending()
+{
+    for(uint32_t i = 0; i < workCount; ++i)
+    {
+        if(work[i]->Pending())
+            work[i]->Run();
+    }
+}
+
+void IdleLoop::Run()
+{
+    while(true)
+    {
+        RunPending();
+
+        __asm__ volatile("cli" : : : "memory");
+        if(AnyPending())
+        {
+            __asm__ volatile("sti" : : : "memory");
+            continue;
+        }
+        // An interrupt that queues work after this check is held off until the `sti`
+        // below, and `sti` only takes effect after the following `hlt`, so it is
+        // guaranteed to wake us; nothing can slip in between the check and the halt.
+
+        TaskManager* scheduler = TaskManager::Current();
+        if(scheduler != 0 && scheduler->HasReadyTasks())
+        {
+            __asm__ volatile("sti; int %0" : : "i" (TaskManager::YieldVector) : "memory");
+            continue;
+        }
+        // Other tasks want the CPU: hand them the rest of the slice rather than
+        // sitting in `hlt` until the next tick.
+
+        bool stopped = tickless && timer != 0 && timer->EnterTickless();
+        halts++;
+        if(stopped)
+            ticklessHalts++;
+
+        __asm__ volatile("sti; hlt" : : : "memory");
+
+        if(stopped)
+        {
+            __asm__ volatile("cli" : : : "memory");
+            timer->ExitTickless();
+            __asm__ volatile("sti" : : : "memory");
+            // Woken by something other than the timer: bring the periodic tick back.
+        }
+    }
+}
+
+void IdleLoop::SetTickless(bool enabled)
+{
+    tickless = enabled;
+}
+
+uint32_t IdleLoop::Halts()
+{
+    return halts;
+}
+
+uint32_t IdleLoop::TicklessHalts()
+{
+    return ticklessHalts;
+}
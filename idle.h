@@ -0,0 +1,68 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "types.h"
+
+class TimerDriver;
+
+class DeferredWork
+// Work that interrupt handlers leave for later (bottom halves), e.g. decoding
+// queued scancodes or copying the console's dirty rows to the screen.
+{
+public:
+    DeferredWork();
+    ~DeferredWork();
+
+    virtual bool Pending();
+    // Whether `Run` has something to do. Called with interrupts off, so it must be cheap.
+
+    virtual void Run();
+    // Does the work, with interrupts on.
+};
+
+class IdleLoop
+// What the boot task does once the kernel is up: run deferred work, and when
+// there is none, yield to any ready task or else halt until the next interrupt
+// with `sti; hlt` instead of spinning. With tickless idle on, the periodic timer is stopped while halted
+// (or turned into a one-shot for the next requested wake-up), so an idle
+// machine isn't woken a thousand times a second just to count ticks.
+{
+public:
+    static const uint32_t MaxWork = 8;
+
+private:
+    DeferredWork* work[MaxWork];
+    uint32_t workCount;
+
+    TimerDriver* timer;
+    bool tickless;
+
+    uint32_t halts;
+    uint32_t ticklessHalts;
+
+    bool AnyPending();
+    // Asks every work item (interrupts off).
+
+public:
+    IdleLoop(TimerDriver* timer = 0, bool tickless = true);
+    ~IdleLoop();
+
+    bool AddWork(DeferredWork* item);
+    // Registers a work item; returns false if all slots are taken.
+
+    void RunPending();
+    // Runs every item that has work pending, once.
+
+    void Run();
+    // Never returns.
+
+    void SetTickless(bool enabled);
+
+    uint32_t Halts();
+    // Number of times the CPU was halted.
+
+    uint32_t TicklessHalts();
+    // Halts with the periodic tick stopped.
+};
+
+#endif
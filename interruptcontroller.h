@@ -0,0 +1,25 @@
+#ifndef INTERRUPTCONTROLLER_H
+#define INTERRUPTCONTROLLER_H
+
+#include "types.h"
+
+class InterruptController
+// What `InterruptManager` needs from the hardware that delivers IRQs: the 8259
+// pair or the local APIC + IOAPIC. IRQ numbers are ISA lines 0-15, delivered at
+// the manager's hardware interrupt offset + line with either backend.
+{
+public:
+    InterruptController();
+    ~InterruptController();
+
+    virtual void Mask(uint8_t irq);
+    virtual void Unmask(uint8_t irq);
+
+    virtual bool IsSpurious(uint8_t irq);
+    // Whether the interrupt on `irq` must be dropped without an EOI.
+
+    virtual void EndOfInterrupt(uint8_t irq);
+    // Acknowledges the interrupt being handled.
+};
+
+#endif
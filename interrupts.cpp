@@ -1,8 +1,12 @@
 
 #include "interrupts.h"
-
-
-void printf(char* str);
+#include "kprintf.h"
+#include "timer.h"
+#include "arith.h"
+#include "multitasking.h"
+#include "smp.h"
+#include "heap.h"
+#include "memory.h"
 
 
 InterruptHandler::InterruptHandler(InterruptManager* interruptManager, unsigned char InterruptNumber)
@@ -10,12 +14,23 @@ InterruptHandler::InterruptHandler(InterruptManager* interruptManager, unsigned
     this->InterruptNumber = InterruptNumber;
     this->interruptManager = interruptManager;
     interruptManager->handlers[InterruptNumber] = this;
+
+    // A hardware line is only unmasked once somebody handles it.
+    unsigned char irq = InterruptNumber - interruptManager->hardwareInterruptOffset;
+    if(irq < ProgrammableInterruptController::Lines)
+        interruptManager->controller->Unmask(irq);
 }
 
 InterruptHandler::~InterruptHandler()
 {
     if(interruptManager->handlers[InterruptNumber] == this)
+    {
         interruptManager->handlers[InterruptNumber] = 0;
+
+        unsigned char irq = InterruptNumber - interruptManager->hardwareInterruptOffset;
+        if(irq < ProgrammableInterruptController::Lines)
+            interruptManager->controller->Mask(irq);
+    }
 }
 
 unsigned int InterruptHandler::HandleInterrupt(unsigned int esp)
@@ -26,6 +41,18 @@ unsigned int InterruptHandler::HandleInterrupt(unsigned int esp)
 
 InterruptManager::GateDescriptor InterruptManager::interruptDescriptorTable[256];
 InterruptManager* InterruptManager::ActiveInterruptManager = 0;
+#if INTERRUPT_STATISTICS
+InterruptStatistics InterruptManager::statistics[256];
+uint64_t InterruptManager::statisticsStart = 0;
+
+static InterruptStatistics* StatisticsOf(Cpu* cpu)
+{
+    if(cpu == 0 || cpu->index == 0)
+        return InterruptManager::BootStatistics();
+    return cpu->interruptStatistics;
+}
+// The calling CPU's table, or 0 for a processor whose table couldn't be allocated.
+#endif
 void InterruptManager::SetInterruptDescriptorTableEntry(unsigned char interrupt,
     unsigned short int CodeSegment, void (*handler)(), unsigned char DescriptorPrivilegeLevel, unsigned char DescriptorType)
 {
@@ -41,12 +68,11 @@ void InterruptManager::SetInterruptDescriptorTableEntry(unsigned char interrupt,
 
 
 InterruptManager::InterruptManager(unsigned short int hardwareInterruptOffset, GDT* globalDescriptorTable)
-    : picMC(0x20),
-      picMD(0x21),
-      picSC(0xA0),
-      picSD(0xA1)
+: pic(hardwareInterruptOffset)
+// Remaps the PICs to `hardwareInterruptOffset` with every line masked.
 {
     this->hardwareInterruptOffset = hardwareInterruptOffset;
+    controller = &pic;
     unsigned int CodeSegment = globalDescriptorTable->CSS();
 
     const unsigned char IDT_INTERRUPT_GATE = 0xE;
@@ -95,22 +121,21 @@ InterruptManager::InterruptManager(unsigned short int hardwareInterruptOffset, G
     SetInterruptDescriptorTableEntry(hardwareInterruptOffset + 0x0D, CodeSegment, &HandleInterruptRequest0x0D, 0, IDT_INTERRUPT_GATE);
     SetInterruptDescriptorTableEntry(hardwareInterruptOffset + 0x0E, CodeSegment, &HandleInterruptRequest0x0E, 0, IDT_INTERRUPT_GATE);
     SetInterruptDescriptorTableEntry(hardwareInterruptOffset + 0x0F, CodeSegment, &HandleInterruptRequest0x0F, 0, IDT_INTERRUPT_GATE);
+    SetInterruptDescriptorTableEntry(hardwareInterruptOffset + 0x20, CodeSegment, &HandleInterruptRequest0x20, 0, IDT_INTERRUPT_GATE);
+    SetInterruptDescriptorTableEntry(hardwareInterruptOffset + 0x21, CodeSegment, &HandleInterruptRequest0x21, 0, IDT_INTERRUPT_GATE);
+    SetInterruptDescriptorTableEntry(0x80, CodeSegment, &HandleSoftwareInterrupt0x80, 3, IDT_INTERRUPT_GATE);
+    // DPL 3: the system call gate is the one vector user code may raise with `int`.
 
-    picMC.Write(0x11);
-    picSC.Write(0x11);
-    picMD.Write(hardwareInterruptOffset);
-    picSD.Write(hardwareInterruptOffset+8);
-    picMD.Write(0x04);
-    picSD.Write(0x02);
-    picMD.Write(0x01);
-    picSD.Write(0x01);
-    picMD.Write(0x00);
-    picSD.Write(0x00);
+    Load();
 
-    InterruptDescriptorTablePointer idt_pointer;
-    idt_pointer.size  = 256*sizeof(GateDescriptor) - 1;
-    idt_pointer.base  = (unsigned int)interruptDescriptorTable;
-    asm volatile("lidt %0" : : "m" (idt_pointer));
+    // The IDT now points at our stubs, so dispatch CPU exceptions (e.g. page faults)
+    // through this manager right away; hardware interrupts stay off until Activate().
+    if(ActiveInterruptManager == 0)
+        ActiveInterruptManager = this;
+
+#if INTERRUPT_STATISTICS
+    statisticsStart = TimerDriver::ReadTSC();
+#endif
 }
 
 InterruptManager::~InterruptManager()
@@ -123,9 +148,37 @@ unsigned short int InterruptManager::HardwareInterruptOffset()
     return hardwareInterruptOffset;
 }
 
+ProgrammableInterruptController* InterruptManager::PIC()
+{
+    return &pic;
+}
+
+InterruptController* InterruptManager::Controller()
+{
+    return controller;
+}
+
+void InterruptManager::SetController(InterruptController* controller)
+{
+    this->controller = controller;
+    for(unsigned char irq = 0; irq < ProgrammableInterruptController::Lines; ++irq)
+    {
+        if(handlers[hardwareInterruptOffset + irq] != 0)
+            controller->Unmask(irq);
+    }
+}
+
+void InterruptManager::Load()
+{
+    InterruptDescriptorTablePointer idt_pointer;
+    idt_pointer.size  = 256*sizeof(GateDescriptor) - 1;
+    idt_pointer.base  = (unsigned int)interruptDescriptorTable;
+    asm volatile("lidt %0" : : "m" (idt_pointer));
+}
+
 void InterruptManager::Activate()
 {
-    if(ActiveInterruptManager != 0)
+    if(ActiveInterruptManager != 0 && ActiveInterruptManager != this)
         ActiveInterruptManager->Deactivate();
 
     ActiveInterruptManager = this;
@@ -141,36 +194,178 @@ void InterruptManager::Deactivate()
     }
 }
 
-unsigned int InterruptManager::HandleInterrupt(unsigned char interrupt, unsigned int esp)
+CPUState* InterruptManager::HandleInterrupt(CPUState* cpu)
 {
     if(ActiveInterruptManager != 0)
-        return ActiveInterruptManager->DoHandleInterrupt(interrupt, esp);
-    return esp;
+        return ActiveInterruptManager->DoHandleInterrupt(cpu);
+    return cpu;
 }
 
 
-unsigned int InterruptManager::DoHandleInterrupt(unsigned char interrupt, unsigned int esp)
+CPUState* InterruptManager::DoHandleInterrupt(CPUState* cpu)
 {
+    // The vector lives in the frame rather than in a shared global, so a nested
+    // interrupt or a fault inside a handler can't clobber it.
+    unsigned char interrupt = cpu->interrupt;
+
+    unsigned char irq = interrupt - hardwareInterruptOffset;
+    bool hardware = irq < ProgrammableInterruptController::Lines;
+    if(hardware && controller->IsSpurious(irq))
+        return cpu;
+    // Nothing is in service, so there is nothing to handle or acknowledge.
+
     if(handlers[interrupt] != 0)
     {
-        esp = handlers[interrupt]->HandleInterrupt(esp);
+#if INTERRUPT_STATISTICS
+        uint64_t start = TimerDriver::ReadTSC();
+#endif
+        cpu = (CPUState*)handlers[interrupt]->HandleInterrupt((unsigned int)cpu);
+#if INTERRUPT_STATISTICS
+        uint64_t elapsed = TimerDriver::ReadTSC() - start;
+        uint32_t cycles = (elapsed >> 32) ? 0xFFFFFFFF : (uint32_t)elapsed;
+
+        InterruptStatistics* table = StatisticsOf(Cpu::Current());
+        // Each CPU counts in its own table, so vectors that run on every CPU at
+        // once (timer, yield, faults) need no locked adds.
+        if(table != 0)
+        {
+            InterruptStatistics* stats = &table[interrupt];
+            stats->count++;
+            stats->totalCycles += cycles;
+            if(cycles > stats->maxCycles)
+                stats->maxCycles = cycles;
+
+            uint32_t bucket = 0;
+            if(cycles != 0)
+                __asm__("bsrl %1, %0" : "=r" (bucket) : "rm" (cycles));
+            // Index of the highest set bit, i.e. floor(log2(cycles)).
+            if(bucket >= InterruptStatistics::HistogramBuckets)
+                bucket = InterruptStatistics::HistogramBuckets - 1;
+            stats->histogram[bucket]++;
+        }
+#endif
     }
-    else if(interrupt != hardwareInterruptOffset)
+    else if(interrupt < 0x20 && (cpu->cs & 3) && TaskManager::Current() != 0)
     {
-        char* foo = "UNHANDLED INTERRUPT 0x00";
-        char* hex = "0123456789ABCDEF";
-        foo[22] = hex[(interrupt >> 4) & 0xF];
-        foo[23] = hex[interrupt & 0xF];
-        printf(foo);
+        kprintf("\nEXCEPTION 0x%02X in user mode at eip %p, task terminated\n", interrupt, (void*)cpu->eip);
+        cpu = TaskManager::Current()->Terminate(cpu);
     }
+    // Returning would only repeat the faulting instruction.
+    else
+    {
+        kprintf("UNHANDLED INTERRUPT 0x%02X", interrupt);
+    }
+
+    // hardware interrupts must be acknowledged (unless the PIC does it itself in auto-EOI mode)
+    if(hardware)
+        controller->EndOfInterrupt(irq);
+
+    return cpu;
+}
 
-    // hardware interrupts must be acknowledged
-    if(hardwareInterruptOffset <= interrupt && interrupt < hardwareInterruptOffset+16)
+bool InterruptManager::Statistics(unsigned char interrupt, InterruptStatistics* result)
+{
+#if INTERRUPT_STATISTICS
+    kmemset(result, 0, sizeof(InterruptStatistics));
+    SmpManager* smp = SmpManager::ActiveSmpManager;
+    uint32_t cpus = smp != 0 ? smp->CpuCount() : 1;
+    for(uint32_t i = 0; i < cpus; ++i)
     {
-        picMC.Write(0x20);
-        if(hardwareInterruptOffset + 8 <= interrupt)
-            picSC.Write(0x20);
+        InterruptStatistics* table = StatisticsOf(smp != 0 ? smp->GetCpu(i) : 0);
+        if(table == 0)
+            continue;
+
+        uint32_t eflags;
+        asm volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+        InterruptStatistics stats = table[interrupt];
+        asm volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+        // Copied with interrupts off so this CPU's counters belong together; another
+        // CPU's may be one interrupt apart.
+
+        result->count += stats.count;
+        result->totalCycles += stats.totalCycles;
+        if(stats.maxCycles > result->maxCycles)
+            result->maxCycles = stats.maxCycles;
+        for(int bucket = 0; bucket < InterruptStatistics::HistogramBuckets; ++bucket)
+            result->histogram[bucket] += stats.histogram[bucket];
     }
+    return true;
+#else
+    return false;
+#endif
+}
 
-    return esp;
-}
\ No newline at end of file
+void InterruptManager::ResetStatistics()
+{
+#if INTERRUPT_STATISTICS
+    uint32_t eflags;
+    asm volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+    SmpManager* smp = SmpManager::ActiveSmpManager;
+    uint32_t cpus = smp != 0 ? smp->CpuCount() : 1;
+    for(uint32_t i = 0; i < cpus; ++i)
+    {
+        InterruptStatistics* table = StatisticsOf(smp != 0 ? smp->GetCpu(i) : 0);
+        if(table != 0)
+            kmemset(table, 0, sizeof(statistics));
+    }
+    statisticsStart = TimerDriver::ReadTSC();
+    asm volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+#endif
+}
+
+InterruptStatistics* InterruptManager::CreateStatistics()
+{
+#if INTERRUPT_STATISTICS
+    InterruptStatistics* table = new InterruptStatistics[256];
+    if(table != 0)
+        kmemset(table, 0, sizeof(statistics));
+    return table;
+#else
+    return 0;
+#endif
+}
+
+InterruptStatistics* InterruptManager::BootStatistics()
+{
+#if INTERRUPT_STATISTICS
+    return statistics;
+#else
+    return 0;
+#endif
+}
+
+void InterruptManager::DumpStatistics()
+{
+#if INTERRUPT_STATISTICS
+    uint32_t elapsedMs = 0;
+    if(TimerDriver::ActiveTimer != 0 && TimerDriver::ActiveTimer->TscFrequency() >= 1000)
+    {
+        uint32_t tscKHz = (uint32_t)DivU64(TimerDriver::ActiveTimer->TscFrequency(), 1000);
+        elapsedMs = (uint32_t)DivU64(TimerDriver::ReadTSC() - statisticsStart, tscKHz);
+    }
+
+    kprintf("\nvector    count     per s  avg cycles  max cycles  histogram (log2 cycles:count)\n");
+    for(int interrupt = 0; interrupt < 256; ++interrupt)
+    {
+        InterruptStatistics stats;
+        Statistics(interrupt, &stats);
+        if(stats.count == 0)
+            continue;
+
+        uint32_t rate = elapsedMs == 0 ? 0 : (uint32_t)DivU64((uint64_t)stats.count * 1000, elapsedMs);
+        kprintf("  0x%02X %10u %9u %11u %11u ", interrupt, stats.count, rate,
+                (uint32_t)DivU64(stats.totalCycles, stats.count), stats.maxCycles);
+        for(int bucket = 0; bucket < InterruptStatistics::HistogramBuckets; ++bucket)
+        {
+            if(stats.histogram[bucket] != 0)
+                kprintf(" %d:%u", bucket, stats.histogram[bucket]);
+        }
+        kprintf("\n");
+    }
+    kprintf("spurious IRQ7 %u, IRQ15 %u, PIC mask %04x%s\n",
+            pic.SpuriousMaster(), pic.SpuriousSlave(), pic.MaskBits(),
+            pic.AutoEoi() ? ", auto-EOI" : "");
+#else
+    kprintf("\nInterrupt statistics are disabled (INTERRUPT_STATISTICS=0)\n");
+#endif
+}
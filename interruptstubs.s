@@ -1,23 +1,47 @@
 .set IRQ_BASE, 0x20                     # Define IRQ base as 0x20, which is the base of IRQ vector addresses
+.set KERNEL_DATA_SELECTOR, 0x18         # GDT::DSS()
+.set PER_CPU_SELECTOR, 0x30             # GDT::PSS()
 
 .section .text                          # Begin the section that contains executable code
 
-.extern _ZN16InterruptManager15HandleInterruptEhj  # Declare an external symbol for the C++ interrupt handler function
+.extern _ZN16InterruptManager15HandleInterruptEP8CPUState  # Declare an external symbol for the C++ interrupt handler function
+
+# Each stub pushes its own vector number onto the stack instead of storing it in a
+# shared global, so the entry path is reentrant (nested IRQs and faults inside handlers
+# see their own vector). Together with the error code slot this gives every vector the
+# same frame layout, which is described by `struct CPUState` in interrupts.h.
 
 .macro HandleException num                                      # Define a macro to handle exceptions with the given exception number 'num'
 .global _ZN16InterruptManager19HandleException\num\()Ev         # Declare the global handler function for this exception number
 _ZN16InterruptManager19HandleException\num\()Ev:                # Define the handler function for this exception number
-    movb $\num, (interruptnumber)                               # Move the exception number into the interruptnumber variable
+    pushl $0                                                    # Push a dummy error code, the CPU doesn't push one for this exception
+    pushl $\num                                                 # Push the exception number
+    jmp int_bottom                                              # Jump to the 'int_bottom' label to perform common interrupt processing
+.endm                                                           # End of the macro definition
+
+.macro HandleExceptionWithErrorCode num                         # Same as above for exceptions where the CPU pushes an error code itself
+.global _ZN16InterruptManager19HandleException\num\()Ev         # Declare the global handler function for this exception number
+_ZN16InterruptManager19HandleException\num\()Ev:                # Define the handler function for this exception number
+    pushl $\num                                                 # Push the exception number on top of the CPU's error code
     jmp int_bottom                                              # Jump to the 'int_bottom' label to perform common interrupt processing
 .endm                                                           # End of the macro definition
 
 .macro HandleInterruptRequest num                               # Define a macro to handle interrupt requests with the given IRQ number 'num'
 .global _ZN16InterruptManager26HandleInterruptRequest\num\()Ev  # Declare the global handler function for this IRQ number
 _ZN16InterruptManager26HandleInterruptRequest\num\()Ev:         # Define the handler function for this IRQ number
-    movb $\num + IRQ_BASE, (interruptnumber)                    # Move the IRQ number, adjusted by IRQ_BASE, into the interruptnumber variable
+    pushl $0                                                    # Push a dummy error code so the frame matches the exception layout
+    pushl $\num + IRQ_BASE                                      # Push the IRQ number, adjusted by IRQ_BASE
     jmp int_bottom                                              # Jump to the 'int_bottom' label for common interrupt handling
 .endm                                                           # End of the macro definition
 
+.macro HandleSoftwareInterrupt num                              # Vectors raised with `int` from ring 3; their number is the vector itself
+.global _ZN16InterruptManager27HandleSoftwareInterrupt\num\()Ev
+_ZN16InterruptManager27HandleSoftwareInterrupt\num\()Ev:
+    pushl $0                                                    # No error code
+    pushl $\num                                                 # Push the vector number
+    jmp int_bottom
+.endm
+
 # Handle a series of exceptions (0x00 to 0x13)
 HandleException 0x00
 HandleException 0x01
@@ -27,20 +51,20 @@ HandleException 0x04
 HandleException 0x05
 HandleException 0x06
 HandleException 0x07
-HandleException 0x08
+HandleExceptionWithErrorCode 0x08
 HandleException 0x09
-HandleException 0x0A
-HandleException 0x0B
-HandleException 0x0C
-HandleException 0x0D
-HandleException 0x0E
+HandleExceptionWithErrorCode 0x0A
+HandleExceptionWithErrorCode 0x0B
+HandleExceptionWithErrorCode 0x0C
+HandleExceptionWithErrorCode 0x0D
+HandleExceptionWithErrorCode 0x0E
 HandleException 0x0F
 HandleException 0x10
-HandleException 0x11
+HandleExceptionWithErrorCode 0x11
 HandleException 0x12
 HandleException 0x13
 
-# Handle a series of interrupt requests (0x00 to 0x0F and an additional IRQ 0x31)
+# Handle a series of interrupt requests (0x00 to 0x0F, plus the vectors the kernel raises itself)
 HandleInterruptRequest 0x00
 HandleInterruptRequest 0x01
 HandleInterruptRequest 0x02
@@ -57,7 +81,10 @@ HandleInterruptRequest 0x0C
 HandleInterruptRequest 0x0D
 HandleInterruptRequest 0x0E
 HandleInterruptRequest 0x0F
-HandleInterruptRequest 0x31                                    # Handle an additional IRQ 0x31
+HandleInterruptRequest 0x20                                    # Local APIC timer of the application processors
+HandleInterruptRequest 0x21                                    # Task yield (TaskManager::YieldStub)
+
+HandleSoftwareInterrupt 0x80                                   # System calls (SyscallManager::SoftwareVector)
 
 int_bottom:  # Common processing point for all interrupts and exceptions
 
@@ -68,30 +95,31 @@ int_bottom:  # Common processing point for all interrupts and exceptions
     pushl %fs
     pushl %gs
 
-    # Load the segment registers for ring 0 (kernel mode)
-    # Note: These lines are commented out, suggesting they are not in use here
-    # cld
-    # mov $0x10, %eax
-    # mov %eax, %eds
-    # mov %eax, %ees
+    # Coming from ring 3 the data segments are the user's; the handlers need the
+    # kernel's, and %gs must select this CPU's per-CPU block (see Cpu::Current)
+    mov $KERNEL_DATA_SELECTOR, %eax
+    mov %eax, %ds
+    mov %eax, %es
+    mov $PER_CPU_SELECTOR, %eax
+    mov %eax, %gs
+
+    # The C++ code relies on the direction flag being clear (System V ABI)
+    cld
 
     # Call the C++ interrupt handler function
-    pushl %esp                                      # Save the stack pointer before passing it to the handler
-    push (interruptnumber)                          # Push the interrupt number to the stack for the handler
-    call _ZN16InterruptManager15HandleInterruptEhj  # Call the handler function
-    add %esp, 6                                     # Adjust the stack pointer after the function call
-    mov %eax, %esp                                  # Restore the stack pointer from the returned value (this is a context switch)
+    pushl %esp                                                  # Pass the address of the saved frame (CPUState*) as the only argument
+    call _ZN16InterruptManager15HandleInterruptEP8CPUState      # Call the handler function
+    mov %eax, %esp                                              # Switch to the returned frame (this is a context switch when it differs)
 
     # Restore the registers that were saved earlier
-    pop %gs
-    pop %fs
-    pop %es
-    pop %ds
+    popl %gs
+    popl %fs
+    popl %es
+    popl %ds
     popa
 
+    add $8, %esp                                                # Drop the vector number and the error code pushed by the stub
+
 .global _ZN16InterruptManager15InterruptIgnoreEv    # Declare the interrupt ignore function globally
 _ZN16InterruptManager15InterruptIgnoreEv:           # Define the function to ignore the interrupt
     iret                                            # Return from interrupt (this effectively ignores the interrupt)
-
-.data  # Begin the section for data storage
-    interruptnumber: .byte 0  # Reserve a byte of memory to store the interrupt number
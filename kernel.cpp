@@ -1,55 +1,198 @@
 #include "interrupts.h" 
 #include "gdt.h"        
 #include "keyboard.h"  
+#include "timer.h"
+#include "multitasking.h"
+#include "console.h"
+#include "kprintf.h"
+#include "arith.h"
+#include "multiboot.h"
+#include "pmm.h"
+#include "heap.h"
+#include "paging.h"
+#include "serial.h"
+#include "pci.h"
+#include "ata.h"
+#include "profiler.h"
+#include "idle.h"
+#include "acpi.h"
+#include "apic.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "syscall.h"
+#include "fpu.h"
+#include "memory.h"
 
 void printf(char* message) {
-    static unsigned short int* screenBuffer = (unsigned short int*)0xb8000; 
-    static unsigned short int col = 0, row = 0; 
-    for (int index = 0; message[index] != '\0'; ++index) { 
-        // Loop through each character in the input string
-        screenBuffer[80 * row + col] = (screenBuffer[80 * row + col] & 0xFF00) | message[index]; 
-        // Set the character at the current position in video memory
-        // The upper byte is preserved for text attributes; the lower byte stores the character
-
-        if (++col == 80) { 
-            // If the end of the row is reached (80 columns), move to the next line
-            col = 0;
-            row++;
-        }
-        if (row == 25) { 
-            // If the screen's height limit is reached (25 rows), clear the screen
-            for (unsigned short int clearRow = 0; clearRow < 25; clearRow++) { 
-                // Loop through all rows
-                for (unsigned short int clearCol = 0; clearCol < 80; clearCol++) { 
-                    // Loop through all columns
-                    screenBuffer[80 * clearRow + clearCol] = (screenBuffer[80 * clearRow + clearCol] & 0xFF00) | ' '; 
-                    // Clear each character while preserving text attributes
-                }
-            }
-            col = 0; // Reset cursor to the top-left corner
-            row = 0;
+    if (VgaConsole::ActiveConsole != 0)
+        VgaConsole::ActiveConsole->Write(message);
+    // Output goes to the console's shadow buffer; it reaches the screen on the next Flush()
+}
+
+// Prints the characters typed on the keyboard
+class PrintfKeyboardEventHandler : public KeyboardEventHandler {
+    InterruptManager* interrupts;
+    Profiler* profiler;
+    SerialDriver* serial;
+public:
+    PrintfKeyboardEventHandler(InterruptManager* interrupts, Profiler* profiler, SerialDriver* serial) {
+        this->interrupts = interrupts;
+        this->profiler = profiler;
+        this->serial = serial;
+    }
+
+    void OnKeyEvent(const KeyEvent& event) {
+        if (!event.pressed)
+            return;
+        if (event.keycode == KeyF12) {
+            interrupts->DumpStatistics();
+            DumpLockStatistics();
+            // F12 prints the per-vector interrupt counters and lock contention (also to serial)
+        } else if (event.keycode == KeyF11) {
+            profiler->Dump(serial);
+            profiler->Reset();
+            // F11 sends the profile samples to serial (see symbolize.py) and starts over
+        } else if (event.keycode == KeyF10) {
+            if (profiler->Running())
+                profiler->Stop();
+            else
+                profiler->Start();
+            // F10 starts and stops sampling; the timer keeps ticking while it runs
+        } else if (event.character != 0) {
+            char foo[] = " ";
+            foo[0] = event.character;
+            printf(foo);
+        } else {
+            // Report keys without a character like the old decoder did
+            kprintf("KEYBOARD 0x%02X ", event.keycode);
         }
     }
-}
+};
 
 // Kernel entry point function
 extern "C" void kernelMain(const void* multiboot_structure, unsigned int* multiboot_magic) {
+    VgaConsole console;
+    AddKPrintfSink(&console);
+    // Take over the VGA text screen; `printf` and `kprintf` write through this console
+
     printf("Hello World!"); 
     // Print "Hello World!" to the screen
 
+    const multiboot_info* bootInfo = 0;
+    if ((unsigned int)multiboot_magic == MULTIBOOT_BOOTLOADER_MAGIC)
+        bootInfo = (const multiboot_info*)multiboot_structure;
+    // The loader passes eax (the boot loader's magic value) as `multiboot_magic`
+
+    PhysicalMemoryManager pmm(bootInfo);
+    kprintf("\nMemory: %u KiB usable, %u KiB free\n",
+            pmm.TotalFrames() * 4, pmm.FreeFrameCount() * 4);
+    // Build the physical frame allocator from the boot loader's memory map
+
+    KernelHeap heap(&pmm);
+    // Slab heap behind operator new/delete
+
     GDT gdt; 
     // Instantiate the Global Descriptor Table (GDT), which manages memory segments
 
-    InterruptManager interrupts(0x20, &gdt); 
+    InterruptManager interrupts(InterruptManager::DefaultHardwareInterruptOffset, &gdt);
     // Instantiate the interrupt manager and set its base interrupt vector (0x20) 
     // and associate it with the GDT
 
-    KeyboardDriver keyboard(&interrupts); 
+    SmpManager smp(&interrupts, &gdt);
+    // Per-CPU data for the boot processor (through %gs); the other CPUs are started below
+
+    SerialDriver serial(&interrupts, 115200);
+    AddKPrintfSink(&serial);
+    // COM1 at 115200 baud; everything printed with kprintf is mirrored there
+    // (`qemu -serial stdio`). Output queued before Activate() goes out once interrupts are on
+
+    PageManager paging(&interrupts, &pmm);
+    // Turn on paging: the kernel is identity mapped with 4 MiB pages, other RAM
+    // gets 4 KiB pages when it is first touched
+
+    Madt madt;
+    ApicController* apic = 0;
+    if (LocalApic::Supported() && madt.Parse()) {
+        apic = new ApicController(&madt, interrupts.HardwareInterruptOffset(), interrupts.PIC());
+        interrupts.SetController(apic);
+        kprintf("APIC: %u CPUs, %u IOAPICs, PIC masked\n", madt.processorCount, madt.ioApicCount);
+    }
+    // With an APIC (and an MADT describing it) IRQs go through the IOAPIC and are
+    // acknowledged at the local APIC; otherwise the 8259s stay in charge
+
+    PciController pci;
+    pci.Enumerate();
+    pci.Dump();
+    // Walk the PCI buses once and cache what is present; drivers register with
+    // `pci.RegisterDriver` and are bound to matching devices
+
+    AtaDriver ata(&interrupts);
+    if (ata.Present()) {
+        uint8_t bootSector[AtaDriver::SectorSize];
+        bool ok = ata.Read(0, bootSector, 1) && ata.Read(0, bootSector, 1);
+        kprintf("ATA: %s, %u MiB, boot signature %s, cache %u hits / %u misses\n",
+                ata.Model(), ata.SectorCount() / 2048,
+                ok && bootSector[510] == 0x55 && bootSector[511] == 0xAA ? "present" : "missing",
+                ata.CacheHits(), ata.CacheMisses());
+    }
+    // Primary master on IRQ14 (`qemu -hda disk.img`), read through a 256 KiB block cache
+
+    TimerDriver timer(&interrupts, 1000);
+    // Program the PIT to tick at 1 kHz on IRQ0 and calibrate the TSC against it
+
+    kprintf("\nTimer: %u Hz, TSC: %u kHz\n", timer.Frequency(), (uint32_t)DivU64(timer.TscFrequency(), 1000));
+
+    if (apic != 0 && timer.UseLocalApicTimer(apic->Local()))
+        kprintf("Timer: local APIC, %s mode\n", apic->Local()->TscDeadlineMode() ? "TSC-deadline" : "one-shot");
+    // Take the tick from the per-CPU APIC timer instead of the PIT
+
+    TaskManager taskManager(10);
+    timer.SetScheduler(&taskManager);
+    YieldHandler yield(&interrupts);
+    // Round-robin scheduler with a 10 ms time slice, preempting from the timer interrupt.
+    // Tasks are added with `taskManager.AddTask(&task)`; this context keeps running as one of them.
+    // Tasks give up the CPU through the yield interrupt and sleep in WaitQueues
+    // (e.g. SerialDriver::Drain) until an interrupt handler wakes them.
+
+    FpuManager fpu(&interrupts);
+    kprintf("FPU: %s\n", !fpu.Enabled() ? "not supported" : fpu.SseEnabled() ? "x87, SSE2" : "x87");
+    // FPU and SSE state is switched lazily through #NM, for the tasks that use it
+
+    MemoryBenchmark(&timer);
+    // Time kmemcpy/kmemset's variants and let large blocks use streaming stores if they win
+
+    SyscallManager syscalls(&interrupts, &gdt);
+    kprintf("Syscall: int 0x80%s\n", syscalls.FastPath() ? ", sysenter" : "");
+    Task* syscallBenchmark = syscalls.CreateBenchmarkTask(&paging, &pmm);
+    if (syscallBenchmark != 0)
+        taskManager.AddTask(syscallBenchmark);
+    // System calls from ring 3; a user task times a round trip through each path
+    // and prints the cycles once the scheduler gets to it
+
+    if (apic != 0) {
+        smp.StartProcessors(&madt, apic->Local(), &timer, 10);
+        kprintf("SMP: %u CPUs online\n", smp.CpuCount());
+    }
+    // Start the other processors; each idles until it can steal a ready task from
+    // another CPU's run queue
+
+    Profiler profiler(4096, 1);
+    timer.SetProfiler(&profiler);
+    // Samples the interrupted EIP and call stack on every tick once started with F10
+
+    PrintfKeyboardEventHandler kbhandler(&interrupts, &profiler, &serial);
+    KeyboardDriver keyboard(&interrupts, &kbhandler, KeymapDE); 
     // Instantiate the keyboard driver and link it to the interrupt manager
 
+    IdleLoop idle(&timer);
+    idle.AddWork(&keyboard);
+    idle.AddWork(&console);
+    // Bottom halves run by the idle loop: decode queued keys, push dirty rows to the screen
+
     interrupts.Activate(); 
     // Activate the interrupt manager to enable hardware interrupts
 
-    while(1); 
-    // Enter an infinite loop to prevent the kernel from exiting
+    idle.Run();
+    // Become the idle task: run deferred work as it comes in and halt in between,
+    // with the timer stopped while nothing needs it. Never returns.
 }
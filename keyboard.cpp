@@ -1,100 +1,240 @@
 #include "keyboard.h"
 
-KeyboardDriver::KeyboardDriver(InterruptManager* manager)
-: InterruptHandler(manager, 0x21), // Initialize the base class `InterruptHandler` with interrupt number 0x21.
-dataport(0x60), // Initialize `dataport` to I/O port 0x60 (keyboard data port).
-commandport(0x64) // Initialize `commandport` to I/O port 0x64 (keyboard command port).
+KeyboardEventHandler::KeyboardEventHandler()
+{}
+
+KeyboardEventHandler::~KeyboardEventHandler()
+{}
+
+void KeyboardEventHandler::OnKeyEvent(const KeyEvent& event)
+{}
+
+// Translation tables for every `KeymapLayout`, generated by the compiler.
+static constexpr KeymapTable keymaps[KeymapCount] = {
+    MakeKeymapUS(),
+    MakeKeymapDE()
+};
+
+KeyboardDriver::KeyboardDriver(InterruptManager* manager, KeyboardEventHandler* handler, KeymapLayout layout)
+: InterruptHandler(manager, 0x21) // Initialize the base class `InterruptHandler` with interrupt number 0x21.
 {
-    while(commandport.Read() & 0x1)
-        dataport.Read();
+    dropped = 0;
+    overruns = 0;
+    this->handler = handler;
+    keymap = &keymaps[layout < KeymapCount ? layout : KeymapDE];
+    prefix = 0;
+    pauseBytes = 0;
+    held = 0;
+    locks = 0;
+    locksHeld = 0;
+
+    while(OutputBufferFull::IsSet())
+        DataPort::Read();
     // Clear any existing data in the keyboard buffer.
-    // The condition `commandport.Read() & 0x1` checks if the output buffer is full.
+    // The condition `OutputBufferFull::IsSet()` checks if the output buffer is full.
 
-    commandport.Write(0xae); // Activate keyboard interrupts.
-    commandport.Write(0x20); // Send command 0x20 to read the controller command byte.
+    CommandPort::Write(0xae); // Activate keyboard interrupts.
+    CommandPort::Write(0x20); // Send command 0x20 to read the controller command byte.
 
-    unsigned char status = (dataport.Read() | 1) & ~0x10;
+    unsigned char status = (DataPort::Read() | 1) & ~0x10;
     // Read the controller command byte and modify it:
     // - Set the lowest bit (bit 0) to 1 to enable interrupts.
     // - Clear bit 4 (~0x10) to disable translation.
 
-    commandport.Write(0x60); // Send command 0x60 to set the controller command byte.
-    dataport.Write(status); // Write the modified command byte back to the controller.
+    CommandPort::Write(0x60); // Send command 0x60 to set the controller command byte.
+    DataPort::Write(status); // Write the modified command byte back to the controller.
 
-    dataport.Write(0xf4); // Send command 0xF4 to the keyboard to enable scanning.
+    DataPort::Write(0xf4); // Send command 0xF4 to the keyboard to enable scanning.
 }
 
 KeyboardDriver::~KeyboardDriver()
 {}
 
-void printf(char*);
 unsigned int KeyboardDriver::HandleInterrupt(unsigned int esp)
 {
-    unsigned char key = dataport.Read();
+    unsigned char key = DataPort::Read();
     // Read the key code from the keyboard's data port.
 
-    if(key < 0x80)
+    if(!scancodes.Push(key))
+        dropped++;
+    // Only queue it here; the interrupt stays short no matter what the key does.
+
+    return esp; // Return the stack pointer.
+}
+
+void KeyboardDriver::ProcessPending()
+{
+    uint8_t key;
+    while(scancodes.Pop(&key))
+        HandleScancode(key);
+}
+
+bool KeyboardDriver::Pending()
+{
+    return !scancodes.Empty();
+}
+
+void KeyboardDriver::Run()
+{
+    ProcessPending();
+}
+
+void KeyboardDriver::SetHandler(KeyboardEventHandler* handler)
+{
+    this->handler = handler;
+}
+
+void KeyboardDriver::SetKeymap(KeymapLayout layout)
+{
+    if(layout < KeymapCount)
+        keymap = &keymaps[layout];
+}
+
+uint32_t KeyboardDriver::Dropped()
+{
+    return dropped;
+}
+
+uint32_t KeyboardDriver::Overruns()
+{
+    return overruns;
+}
+
+void KeyboardDriver::HandleScancode(uint8_t key)
+{
+    if(key == 0x00 || key == 0xFF)
     {
-        // Check if the key code is a "make" code (indicates key press).
-        switch(key)
+        overruns++;
+        return;
+    }
+    // The keyboard sends 0x00 or 0xFF instead of a scancode when its internal buffer overflowed.
+
+    if(prefix == 0xE1)
+    {
+        // Pause is E1 1D 45 on press and E1 9D C5 on release, with no separate break code.
+        if(++pauseBytes == 2)
         {
-            case 0x02: printf("1"); break; // Print "1" for key code 0x02.
-            case 0x03: printf("2"); break; // Print "2" for key code 0x03.
-            case 0x04: printf("3"); break; // Print "3" for key code 0x04.
-            case 0x05: printf("4"); break; // Print "4" for key code 0x05.
-            case 0x06: printf("5"); break; // Print "5" for key code 0x06.
-            case 0x07: printf("6"); break; // Print "6" for key code 0x07.
-            case 0x08: printf("7"); break; // Print "7" for key code 0x08.
-            case 0x09: printf("8"); break; // Print "8" for key code 0x09.
-            case 0x0A: printf("9"); break; // Print "9" for key code 0x0A.
-            case 0x0B: printf("0"); break; // Print "0" for key code 0x0B.
-
-            case 0x10: printf("q"); break; // Print "q" for key code 0x10.
-            case 0x11: printf("w"); break; // Print "w" for key code 0x11.
-            case 0x12: printf("e"); break; // Print "e" for key code 0x12.
-            case 0x13: printf("r"); break; // Print "r" for key code 0x13.
-            case 0x14: printf("t"); break; // Print "t" for key code 0x14.
-            case 0x15: printf("z"); break; // Print "z" for key code 0x15.
-            case 0x16: printf("u"); break; // Print "u" for key code 0x16.
-            case 0x17: printf("i"); break; // Print "i" for key code 0x17.
-            case 0x18: printf("o"); break; // Print "o" for key code 0x18.
-            case 0x19: printf("p"); break; // Print "p" for key code 0x19.
-
-            case 0x1E: printf("a"); break; // Print "a" for key code 0x1E.
-            case 0x1F: printf("s"); break; // Print "s" for key code 0x1F.
-            case 0x20: printf("d"); break; // Print "d" for key code 0x20.
-            case 0x21: printf("f"); break; // Print "f" for key code 0x21.
-            case 0x22: printf("g"); break; // Print "g" for key code 0x22.
-            case 0x23: printf("h"); break; // Print "h" for key code 0x23.
-            case 0x24: printf("j"); break; // Print "j" for key code 0x24.
-            case 0x25: printf("k"); break; // Print "k" for key code 0x25.
-            case 0x26: printf("l"); break; // Print "l" for key code 0x26.
-
-            case 0x2C: printf("y"); break; // Print "y" for key code 0x2C.
-            case 0x2D: printf("x"); break; // Print "x" for key code 0x2D.
-            case 0x2E: printf("c"); break; // Print "c" for key code 0x2E.
-            case 0x2F: printf("v"); break; // Print "v" for key code 0x2F.
-            case 0x30: printf("b"); break; // Print "b" for key code 0x30.
-            case 0x31: printf("n"); break; // Print "n" for key code 0x31.
-            case 0x32: printf("m"); break; // Print "m" for key code 0x32.
-            case 0x33: printf(","); break; // Print "," for key code 0x33.
-            case 0x34: printf("."); break; // Print "." for key code 0x34.
-            case 0x35: printf("-"); break; // Print "-" for key code 0x35.
-
-            case 0x1C: printf("\n"); break; // Print a newline for key code 0x1C.
-            case 0x39: printf(" "); break; // Print a space for key code 0x39.
-
-            default:
-            {
-                // Handle unknown key codes.
-                char* foo = "KEYBOARD 0x00 ";
-                char* hex = "0123456789ABCDEF";
-                foo[11] = hex[(key >> 4) & 0xF]; // Get the high nibble of the key code as a hex character.
-                foo[12] = hex[key & 0xF];       // Get the low nibble of the key code as a hex character.
-                printf(foo);                    // Print the unknown key code in hexadecimal.
-                break;
-            }
+            prefix = 0;
+            EmitKey(KeyPause, (key & 0x80) == 0);
         }
+        return;
     }
-    return esp; // Return the stack pointer.
+
+    if(key == 0xE0 || key == 0xE1)
+    {
+        prefix = key;
+        pauseBytes = 0;
+        return;
+    }
+
+    bool pressed = (key & 0x80) == 0;
+    uint8_t keycode = key & 0x7F;
+
+    if(prefix == 0xE0)
+    {
+        prefix = 0;
+        if(keycode == 0x2A || keycode == 0x36)
+            return;
+        // E0 2A / E0 36 are fake shifts sent around Print Screen and the navigation keys.
+        keycode |= KeyExtended;
+    }
+
+    EmitKey(keycode, pressed);
+}
+
+// Bits of `held`; left and right keys are tracked separately so releasing one
+// doesn't clear a modifier the other one still holds.
+static const uint8_t HeldLeftShift = 0x01;
+static const uint8_t HeldRightShift = 0x02;
+static const uint8_t HeldLeftCtrl = 0x04;
+static const uint8_t HeldRightCtrl = 0x08;
+static const uint8_t HeldLeftAlt = 0x10;
+static const uint8_t HeldRightAlt = 0x20;
+
+static uint8_t HeldBit(uint8_t keycode)
+{
+    switch(keycode)
+    {
+        case KeyLeftShift: return HeldLeftShift;
+        case KeyRightShift: return HeldRightShift;
+        case KeyLeftCtrl: return HeldLeftCtrl;
+        case KeyRightCtrl: return HeldRightCtrl;
+        case KeyLeftAlt: return HeldLeftAlt;
+        case KeyRightAlt: return HeldRightAlt;
+    }
+    return 0;
+}
+
+uint8_t KeyboardDriver::Modifiers()
+{
+    uint8_t modifiers = locks;
+    if(held & (HeldLeftShift | HeldRightShift))
+        modifiers |= ModifierShift;
+    if(held & (HeldLeftCtrl | HeldRightCtrl))
+        modifiers |= ModifierCtrl;
+    if(held & HeldLeftAlt)
+        modifiers |= ModifierAlt;
+    if(held & HeldRightAlt)
+        modifiers |= keymap->hasAltGr ? ModifierAltGr : ModifierAlt;
+    return modifiers;
+}
+
+void KeyboardDriver::EmitKey(uint8_t keycode, bool pressed)
+{
+    uint8_t heldBit = HeldBit(keycode);
+    if(heldBit != 0)
+    {
+        if(pressed)
+            held |= heldBit;
+        else
+            held &= ~heldBit;
+    }
+    else
+    {
+        uint8_t lockBit = 0;
+        if(keycode == KeyCapsLock)
+            lockBit = ModifierCapsLock;
+        else if(keycode == KeyNumLock)
+            lockBit = ModifierNumLock;
+        else if(keycode == KeyScrollLock)
+            lockBit = ModifierScrollLock;
+
+        if(pressed && !(locksHeld & lockBit))
+            locks ^= lockBit;
+        // Lock keys toggle on the first make code only; the typematic repeats
+        // of a lock key that stays down leave the state alone.
+        if(pressed)
+            locksHeld |= lockBit;
+        else
+            locksHeld &= ~lockBit;
+    }
+
+    KeyEvent event;
+    event.keycode = keycode;
+    event.pressed = pressed;
+    event.modifiers = Modifiers();
+    event.character = 0;
+
+    if(keycode == KeyKeypadEnter)
+        event.character = '\n';
+    else if(keycode == KeyKeypadSlash)
+        event.character = '/';
+    else if(keycode < KeyExtended)
+    {
+        int plane;
+        if(event.modifiers & ModifierAltGr)
+            plane = PlaneAltGr;
+        else
+            plane = ((event.modifiers & ModifierShift) ? PlaneShift : PlaneNormal)
+                  | ((event.modifiers & ModifierCapsLock) ? PlaneCaps : PlaneNormal);
+        event.character = keymap->planes[plane][keycode];
+
+        bool keypadDigit = keycode >= 0x47 && keycode <= 0x53 && keycode != 0x4A && keycode != 0x4E;
+        if(keypadDigit && !(event.modifiers & ModifierNumLock))
+            event.character = 0;
+        // Without Num Lock the keypad digits are navigation keys.
+    }
+
+    if(handler != 0)
+        handler->OnKeyEvent(event);
 }
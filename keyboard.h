@@ -3,21 +3,143 @@
 
 #include "interrupts.h"
 #include "port.h"
+#include "staticport.h"
+#include "idle.h"
+#include "types.h"
+#include "ringbuffer.h"
+#include "keymap.h"
 
-class KeyboardDriver : public InterruptHandler
+enum KeyCode
+// Key codes carried by `KeyEvent`. Keys without a prefix use their scancode set 1
+// make code (0x01-0x7F); keys sent with the E0 prefix use 0x80 | make code.
+{
+    KeyEscape = 0x01,
+    KeyBackspace = 0x0E,
+    KeyTab = 0x0F,
+    KeyEnter = 0x1C,
+    KeyLeftCtrl = 0x1D,
+    KeyLeftShift = 0x2A,
+    KeyRightShift = 0x36,
+    KeyLeftAlt = 0x38,
+    KeySpace = 0x39,
+    KeyCapsLock = 0x3A,
+    KeyF1 = 0x3B,
+    KeyF10 = 0x44,
+    KeyNumLock = 0x45,
+    KeyScrollLock = 0x46,
+    KeyF11 = 0x57,
+    KeyF12 = 0x58,
+
+    KeyExtended = 0x80,
+    KeyKeypadEnter = 0x80 | 0x1C,
+    KeyRightCtrl = 0x80 | 0x1D,
+    KeyKeypadSlash = 0x80 | 0x35,
+    KeyPrintScreen = 0x80 | 0x37,
+    KeyRightAlt = 0x80 | 0x38,
+    KeyPause = 0x80 | 0x45,     // Sent as the E1 1D 45 sequence.
+    KeyHome = 0x80 | 0x47,
+    KeyUp = 0x80 | 0x48,
+    KeyPageUp = 0x80 | 0x49,
+    KeyLeft = 0x80 | 0x4B,
+    KeyRight = 0x80 | 0x4D,
+    KeyEnd = 0x80 | 0x4F,
+    KeyDown = 0x80 | 0x50,
+    KeyPageDown = 0x80 | 0x51,
+    KeyInsert = 0x80 | 0x52,
+    KeyDelete = 0x80 | 0x53,
+    KeyLeftGui = 0x80 | 0x5B,
+    KeyRightGui = 0x80 | 0x5C,
+    KeyMenu = 0x80 | 0x5D
+};
+
+enum KeyModifier
+// Bits of `KeyEvent::modifiers`.
+{
+    ModifierShift = 0x01,
+    ModifierCtrl = 0x02,
+    ModifierAlt = 0x04,
+    ModifierAltGr = 0x08,
+    ModifierCapsLock = 0x10,
+    ModifierNumLock = 0x20,
+    ModifierScrollLock = 0x40
+};
+
+struct KeyEvent
+{
+    uint8_t keycode;    // One of `KeyCode`.
+    bool pressed;       // true for make codes, false for break codes.
+    uint8_t modifiers;  // `KeyModifier` bits in effect after this event.
+    uint8_t character;  // Code page 437 character for the active keymap, 0 if the key has none.
+};
+
+class KeyboardEventHandler
+// Receives the decoded key events of a `KeyboardDriver`.
+{
+public:
+    KeyboardEventHandler();
+    ~KeyboardEventHandler();
+
+    virtual void OnKeyEvent(const KeyEvent& event);
+    // Called from the driver's bottom half for every press and release.
+};
+
+class KeyboardDriver : public InterruptHandler, public DeferredWork
 // Define the `KeyboardDriver` class, which inherits from the `InterruptHandler` class.
 // This indicates that the `KeyboardDriver` will handle specific interrupt events.
+// As `DeferredWork` the idle loop runs its bottom half.
 {
-    Port8Bit dataport;
-    // Member variable `dataport` represents the data port for the keyboard (typically I/O port 0x60).
+    typedef StaticPort<0x60> DataPort;
+    // `DataPort` is the data port for the keyboard (I/O port 0x60).
     // This is used to read/write data to/from the keyboard hardware.
 
-    Port8Bit commandport;
-    // Member variable `commandport` represents the command port for the keyboard (typically I/O port 0x64).
-    // This is used to send commands to the keyboard controller.
+    typedef StaticPort<0x64> CommandPort;
+    // `CommandPort` is the command port for the keyboard controller (I/O port 0x64).
+    // Writes send commands to the controller; reads return its status register.
+
+    typedef RegisterField<CommandPort, 0> OutputBufferFull;
+    // Status bit 0: a byte is waiting in the data port.
+
+    RingBuffer<uint8_t, 256> scancodes;
+    // Raw scancodes queued by the interrupt handler for `ProcessPending` to decode.
+
+    volatile uint32_t dropped;
+    // Scancodes lost because `scancodes` was full when they arrived.
+
+    volatile uint32_t overruns;
+    // Overrun codes (0x00/0xFF) reported by the keyboard when its own buffer overflowed.
+
+    KeyboardEventHandler* handler;
+    // Receiver of the decoded events, may be 0.
+
+    const KeymapTable* keymap;
+    // Active translation table.
+
+    uint8_t prefix;
+    // Decoder state: 0, 0xE0 after an extended prefix, or 0xE1 while in a Pause sequence.
+
+    uint8_t pauseBytes;
+    // Bytes of the E1 sequence seen so far.
+
+    uint8_t held;
+    // Modifier keys currently held, see the `Held*` constants in keyboard.cpp.
+
+    uint8_t locks;
+    // Lock states (`ModifierCapsLock`, `ModifierNumLock`, `ModifierScrollLock`).
+
+    uint8_t locksHeld;
+    // Lock keys currently held, with the same bits as `locks`.
+
+    void HandleScancode(uint8_t key);
+    // Runs one scancode through the prefix state machine and emits the resulting event.
+
+    void EmitKey(uint8_t keycode, bool pressed);
+    // Updates the modifier state and translates the key into a `KeyEvent`.
+
+    uint8_t Modifiers();
+    // Current `KeyModifier` bits.
 
 public:
-    KeyboardDriver(InterruptManager* manager);
+    KeyboardDriver(InterruptManager* manager, KeyboardEventHandler* handler = 0, KeymapLayout layout = KeymapDE);
     // Constructor for the `KeyboardDriver` class. 
     // It takes a pointer to an `InterruptManager` object to register the keyboard driver as an interrupt handler.
 
@@ -30,6 +152,29 @@ public:
     // `esp` is the stack pointer passed during the interrupt, which may be used to 
     // modify the state of the interrupted process. This method will be called when 
     // a keyboard interrupt occurs.
+    // It only queues the raw scancode; decoding and printing happen in `ProcessPending`.
+
+    void ProcessPending();
+    // Bottom half: decodes every queued scancode and passes the events to the handler.
+    // Runs with interrupts enabled.
+
+    virtual bool Pending();
+    // Whether scancodes are waiting for `ProcessPending`.
+
+    virtual void Run();
+    // Same as `ProcessPending`.
+
+    void SetHandler(KeyboardEventHandler* handler);
+    // Replaces the receiver of key events.
+
+    void SetKeymap(KeymapLayout layout);
+    // Selects the keyboard layout used to translate keys into characters.
+
+    uint32_t Dropped();
+    // Number of scancodes dropped because the queue was full.
+
+    uint32_t Overruns();
+    // Number of overrun codes received from the keyboard.
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,125 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "types.h"
+
+// Scancode set 1 translation tables, built at compile time.
+// Every layout is a set of planes indexed by scancode (0x00-0x7F); the plane is
+// chosen from the modifier state, so decoding a key is a single table lookup.
+// Characters are code page 437 bytes, which is what the VGA text mode displays.
+
+enum KeymapLayout
+{
+    KeymapUS = 0,
+    KeymapDE = 1,
+    KeymapCount
+};
+
+enum KeymapPlane
+{
+    PlaneNormal = 0,
+    PlaneShift = 1,
+    PlaneCaps = 2,          // Caps Lock on: letters shifted, everything else normal.
+    PlaneShiftCaps = 3,     // Shift with Caps Lock on: letters unshifted, everything else shifted.
+    PlaneAltGr = 4,
+    PlaneCount
+};
+
+struct KeymapTable
+{
+    uint8_t planes[PlaneCount][128];
+    bool hasAltGr;
+    // Whether right Alt acts as AltGr (selects PlaneAltGr) instead of Alt.
+};
+
+// Writes `chars` into `plane` starting at `scancode`.
+static constexpr void KeymapRow(KeymapTable& table, int plane, int scancode, const char* chars)
+{
+    for(int i = 0; chars[i] != '\0'; ++i)
+        table.planes[plane][scancode + i] = (uint8_t)chars[i];
+}
+
+static constexpr bool KeymapIsLetter(uint8_t c)
+{
+    return (c >= 'a' && c <= 'z')
+        || c == 0x81 || c == 0x84 || c == 0x94;   // ü, ä, ö in code page 437.
+}
+
+// Fills in the keys every layout shares and derives the Caps Lock planes.
+static constexpr void KeymapFinish(KeymapTable& table)
+{
+    for(int plane = PlaneNormal; plane <= PlaneShift; ++plane)
+    {
+        table.planes[plane][0x01] = 0x1B;   // Escape
+        table.planes[plane][0x0E] = '\b';   // Backspace
+        table.planes[plane][0x0F] = '\t';   // Tab
+        table.planes[plane][0x1C] = '\n';   // Enter
+        table.planes[plane][0x39] = ' ';    // Space
+        table.planes[plane][0x37] = '*';    // Keypad *
+        table.planes[plane][0x4A] = '-';    // Keypad -
+        table.planes[plane][0x4E] = '+';    // Keypad +
+        KeymapRow(table, plane, 0x47, "789");
+        KeymapRow(table, plane, 0x4B, "456");
+        KeymapRow(table, plane, 0x4F, "1230.");
+    }
+
+    for(int scancode = 0; scancode < 128; ++scancode)
+    {
+        uint8_t normal = table.planes[PlaneNormal][scancode];
+        uint8_t shifted = table.planes[PlaneShift][scancode];
+        bool letter = KeymapIsLetter(normal);
+        table.planes[PlaneCaps][scancode] = letter ? shifted : normal;
+        table.planes[PlaneShiftCaps][scancode] = letter ? normal : shifted;
+    }
+}
+
+static constexpr KeymapTable MakeKeymapUS()
+{
+    KeymapTable table = {};
+    table.hasAltGr = false;
+
+    KeymapRow(table, PlaneNormal, 0x02, "1234567890-=");
+    KeymapRow(table, PlaneNormal, 0x10, "qwertyuiop[]");
+    KeymapRow(table, PlaneNormal, 0x1E, "asdfghjkl;'`");
+    KeymapRow(table, PlaneNormal, 0x2B, "\\zxcvbnm,./");
+    KeymapRow(table, PlaneNormal, 0x56, "\\");
+
+    KeymapRow(table, PlaneShift, 0x02, "!@#$%^&*()_+");
+    KeymapRow(table, PlaneShift, 0x10, "QWERTYUIOP{}");
+    KeymapRow(table, PlaneShift, 0x1E, "ASDFGHJKL:\"~");
+    KeymapRow(table, PlaneShift, 0x2B, "|ZXCVBNM<>?");
+    KeymapRow(table, PlaneShift, 0x56, "|");
+
+    KeymapFinish(table);
+    return table;
+}
+
+static constexpr KeymapTable MakeKeymapDE()
+{
+    KeymapTable table = {};
+    table.hasAltGr = true;
+
+    KeymapRow(table, PlaneNormal, 0x02, "1234567890\xE1'");       // ß, ´
+    KeymapRow(table, PlaneNormal, 0x10, "qwertzuiop\x81+");       // ü
+    KeymapRow(table, PlaneNormal, 0x1E, "asdfghjkl\x94\x84^");    // ö, ä
+    KeymapRow(table, PlaneNormal, 0x2B, "#yxcvbnm,.-");
+    KeymapRow(table, PlaneNormal, 0x56, "<");
+
+    KeymapRow(table, PlaneShift, 0x02, "!\"\x15$%&/()=?`");       // §
+    KeymapRow(table, PlaneShift, 0x10, "QWERTZUIOP\x9A*");        // Ü
+    KeymapRow(table, PlaneShift, 0x1E, "ASDFGHJKL\x99\x8E\xF8");  // Ö, Ä, °
+    KeymapRow(table, PlaneShift, 0x2B, "'YXCVBNM;:_");
+    KeymapRow(table, PlaneShift, 0x56, ">");
+
+    KeymapRow(table, PlaneAltGr, 0x03, "\xFD");                   // ²
+    KeymapRow(table, PlaneAltGr, 0x08, "{[]}\\");
+    KeymapRow(table, PlaneAltGr, 0x10, "@");
+    KeymapRow(table, PlaneAltGr, 0x1B, "~");
+    KeymapRow(table, PlaneAltGr, 0x32, "\xE6");                   // µ
+    KeymapRow(table, PlaneAltGr, 0x56, "|");
+
+    KeymapFinish(table);
+    return table;
+}
+
+#endif
@@ -0,0 +1,294 @@
+#include "kprintf.h"
+#include "arith.h"
+
+KPrintfSink::KPrintfSink()
+{}
+
+KPrintfSink::~KPrintfSink()
+{}
+
+void KPrintfSink::Write(const char* str, uint32_t length)
+{}
+
+
+static const int MaxSinks = 4;
+static KPrintfSink* sinks[MaxSinks];
+// Registered outputs; empty slots are 0 (the array lives in .bss).
+
+bool AddKPrintfSink(KPrintfSink* sink)
+{
+    for(int i = 0; i < MaxSinks; ++i)
+    {
+        if(sinks[i] == sink)
+            return true;
+    }
+    for(int i = 0; i < MaxSinks; ++i)
+    {
+        if(sinks[i] == 0)
+        {
+            sinks[i] = sink;
+            return true;
+        }
+    }
+    return false;
+}
+
+void RemoveKPrintfSink(KPrintfSink* sink)
+{
+    for(int i = 0; i < MaxSinks; ++i)
+    {
+        if(sinks[i] == sink)
+            sinks[i] = 0;
+    }
+}
+
+static void WriteToSinks(const char* str, uint32_t length)
+{
+    for(int i = 0; i < MaxSinks; ++i)
+    {
+        if(sinks[i] != 0)
+            sinks[i]->Write(str, length);
+    }
+}
+
+
+// Destination of the formatter: a fixed buffer that is either handed to the
+// sinks whenever it fills up (kprintf) or truncated (ksnprintf).
+struct FormatOutput
+{
+    char* buffer;
+    uint32_t size;      // Usable bytes in `buffer`.
+    uint32_t used;      // Bytes currently in `buffer`.
+    uint32_t total;     // Characters produced so far, including truncated ones.
+    bool toSinks;
+
+    void Put(char c)
+    {
+        total++;
+        if(used == size)
+        {
+            if(!toSinks)
+                return;
+            WriteToSinks(buffer, used);
+            used = 0;
+        }
+        buffer[used++] = c;
+    }
+
+    void Pad(char c, int count)
+    {
+        for(; count > 0; --count)
+            Put(c);
+    }
+};
+
+static const char* const lowerDigits = "0123456789abcdef";
+static const char* const upperDigits = "0123456789ABCDEF";
+
+// Writes `value` in `base` with the requested padding.
+static void FormatNumber(FormatOutput& out, uint64_t value, bool negative, uint32_t base,
+                         bool upper, int width, bool zeroPad, bool leftAlign)
+{
+    char digits[20];
+    // 2^64 has 20 decimal digits.
+    int count = 0;
+    const char* table = upper ? upperDigits : lowerDigits;
+
+    do
+    {
+        uint32_t digit;
+        if((value >> 32) == 0)
+        {
+            // Stay on 32-bit arithmetic for the common case.
+            uint32_t v = (uint32_t)value;
+            digit = v % base;
+            value = v / base;
+        }
+        else
+            value = DivU64(value, base, &digit);
+        digits[count++] = table[digit];
+    } while(value != 0);
+
+    int length = count + (negative ? 1 : 0);
+    int padding = width > length ? width - length : 0;
+
+    if(!leftAlign && !zeroPad)
+        out.Pad(' ', padding);
+    if(negative)
+        out.Put('-');
+    if(!leftAlign && zeroPad)
+        out.Pad('0', padding);
+    while(count > 0)
+        out.Put(digits[--count]);
+    if(leftAlign)
+        out.Pad(' ', padding);
+}
+
+static void Format(FormatOutput& out, const char* format, va_list args)
+{
+    for(const char* p = format; *p != '\0'; ++p)
+    {
+        if(*p != '%')
+        {
+            out.Put(*p);
+            continue;
+        }
+
+        bool zeroPad = false;
+        bool leftAlign = false;
+        int width = 0;
+        int longCount = 0;
+
+        // Flags.
+        for(++p; *p == '0' || *p == '-'; ++p)
+        {
+            if(*p == '0')
+                zeroPad = true;
+            else
+                leftAlign = true;
+        }
+
+        // Field width.
+        if(*p == '*')
+        {
+            width = va_arg(args, int);
+            if(width < 0)
+            {
+                leftAlign = true;
+                width = -width;
+            }
+            ++p;
+        }
+        else
+        {
+            for(; *p >= '0' && *p <= '9'; ++p)
+                width = width * 10 + (*p - '0');
+        }
+
+        // Length modifiers; `long` is 32 bits on i386.
+        for(; *p == 'l'; ++p)
+            longCount++;
+
+        switch(*p)
+        {
+            case 'd':
+            case 'i':
+            {
+                int64_t value = longCount >= 2 ? va_arg(args, int64_t) : va_arg(args, int32_t);
+                bool negative = value < 0;
+                FormatNumber(out, negative ? (uint64_t)-value : (uint64_t)value, negative, 10,
+                             false, width, zeroPad, leftAlign);
+                break;
+            }
+
+            case 'u':
+            case 'x':
+            case 'X':
+            {
+                uint64_t value = longCount >= 2 ? va_arg(args, uint64_t) : va_arg(args, uint32_t);
+                FormatNumber(out, value, false, *p == 'u' ? 10 : 16, *p == 'X',
+                             width, zeroPad, leftAlign);
+                break;
+            }
+
+            case 'p':
+            {
+                uint32_t value = (uint32_t)va_arg(args, void*);
+                out.Put('0');
+                out.Put('x');
+                FormatNumber(out, value, false, 16, false, 8, true, false);
+                break;
+            }
+
+            case 's':
+            {
+                const char* str = va_arg(args, const char*);
+                if(str == 0)
+                    str = "(null)";
+                int length = 0;
+                while(str[length] != '\0')
+                    length++;
+                if(!leftAlign)
+                    out.Pad(' ', width - length);
+                for(int i = 0; i < length; ++i)
+                    out.Put(str[i]);
+                if(leftAlign)
+                    out.Pad(' ', width - length);
+                break;
+            }
+
+            case 'c':
+            {
+                if(!leftAlign)
+                    out.Pad(' ', width - 1);
+                out.Put((char)va_arg(args, int));
+                if(leftAlign)
+                    out.Pad(' ', width - 1);
+                break;
+            }
+
+            case '%':
+                out.Put('%');
+                break;
+
+            case '\0':
+                return;
+                // A lone '%' at the end of the format string.
+
+            default:
+                out.Put('%');
+                out.Put(*p);
+                break;
+        }
+    }
+}
+
+int kvprintf(const char* format, va_list args)
+{
+    char buffer[128];
+    FormatOutput out;
+    out.buffer = buffer;
+    out.size = sizeof(buffer);
+    out.used = 0;
+    out.total = 0;
+    out.toSinks = true;
+
+    Format(out, format, args);
+    if(out.used > 0)
+        WriteToSinks(buffer, out.used);
+    return out.total;
+}
+
+int kprintf(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int result = kvprintf(format, args);
+    va_end(args);
+    return result;
+}
+
+int kvsnprintf(char* buffer, uint32_t size, const char* format, va_list args)
+{
+    FormatOutput out;
+    out.buffer = buffer;
+    out.size = size > 0 ? size - 1 : 0;
+    // Keep room for the terminating NUL.
+    out.used = 0;
+    out.total = 0;
+    out.toSinks = false;
+
+    Format(out, format, args);
+    if(size > 0)
+        buffer[out.used] = '\0';
+    return out.total;
+}
+
+int ksnprintf(char* buffer, uint32_t size, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int result = kvsnprintf(buffer, size, format, args);
+    va_end(args);
+    return result;
+}
@@ -0,0 +1,42 @@
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+#include <stdarg.h>
+// stdarg.h comes with the compiler itself, not with libc, so it is usable with -nostdlib.
+#include "types.h"
+
+class KPrintfSink
+// Output device for `kprintf` (VGA console, serial port, ...).
+{
+public:
+    KPrintfSink();
+    ~KPrintfSink();
+
+    virtual void Write(const char* str, uint32_t length);
+    // Receives a chunk of formatted output. Must not call `kprintf` itself.
+};
+
+bool AddKPrintfSink(KPrintfSink* sink);
+// Registers a sink; every `kprintf` is written to all registered sinks.
+// Returns false if all slots are taken.
+
+void RemoveKPrintfSink(KPrintfSink* sink);
+// Unregisters a sink.
+
+int kprintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+// Formats into a stack buffer and writes the result to the registered sinks.
+// Supports %d %i %u %x %X %p %s %c %%, the '-' and '0' flags, a field width
+// (digits or '*'), and the l/ll length modifiers. No heap, no libc.
+// Returns the number of characters produced.
+
+int kvprintf(const char* format, va_list args);
+// `kprintf` taking a va_list.
+
+int ksnprintf(char* buffer, uint32_t size, const char* format, ...) __attribute__((format(printf, 3, 4)));
+// Formats into `buffer`, always NUL-terminating it when `size` > 0.
+// Returns the length the full output would have had.
+
+int kvsnprintf(char* buffer, uint32_t size, const char* format, va_list args);
+// `ksnprintf` taking a va_list.
+
+#endif
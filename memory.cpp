@@ -0,0 +1,289 @@
+#include "memory.h"
+#include "fpu.h"
+#include "timer.h"
+#include "kprintf.h"
+#include "arith.h"
+
+static const uint32_t SmallSize = 16;
+// Below this, aligning first costs more than it saves.
+
+static const uint32_t StreamChunk = 64 * 1024;
+// Bytes streamed per FpuManager::Acquire, which keeps interrupts off for a few microseconds at most.
+
+static const uint32_t NoStreaming = 0xFFFFFFFF;
+static uint32_t streamCopyThreshold = NoStreaming;
+static uint32_t streamFillThreshold = NoStreaming;
+// Set by MemoryBenchmark; blocks of at least this size are streamed.
+
+static inline bool CanStream()
+{
+    return FpuManager::ActiveFpuManager != 0 && FpuManager::ActiveFpuManager->SseEnabled();
+}
+
+static void CopyDwords(uint8_t* destination, const uint8_t* source, uint32_t count)
+{
+    if(count >= SmallSize)
+    {
+        uint32_t head = -(uint32_t)destination & 3;
+        count -= head;
+        __asm__ volatile("rep movsb" : "+D" (destination), "+S" (source), "+c" (head) : : "memory");
+
+        uint32_t dwords = count >> 2;
+        count &= 3;
+        __asm__ volatile("rep movsl" : "+D" (destination), "+S" (source), "+c" (dwords) : : "memory");
+    }
+    __asm__ volatile("rep movsb" : "+D" (destination), "+S" (source), "+c" (count) : : "memory");
+}
+
+static void CopyStreaming(uint8_t* destination, const uint8_t* source, uint32_t count)
+{
+    uint32_t head = -(uint32_t)destination & 15;
+    count -= head;
+    __asm__ volatile("rep movsb" : "+D" (destination), "+S" (source), "+c" (head) : : "memory");
+    // movntdq needs a 16-byte aligned destination; the source is read with movdqu.
+
+    while(count >= 64)
+    {
+        uint32_t chunk = count < StreamChunk ? count & ~63 : StreamChunk;
+        count -= chunk;
+
+        uint32_t eflags = FpuManager::ActiveFpuManager->Acquire();
+        __asm__ volatile("1:\n"
+                         "movdqu (%1), %%xmm0\n"
+                         "movdqu 16(%1), %%xmm1\n"
+                         "movdqu 32(%1), %%xmm2\n"
+                         "movdqu 48(%1), %%xmm3\n"
+                         "movntdq %%xmm0, (%0)\n"
+                         "movntdq %%xmm1, 16(%0)\n"
+                         "movntdq %%xmm2, 32(%0)\n"
+                         "movntdq %%xmm3, 48(%0)\n"
+                         "add $64, %1\n"
+                         "add $64, %0\n"
+                         "sub $64, %2\n"
+                         "jnz 1b\n"
+                         "sfence"
+                         : "+r" (destination), "+r" (source), "+r" (chunk)
+                         : : "memory", "cc");
+        // sfence orders the weakly ordered streaming stores before anything that follows.
+        FpuManager::ActiveFpuManager->Release(eflags);
+    }
+    CopyDwords(destination, source, count);
+}
+
+static void FillDwords(uint8_t* destination, uint32_t pattern, uint32_t count)
+{
+    if(count >= SmallSize)
+    {
+        uint32_t head = -(uint32_t)destination & 3;
+        count -= head;
+        __asm__ volatile("rep stosb" : "+D" (destination), "+c" (head) : "a" (pattern) : "memory");
+
+        uint32_t dwords = count >> 2;
+        count &= 3;
+        __asm__ volatile("rep stosl" : "+D" (destination), "+c" (dwords) : "a" (pattern) : "memory");
+    }
+    __asm__ volatile("rep stosb" : "+D" (destination), "+c" (count) : "a" (pattern) : "memory");
+}
+
+static void FillStreaming(uint8_t* destination, uint32_t pattern, uint32_t count)
+{
+    uint32_t head = -(uint32_t)destination & 15;
+    count -= head;
+    __asm__ volatile("rep stosb" : "+D" (destination), "+c" (head) : "a" (pattern) : "memory");
+
+    while(count >= 64)
+    {
+        uint32_t chunk = count < StreamChunk ? count & ~63 : StreamChunk;
+        count -= chunk;
+
+        uint32_t eflags = FpuManager::ActiveFpuManager->Acquire();
+        __asm__ volatile("movd %3, %%xmm0\n"
+                         "pshufd $0, %%xmm0, %%xmm0\n"
+                         "1:\n"
+                         "movntdq %%xmm0, (%0)\n"
+                         "movntdq %%xmm0, 16(%0)\n"
+                         "movntdq %%xmm0, 32(%0)\n"
+                         "movntdq %%xmm0, 48(%0)\n"
+                         "add $64, %0\n"
+                         "sub $64, %1\n"
+                         "jnz 1b\n"
+                         "sfence"
+                         : "+r" (destination), "+r" (chunk)
+                         : "r" (pattern)
+                         : "memory", "cc");
+        FpuManager::ActiveFpuManager->Release(eflags);
+    }
+    FillDwords(destination, pattern, count);
+}
+
+void* kmemcpy(void* destination, const void* source, uint32_t count)
+{
+    if(count >= streamCopyThreshold && CanStream())
+        CopyStreaming((uint8_t*)destination, (const uint8_t*)source, count);
+    else
+        CopyDwords((uint8_t*)destination, (const uint8_t*)source, count);
+    return destination;
+}
+
+void* kmemmove(void* destination, const void* source, uint32_t count)
+{
+    uint8_t* d = (uint8_t*)destination;
+    const uint8_t* s = (const uint8_t*)source;
+    if(d <= s || d >= s + count)
+        return kmemcpy(destination, source, count);
+    // A forward copy only goes wrong when the destination starts inside the source.
+
+    uint32_t bytes = count & 3;
+    uint32_t dwords = count >> 2;
+    d += count - 1;
+    s += count - 1;
+    __asm__ volatile("std\n"
+                     "rep movsb\n"
+                     "sub $3, %%edi\n"
+                     "sub $3, %%esi\n"
+                     "mov %3, %%ecx\n"
+                     "rep movsl\n"
+                     "cld"
+                     : "+D" (d), "+S" (s), "+c" (bytes)
+                     : "r" (dwords)
+                     : "memory", "cc");
+    // Backwards from the last byte: the odd bytes at the end first, then whole dwords.
+    return destination;
+}
+
+void* kmemset(void* destination, uint8_t value, uint32_t count)
+{
+    uint32_t pattern = (uint32_t)value * 0x01010101u;
+    if(count >= streamFillThreshold && CanStream())
+        FillStreaming((uint8_t*)destination, pattern, count);
+    else
+        FillDwords((uint8_t*)destination, pattern, count);
+    return destination;
+}
+
+int kmemcmp(const void* a, const void* b, uint32_t count)
+{
+    const uint8_t* x = (const uint8_t*)a;
+    const uint8_t* y = (const uint8_t*)b;
+    while(count >= 4 && *(const uint32_t*)x == *(const uint32_t*)y)
+    {
+        x += 4;
+        y += 4;
+        count -= 4;
+    }
+    // Skips equal dwords; the first difference is then found bytewise.
+
+    for(; count > 0; --count, ++x, ++y)
+    {
+        if(*x != *y)
+            return *x < *y ? -1 : 1;
+    }
+    return 0;
+}
+
+extern "C" void* memcpy(void* destination, const void* source, uint32_t count)
+{
+    return kmemcpy(destination, source, count);
+}
+
+extern "C" void* memmove(void* destination, const void* source, uint32_t count)
+{
+    return kmemmove(destination, source, count);
+}
+
+extern "C" void* memset(void* destination, int value, uint32_t count)
+{
+    return kmemset(destination, (uint8_t)value, count);
+}
+
+extern "C" int memcmp(const void* a, const void* b, uint32_t count)
+{
+    return kmemcmp(a, b, count);
+}
+
+
+static const uint32_t BenchmarkSmall = 4 * 1024;
+// Stays in the L1 cache.
+static const uint32_t BenchmarkLarge = 4 * 1024 * 1024;
+// Larger than most L2 caches, so the stores have to go out to memory.
+static const uint32_t BenchmarkRuns = 3;
+
+static uint32_t BestCycles(void (*copy)(uint8_t*, const uint8_t*, uint32_t), void (*fill)(uint8_t*, uint32_t, uint32_t),
+                           uint8_t* destination, const uint8_t* source, uint32_t size)
+{
+    uint64_t best = 0xFFFFFFFF;
+    for(uint32_t run = 0; run < BenchmarkRuns; ++run)
+    {
+        uint64_t start = TimerDriver::ReadTSC();
+        if(copy != 0)
+            copy(destination, source, size);
+        else
+            fill(destination, 0x5A5A5A5A, size);
+        uint64_t cycles = TimerDriver::ReadTSC() - start;
+        if(cycles < best)
+            best = cycles;
+    }
+    return best > 0 ? (uint32_t)best : 1;
+}
+// The best of a few runs, which leaves out the first run's cache and TLB misses.
+
+static void PrintRate(const char* variant, uint32_t size, uint32_t cycles, uint64_t tscFrequency)
+{
+    uint32_t megabytes = (uint32_t)DivU64(DivU64((uint64_t)size * tscFrequency, cycles), 1000000);
+    kprintf(" %s %u.%02u", variant, megabytes / 1000, (megabytes % 1000) / 10);
+}
+
+void MemoryBenchmark(TimerDriver* timer)
+{
+    uint64_t frequency = timer->TscFrequency();
+    uint8_t* source = new uint8_t[BenchmarkLarge];
+    uint8_t* destination = new uint8_t[BenchmarkLarge];
+    if(frequency == 0 || source == 0 || destination == 0)
+    {
+        delete[] source;
+        delete[] destination;
+        return;
+    }
+    FillDwords(source, 0, BenchmarkLarge);
+    FillDwords(destination, 0, BenchmarkLarge);
+    // Map both buffers before timing anything.
+
+    bool sse = CanStream();
+    uint32_t sizes[2] = { BenchmarkSmall, BenchmarkLarge };
+    uint32_t dwordCopy = 0, streamCopy = 0, dwordFill = 0, streamFill = 0;
+    for(uint32_t i = 0; i < 2; ++i)
+    {
+        kprintf("Memory: %u KiB GB/s: copy", sizes[i] / 1024);
+        dwordCopy = BestCycles(&CopyDwords, 0, destination, source, sizes[i]);
+        PrintRate("rep movsd", sizes[i], dwordCopy, frequency);
+        if(sse)
+        {
+            streamCopy = BestCycles(&CopyStreaming, 0, destination, source, sizes[i]);
+            PrintRate("sse2 nt", sizes[i], streamCopy, frequency);
+        }
+
+        kprintf(", fill");
+        dwordFill = BestCycles(0, &FillDwords, destination, 0, sizes[i]);
+        PrintRate("rep stosd", sizes[i], dwordFill, frequency);
+        if(sse)
+        {
+            streamFill = BestCycles(0, &FillStreaming, destination, 0, sizes[i]);
+            PrintRate("sse2 nt", sizes[i], streamFill, frequency);
+        }
+        kprintf("\n");
+    }
+
+    if(sse && streamCopy < dwordCopy)
+        streamCopyThreshold = BenchmarkLarge / 4;
+    if(sse && streamFill < dwordFill)
+        streamFillThreshold = BenchmarkLarge / 4;
+    // Streaming only pays off for blocks that wouldn't stay in the cache anyway;
+    // what's left in `*Copy`/`*Fill` are the large block's results.
+    if(streamCopyThreshold != NoStreaming || streamFillThreshold != NoStreaming)
+        kprintf("Memory: streaming stores from %u KiB for%s%s\n", BenchmarkLarge / 4 / 1024,
+                streamCopyThreshold != NoStreaming ? " copy" : "",
+                streamFillThreshold != NoStreaming ? " fill" : "");
+
+    delete[] source;
+    delete[] destination;
+}
@@ -0,0 +1,37 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "types.h"
+
+class TimerDriver;
+
+// Memory primitives for a kernel without libc. Short blocks go a byte at a
+// time, medium ones a dword at a time with `rep movsd`/`rep stosd` after aligning
+// the destination, and blocks above the streaming threshold with SSE2
+// non-temporal stores that bypass the cache (only once FpuManager has SSE2 on,
+// and only if `MemoryBenchmark` found them faster).
+
+void* kmemcpy(void* destination, const void* source, uint32_t count);
+// Copies `count` bytes; the blocks must not overlap. Returns `destination`.
+
+void* kmemmove(void* destination, const void* source, uint32_t count);
+// Like kmemcpy, but the blocks may overlap.
+
+void* kmemset(void* destination, uint8_t value, uint32_t count);
+// Fills `count` bytes with `value`. Returns `destination`.
+
+int kmemcmp(const void* a, const void* b, uint32_t count);
+// Compares bytewise as unsigned; <0, 0 or >0 like memcmp.
+
+void MemoryBenchmark(TimerDriver* timer);
+// Times each copy and fill variant on a cached and an uncached block, prints
+// the throughput in GB/s with kprintf and enables streaming for large blocks
+// if it beats `rep movsd`/`rep stosd`. Needs the calibrated TSC and the heap.
+
+extern "C" void* memcpy(void* destination, const void* source, uint32_t count);
+extern "C" void* memmove(void* destination, const void* source, uint32_t count);
+extern "C" void* memset(void* destination, int value, uint32_t count);
+extern "C" int memcmp(const void* a, const void* b, uint32_t count);
+// g++ may emit calls to these for aggregate copies even with -fno-builtin.
+
+#endif
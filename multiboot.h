@@ -0,0 +1,51 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "types.h"
+
+// Structures handed to the kernel by a Multiboot (version 1) boot loader.
+// See the Multiboot Specification 0.6.96, section 3.3 "Boot information format".
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+// Value in eax when a Multiboot loader jumps to `loader`.
+
+#define MULTIBOOT_INFO_MEMORY   0x00000001  // mem_lower/mem_upper are valid.
+#define MULTIBOOT_INFO_MEM_MAP  0x00000040  // mmap_length/mmap_addr are valid.
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+// Type of memory map entries that describe usable RAM.
+
+struct multiboot_info
+{
+    uint32_t flags;         // Which of the fields below are valid.
+    uint32_t mem_lower;     // KiB of memory below 1 MiB.
+    uint32_t mem_upper;     // KiB of memory above 1 MiB, up to the first hole.
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;   // Size in bytes of the memory map buffer.
+    uint32_t mmap_addr;     // Physical address of the first memory map entry.
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+    uint32_t vbe_control_info;
+    uint32_t vbe_mode_info;
+    uint16_t vbe_mode;
+    uint16_t vbe_interface_seg;
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+} __attribute__((packed));
+
+struct multiboot_mmap_entry
+{
+    uint32_t size;          // Size of the rest of the entry; the next entry starts at `&base_addr + size`.
+    uint64_t base_addr;
+    uint64_t length;
+    uint32_t type;          // MULTIBOOT_MEMORY_AVAILABLE for usable RAM.
+} __attribute__((packed));
+
+#endif
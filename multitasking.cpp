@@ -0,0 +1,375 @@
+#include "multitasking.h"
+#include "smp.h"
+#include "fpu.h"
+#include "kprintf.h"
+#include "console.h"
+
+Task::Task()
+{
+    cpustate = 0;
+    entrypoint = 0;
+    retire = 0;
+    fpuUsed = false;
+    fpuCpu = 0;
+    waitNext = 0;
+    readyNext = 0;
+    state = Running;
+    pinned = true;
+}
+
+void Task::InitializeFrame(uint32_t eip, uint32_t cs, uint32_t data, uint32_t gs)
+{
+    // Build the frame int_bottom expects at the top of the new stack.
+    // The trailing esp/ss fields are only popped on a privilege change, so
+    // for a ring 0 task they are just unused space at the top of the stack.
+    cpustate = (CPUState*)(stack + sizeof(stack) - sizeof(CPUState));
+    *(uint32_t*)stack = StackCanary;
+
+    cpustate->eax = 0;
+    cpustate->ebx = 0;
+    cpustate->ecx = 0;
+    cpustate->edx = 0;
+
+    cpustate->esi = 0;
+    cpustate->edi = 0;
+    cpustate->ebp = 0;
+    cpustate->kernel_esp = 0;
+
+    cpustate->gs = gs;
+    cpustate->fs = data;
+    cpustate->es = data;
+    cpustate->ds = data;
+
+    cpustate->interrupt = 0;
+    cpustate->error = 0;
+
+    cpustate->eip = eip;
+    cpustate->cs = cs;
+    cpustate->eflags = 0x202;   // IF set, bit 1 is reserved and always 1.
+    cpustate->esp = 0;
+    cpustate->ss = 0;
+
+    fpuUsed = false;
+    fpuCpu = 0;
+    waitNext = 0;
+    readyNext = 0;
+    retire = 0;
+    state = Ready;
+    pinned = false;
+}
+
+Task::Task(GDT* gdt, void (*entrypoint)())
+{
+    InitializeFrame((uint32_t)&TaskManager::TaskEntry, gdt->CSS(), gdt->DSS(), gdt->PSS());
+    // %gs is the per-CPU segment: popped on whichever CPU runs the task, it selects that CPU's block.
+    this->entrypoint = entrypoint;
+}
+
+Task::Task(GDT* gdt, uint32_t userEntry, uint32_t userStack)
+{
+    InitializeFrame(userEntry, gdt->UserCSS(), gdt->UserDSS(), gdt->UserDSS());
+    cpustate->esp = userStack;
+    cpustate->ss = gdt->UserDSS();
+    // The iret to a ring 3 cs pops these as well.
+    entrypoint = 0;
+}
+
+Task::~Task()
+{}
+
+
+TaskManager* TaskManager::ActiveTaskManager = 0;
+TaskManager* TaskManager::managers[TaskManager::MaxManagers];
+uint32_t TaskManager::managerCount = 0;
+
+TaskManager::TaskManager(uint32_t timeSliceTicks, bool bootTaskIdles)
+{
+    current = &bootTask;
+    this->bootTaskIdles = bootTaskIdles;
+    previous = 0;
+    retired = 0;
+    overflowHead = 0;
+    overflowTail = 0;
+    pinnedReady = 0;
+    pinnedTurn = 0;
+    steals = 0;
+    timeSlice = timeSliceTicks > 0 ? timeSliceTicks : 1;
+    ticksLeft = timeSlice;
+
+    index = managerCount;
+    if(managerCount < MaxManagers)
+        managers[managerCount++] = this;
+    // Managers are created one CPU at a time during bring-up, never concurrently.
+
+    Cpu* cpu = Cpu::Current();
+    if(cpu != 0)
+        cpu->scheduler = this;
+    if(ActiveTaskManager == 0)
+        ActiveTaskManager = this;
+}
+
+TaskManager::~TaskManager()
+{
+    if(ActiveTaskManager == this)
+        ActiveTaskManager = 0;
+}
+
+TaskManager* TaskManager::Current()
+{
+    Cpu* cpu = Cpu::Current();
+    if(cpu != 0 && cpu->scheduler != 0)
+        return cpu->scheduler;
+    return ActiveTaskManager;
+}
+
+bool TaskManager::AddTask(Task* task)
+{
+    if(task == 0 || task->state != Task::Ready || task->pinned)
+        return false;
+
+    // The run queue is also pushed to from the timer interrupt, keep it out while we add the task.
+    unsigned int eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags));
+    bool added = queue.Push(task);
+    __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+    return added;
+}
+
+void TaskManager::SetTimeSlice(uint32_t ticks)
+{
+    timeSlice = ticks > 0 ? ticks : 1;
+}
+
+bool TaskManager::HasReadyTasks()
+{
+    return queue.Count() != 0 || previous != 0 || pinnedReady != 0 || overflowHead != 0;
+}
+
+uint32_t TaskManager::Steals()
+{
+    return steals;
+}
+
+void TaskManager::Publish()
+{
+    if(retired != 0)
+    {
+        Task* task = retired;
+        retired = 0;
+        if(task->retire != 0)
+            task->retire(task);
+    }
+
+    if(previous != 0 && previous->state == Task::Blocking
+       && AtomicCompareAndSwap(&previous->state, Task::Blocking, Task::Blocked))
+        previous = 0;
+    // Asleep for good now: from here on its waker queues it.
+
+    if(previous != 0 && previous->state == Task::Woken)
+        previous->state = Task::Ready;
+    // Woken before it got off the CPU: it goes back into the run queue.
+
+    if(previous != 0 && previous->pinned)
+    {
+        pinnedReady = previous;
+        pinnedTurn = queue.Pushed();
+        previous = 0;
+    }
+    else if(previous != 0 && queue.Push(previous))
+        previous = 0;
+
+    while(previous == 0 && overflowHead != 0 && queue.Push(overflowHead))
+    {
+        overflowHead = overflowHead->readyNext;
+        if(overflowHead == 0)
+            overflowTail = 0;
+    }
+    // Behind `previous`, which was switched away from before any of them was woken.
+}
+
+void TaskManager::AddWoken(Task* task)
+{
+    if(overflowHead != 0 || !queue.Push(task))
+    {
+        task->readyNext = 0;
+        if(overflowTail != 0)
+            overflowTail->readyNext = task;
+        else
+            overflowHead = task;
+        overflowTail = task;
+    }
+    // Once anything overflowed, later wake-ups queue up behind it.
+}
+
+bool TaskManager::StealTask(Task** task)
+{
+    for(uint32_t i = 1; i < managerCount; ++i)
+    {
+        TaskManager* victim = managers[(index + i) % managerCount];
+        if(victim->queue.Steal(task))
+        {
+            steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+CPUState* TaskManager::Tick(CPUState* cpustate)
+{
+    Publish();
+    if(--ticksLeft > 0 && current->state == Task::Running && !(bootTaskIdles && current == &bootTask))
+        return cpustate;
+    return Schedule(cpustate);
+}
+
+CPUState* TaskManager::Schedule(CPUState* cpustate)
+{
+    ticksLeft = timeSlice;
+
+    if(current != &bootTask && *(uint32_t*)current->stack != Task::StackCanary)
+    {
+        kprintf("\nTASK STACK OVERFLOW: task %p, esp %p\n", (void*)current, (void*)cpustate);
+        if(VgaConsole::ActiveConsole != 0)
+            VgaConsole::ActiveConsole->Flush();
+        while(1)
+            __asm__ volatile("cli; hlt");
+    }
+    // The boot task runs on the CPU's own stack and has no canary.
+
+    if(current->state == Task::Woken)
+        current->state = Task::Running;
+    // Woken before it even got to sleep; it can simply go on.
+
+    Publish();
+    if(previous != 0)
+        return cpustate;
+    // The queue is full; keep the current task until `previous` fits.
+
+    Task* next;
+    if(pinnedReady != 0 && (int32_t)(queue.Taken() - pinnedTurn) >= 0)
+    {
+        next = pinnedReady;
+        pinnedReady = 0;
+    }
+    // Its turn: everything queued before it has run or was stolen.
+    else if(!queue.Steal(&next) && !StealTask(&next))
+    {
+        if(current->state == Task::Running)
+            return cpustate;
+        // Nothing else is ready, keep running the current task.
+
+        next = &bootTask;
+        // The current task finished and nothing is ready. A boot task that doesn't
+        // idle would have been in `pinnedReady`, so this is the idle case.
+    }
+
+    current->cpustate = cpustate;
+    if(current->state == Task::Running)
+    {
+        current->state = Task::Ready;
+        if(!(bootTaskIdles && current == &bootTask))
+            previous = current;
+    }
+    else if(current->state != Task::Finished)
+        previous = current;
+    // Blocking (or Woken meanwhile): `Publish` settles it once we are off its stack.
+    else
+        retired = current;
+    // Likewise, a finished task is only freed once nothing runs on its stack.
+
+    Cpu* cpu = Cpu::Current();
+    if(cpu != 0 && FpuManager::ActiveFpuManager != 0)
+        FpuManager::ActiveFpuManager->SwitchTask(cpu, current);
+    // Sets CR0.TS: the FPU state follows only when the next task touches the FPU.
+
+    next->state = Task::Running;
+    current = next;
+
+    if(cpu != 0 && next != &bootTask)
+        cpu->tss.esp0 = (uint32_t)(next->stack + sizeof(next->stack));
+    // Entries from ring 3 land at the top of the task's own kernel stack (empty
+    // whenever the task is in ring 3). The boot task never leaves ring 0.
+    return current->cpustate;
+}
+
+CPUState* TaskManager::Terminate(CPUState* cpustate)
+{
+    current->state = Task::Finished;
+    return Schedule(cpustate);
+}
+
+Task* TaskManager::CurrentTask()
+{
+    return current;
+}
+
+bool TaskManager::CanBlock()
+{
+    return current != &bootTask;
+}
+
+void TaskManager::Block(SpinLock* lock)
+{
+    Task* task = current;
+    task->state = Task::Blocking;
+    lock->Unlock();
+    // From here a waker may move the task to Woken; Schedule and Publish deal with that.
+
+    __asm__ volatile("int %0" : : "i" (YieldVector) : "memory");
+
+    AtomicCompareAndSwap(&task->state, Task::Blocking, Task::Running);
+    // Still Blocking only if Schedule couldn't switch away (its queue was full).
+}
+
+void TaskManager::Wake(Task* task)
+{
+    if(AtomicCompareAndSwap(&task->state, Task::Blocking, Task::Woken))
+        return;
+    // Its CPU hasn't finished switching away; it requeues the task itself.
+
+    if(AtomicCompareAndSwap(&task->state, Task::Blocked, Task::Ready))
+    {
+        unsigned int eflags;
+        __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags));
+        TaskManager* manager = Current();
+        if(manager != 0)
+            manager->AddWoken(task);
+        __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+        // Interrupts off: the timer pushes to the same queue, and the waker must
+        // not move to another CPU between finding its manager and using it.
+    }
+}
+
+void TaskManager::TaskEntry()
+{
+    __asm__ volatile("cli");
+    Task* task = Current()->current;
+    __asm__ volatile("sti");
+    // Without interrupts, so the task can't move to another CPU between the two reads.
+
+    task->entrypoint();
+
+    // The entry point returned: retire the task and wait to be switched away for good.
+    task->state = Task::Finished;
+    while(1)
+        __asm__ volatile("hlt");
+}
+
+
+YieldHandler::YieldHandler(InterruptManager* manager)
+: InterruptHandler(manager, TaskManager::YieldVector)
+{
+}
+
+YieldHandler::~YieldHandler()
+{
+}
+
+unsigned int YieldHandler::HandleInterrupt(unsigned int esp)
+{
+    TaskManager* manager = TaskManager::Current();
+    if(manager != 0)
+        esp = (unsigned int)manager->Schedule((CPUState*)esp);
+    return esp;
+}
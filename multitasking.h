@@ -0,0 +1,238 @@
+#ifndef MULTITASKING_H
+#define MULTITASKING_H
+
+#include "types.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "workstealingqueue.h"
+#include "spinlock.h"
+
+class TaskManager;
+class Cpu;
+
+class Task
+// A kernel thread: its own stack plus the register frame to resume it from. A
+// user task runs in ring 3 and enters the kernel on the same stack.
+{
+    friend class TaskManager;
+    friend class WaitQueue;
+    friend class SyscallManager;
+    friend class FpuManager;
+
+    enum State
+    {
+        Ready,      // Waiting in the run queue.
+        Running,    // Currently owns the CPU.
+        Blocking,   // Giving up the CPU to sleep; still on its stack.
+        Woken,      // Woken while still Blocking; goes on running or back to a run queue.
+        Blocked,    // Asleep in a WaitQueue, off the CPU.
+        Finished    // Entry point returned; never scheduled again.
+    };
+
+public:
+    static const uint32_t StackSize = 16384;
+    static const uint32_t StackCanary = 0xC0FFEE57;
+    // Kept in the lowest word of `stack`; Schedule stops the kernel when it was
+    // overwritten rather than let a task run on with a corrupted neighbour.
+
+private:
+    uint8_t stack[StackSize] __attribute__((aligned(16)));
+    // The task's kernel stack. The initial CPUState frame is built at its top.
+
+    CPUState* cpustate;
+    // Saved register frame on `stack`, valid while the task is not running.
+
+    uint8_t fpuState[512] __attribute__((aligned(16)));
+    // FPU and SSE registers (FXSAVE layout), saved by FpuManager when another task needs the FPU.
+
+    bool fpuUsed;
+    // Whether `fpuState` holds anything yet; until then the task starts from a clean FPU.
+
+    Cpu* fpuCpu;
+    // CPU that last loaded the task's FPU state into its registers.
+
+    void (*entrypoint)();
+    // Function run by the task.
+
+    void (*retire)(Task* task);
+    // Frees the task once it has finished and its CPU is off its stack, or 0 if
+    // whoever created the task keeps it. Runs in the timer interrupt.
+
+    volatile uint32_t state;
+    // Scheduling state of the task (a State). Wakers on other CPUs change it with compare-and-swap.
+
+    Task* waitNext;
+    // Link in the WaitQueue the task sleeps in.
+
+    Task* readyNext;
+    // Link in the overflow list of the TaskManager that woke it.
+
+    bool pinned;
+    // Never taken by another CPU (the boot task of each CPU runs on that CPU's own stack setup).
+    // Pinned tasks never enter a run queue, see TaskManager::pinnedReady.
+
+    void InitializeFrame(uint32_t eip, uint32_t cs, uint32_t data, uint32_t gs);
+    // Builds the frame int_bottom resumes the task from at the top of `stack`.
+
+    Task();
+    // Adopts the context that is running when the TaskManager is created (kernelMain).
+
+public:
+    Task(GDT* gdt, void (*entrypoint)());
+    // Prepares a task that will start executing `entrypoint` on its own stack
+    // the first time it is scheduled.
+
+    Task(GDT* gdt, uint32_t userEntry, uint32_t userStack);
+    // Prepares a ring 3 task that starts at `userEntry` with its stack pointer at
+    // `userStack`; both must be mapped with PageManager::PageUser. It ends with
+    // the exit system call rather than by returning.
+
+    ~Task();
+};
+
+class TaskManager
+// Preemptive round-robin scheduler for one CPU. The CPU's timer calls `Tick` with
+// the interrupted frame; when the current task's time slice is used up, the frame
+// of the next ready task is returned and int_bottom switches to its stack.
+// Every CPU has its own manager and run queue. A CPU that runs out of work takes
+// ready tasks from the queues of the others, so tasks spread over all CPUs
+// without a shared queue or lock.
+{
+    friend class Task;
+
+public:
+    static const uint32_t QueueSize = 64;
+    static const uint32_t MaxManagers = 16;
+
+private:
+    Task bootTask;
+    // The context that created the TaskManager. Scheduled like any other task, or
+    // only when nothing else is ready if `bootTaskIdles`.
+
+    bool bootTaskIdles;
+
+    Task* current;
+    // The task that is running right now.
+
+    WorkStealingQueue<Task*, QueueSize> queue;
+    // Ready tasks of this CPU; other CPUs steal from its top.
+
+    Task* pinnedReady;
+    uint32_t pinnedTurn;
+    // The boot task while it waits for its turn, kept out of `queue` so that
+    // thieves never find it at the top. It runs again once every task queued
+    // before it (`queue.Pushed()` at that time) has been taken.
+
+    Task* overflowHead;
+    Task* overflowTail;
+    // Tasks woken on this CPU while `queue` was full, oldest first. `Publish`
+    // moves them into the queue as it drains.
+
+    Task* retired;
+    // Finished task switched away from, handed to its `retire` on the next tick.
+
+    Task* previous;
+    // Task switched away from and not yet queued. It is queued (or, if it went to
+    // sleep, marked Blocked) on the next tick, once int_bottom has left its stack;
+    // done right away, another CPU could resume it while this one still unwinds
+    // on that stack.
+
+    uint32_t index;
+    // Position in `managers`.
+
+    uint32_t timeSlice;
+    // Length of a time slice in timer ticks.
+
+    uint32_t ticksLeft;
+    // Ticks remaining in the current task's slice.
+
+    static TaskManager* managers[MaxManagers];
+    static uint32_t managerCount;
+    // Every CPU's manager, for stealing.
+
+    uint32_t steals;
+
+    void Publish();
+    // Retires `retired`, queues `previous`, then as many overflow tasks as fit
+    // (interrupts off).
+
+    void AddWoken(Task* task);
+    // Queues a task that Wake made Ready, or appends it to the overflow list
+    // (interrupts off).
+
+    bool StealTask(Task** task);
+    // Takes a ready task from another CPU's queue.
+
+    static void TaskEntry();
+    // First code every new task runs: calls the entry point and retires the task when it returns.
+
+public:
+    static TaskManager* ActiveTaskManager;
+    // The boot processor's scheduler, set by the first constructor.
+
+    TaskManager(uint32_t timeSliceTicks = 10, bool bootTaskIdles = false);
+    // Becomes the calling CPU's scheduler. With `bootTaskIdles` the calling context
+    // is this CPU's idle loop: it is not queued and only runs when there is nothing
+    // else, and every tick it runs looks for work on the other CPUs.
+
+    ~TaskManager();
+
+    static TaskManager* Current();
+    // The calling CPU's scheduler.
+
+    bool AddTask(Task* task);
+    // Puts a new task on this manager's run queue. Must run on the manager's CPU.
+
+    bool HasReadyTasks();
+    // Whether any task besides the current one is waiting for this CPU.
+
+    uint32_t Steals();
+    // Tasks this CPU took from other CPUs.
+
+    static const uint8_t YieldStub = 0x21;
+    static const uint8_t YieldVector = InterruptManager::DefaultHardwareInterruptOffset + YieldStub;
+    // Software interrupt that enters `Schedule` from a task, see YieldHandler. The
+    // stub in interruptstubs.s pushes the hardware offset plus its number.
+
+    Task* CurrentTask();
+
+    bool CanBlock();
+    // Whether the current task may sleep; the boot task (the idle loop) may not.
+
+    void Block(SpinLock* lock);
+    // Puts the current task to sleep. Called with interrupts off and `lock` held,
+    // after the task was put where its waker will find it; releases `lock` and
+    // returns once the task is woken (or, rarely, right away: callers re-check
+    // what they wait for).
+
+    static void Wake(Task* task);
+    // Makes a sleeping task runnable again, on the calling CPU's run queue (or
+    // its overflow list while that queue is full).
+
+    void SetTimeSlice(uint32_t ticks);
+    // Changes the time slice, in timer ticks.
+
+    CPUState* Tick(CPUState* cpustate);
+    // Called once per timer tick; preempts the current task at the end of its slice.
+
+    CPUState* Schedule(CPUState* cpustate);
+    // Saves `cpustate` for the current task and returns the frame of the next one.
+
+    CPUState* Terminate(CPUState* cpustate);
+    // Retires the current task from an exception handler (a fault in ring 3 that
+    // nothing can fix) and returns the frame of the next one. Should the run
+    // queue be full, the faulting task is resumed and ends up here again.
+};
+
+class YieldHandler : public InterruptHandler
+// Handles `int TaskManager::YieldVector`, with which a task enters the scheduler
+// without waiting for the timer.
+{
+public:
+    YieldHandler(InterruptManager* manager);
+    ~YieldHandler();
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include "paging.h"
+#include "kprintf.h"
+#include "memory.h"
+#include "console.h"
+#include "smp.h"
+#include "multitasking.h"
+
+extern "C" uint8_t kernel_end;
+// Defined by linker.ld after .bss.
+
+uint32_t PageManager::pageDirectory[1024];
+PageManager* PageManager::ActivePageManager = 0;
+
+static void InvalidateEverywhere(uint32_t virtualAddress)
+{
+    PageManager::InvalidatePage(virtualAddress);
+    if(SmpManager::ActiveSmpManager != 0)
+        SmpManager::ActiveSmpManager->InvalidatePage(virtualAddress);
+}
+// For an entry that was present: any CPU may have it cached.
+
+static const uint32_t RecursiveSlot = 1023;
+static const uint32_t PageTablesBase = 0xFFC00000;
+// With the directory in its own last slot, page table n appears at 0xFFC00000 + n * 4 KiB.
+
+PageManager::PageManager(InterruptManager* manager, PhysicalMemoryManager* pmm)
+: InterruptHandler(manager, 0x0E),  // Page fault exception.
+  lock("paging")
+{
+    this->pmm = pmm;
+    demandFaults = 0;
+
+    unsigned int eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    bool hasPSE = edx & (1 << 3);
+    globalFlag = (edx & (1 << 13)) ? PageGlobal : 0;
+
+    kernelLimit = ((uint32_t)&kernel_end + LargePageSize - 1) & ~(LargePageSize - 1);
+
+    for(uint32_t i = 0; i < 1024; ++i)
+        pageDirectory[i] = 0;
+
+    for(uint32_t address = 0; address < kernelLimit; address += LargePageSize)
+    {
+        if(hasPSE)
+        {
+            pageDirectory[address >> 22] = address | PagePresent | PageWritable | PageLarge | globalFlag;
+            continue;
+        }
+
+        // Without PSE the kernel gets ordinary page tables. Paging is still off,
+        // so the new frame can be filled through its physical address.
+        uint32_t* table = (uint32_t*)pmm->AllocateFrame();
+        for(uint32_t i = 0; i < 1024; ++i)
+            table[i] = (address + i * PageSize) | PagePresent | PageWritable | globalFlag;
+        pageDirectory[address >> 22] = (uint32_t)table | PagePresent | PageWritable;
+    }
+
+    pageDirectory[RecursiveSlot] = (uint32_t)pageDirectory | PagePresent | PageWritable;
+
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+    if(hasPSE)
+        cr4 |= 0x10;    // CR4.PSE: allow 4 MiB pages.
+    if(globalFlag)
+        cr4 |= 0x80;    // CR4.PGE: honour the global bit.
+    __asm__ volatile("mov %0, %%cr4" : : "r" (cr4));
+
+    __asm__ volatile("mov %0, %%cr3" : : "r" (pageDirectory) : "memory");
+
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    cr0 |= 0x80000000 | 0x10000;
+    // CR0.PG turns paging on; CR0.WP makes read-only pages read-only for ring 0 too.
+    __asm__ volatile("mov %0, %%cr0" : : "r" (cr0) : "memory");
+
+    ActivePageManager = this;
+}
+
+PageManager::~PageManager()
+{
+    if(ActivePageManager == this)
+        ActivePageManager = 0;
+}
+
+uint32_t* PageManager::PageTable(uint32_t directoryIndex)
+{
+    return (uint32_t*)(PageTablesBase + directoryIndex * PageSize);
+}
+
+uint32_t* PageManager::PageTableEntry(uint32_t virtualAddress, bool create)
+{
+    uint32_t directoryIndex = virtualAddress >> 22;
+    if(directoryIndex == RecursiveSlot)
+        return 0;
+
+    uint32_t directoryEntry = pageDirectory[directoryIndex];
+    if(directoryEntry & PageLarge)
+        return 0;
+
+    uint32_t* table = PageTable(directoryIndex);
+    if(!(directoryEntry & PagePresent))
+    {
+        if(!create)
+            return 0;
+        uint32_t frame = pmm->AllocateFrame();
+        if(frame == 0)
+            return 0;
+        pageDirectory[directoryIndex] = frame | PagePresent | PageWritable | PageUser;
+        // Access rights are decided per page; the directory entry allows everything.
+        InvalidatePage((uint32_t)table);
+        kmemset(table, 0, PageSize);
+    }
+    return &table[(virtualAddress >> 12) & 1023];
+}
+
+bool PageManager::MapPage(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags)
+{
+    IrqSpinLockGuard guard(&lock);
+    // Without it, two CPUs faulting in the same 4 MiB region could both install a page table.
+
+    uint32_t* entry = PageTableEntry(virtualAddress, true);
+    bool result = entry != 0;
+    if(result)
+    {
+        bool wasPresent = *entry & PagePresent;
+        *entry = (physicalAddress & ~(PageSize - 1)) | (flags & (PageSize - 1)) | PagePresent;
+        if(wasPresent)
+            InvalidateEverywhere(virtualAddress);
+        // A page that wasn't present can't be cached in any TLB.
+    }
+    return result;
+}
+
+bool PageManager::MapRange(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t length, uint32_t flags)
+{
+    uint32_t offset = virtualAddress & (PageSize - 1);
+    uint32_t pages = (length + offset + PageSize - 1) / PageSize;
+    virtualAddress -= offset;
+    physicalAddress &= ~(PageSize - 1);
+    for(uint32_t i = 0; i < pages; ++i)
+    {
+        if(!MapPage(virtualAddress + i * PageSize, physicalAddress + i * PageSize, flags))
+            return false;
+    }
+    return true;
+}
+
+void PageManager::UnmapPage(uint32_t virtualAddress)
+{
+    IrqSpinLockGuard guard(&lock);
+    uint32_t* entry = PageTableEntry(virtualAddress, false);
+    if(entry == 0 || !(*entry & PagePresent))
+        return;
+    *entry = PageGuard;
+    InvalidateEverywhere(virtualAddress);
+}
+
+void PageManager::ReleasePage(uint32_t address)
+{
+    if(address < kernelLimit)
+        return;
+    IrqSpinLockGuard guard(&lock);
+    uint32_t* entry = PageTableEntry(address, false);
+    if(entry == 0 || (*entry & (PagePresent | ~(PageSize - 1))) != (address | PagePresent))
+        return;
+    // Only identity mappings; anything mapped there on purpose stays.
+    *entry = 0;
+    InvalidateEverywhere(address);
+}
+
+uint32_t PageManager::Translate(uint32_t virtualAddress)
+{
+    uint32_t directoryEntry = pageDirectory[virtualAddress >> 22];
+    if(!(directoryEntry & PagePresent))
+        return 0;
+    if(directoryEntry & PageLarge)
+        return (directoryEntry & ~(LargePageSize - 1)) | (virtualAddress & (LargePageSize - 1));
+
+    uint32_t entry = PageTable(virtualAddress >> 22)[(virtualAddress >> 12) & 1023];
+    if(!(entry & PagePresent))
+        return 0;
+    return (entry & ~(PageSize - 1)) | (virtualAddress & (PageSize - 1));
+}
+
+uint32_t PageManager::DemandFaults()
+{
+    return demandFaults;
+}
+
+unsigned int PageManager::HandleInterrupt(unsigned int esp)
+{
+    CPUState* cpu = (CPUState*)esp;
+
+    uint32_t address;
+    __asm__ volatile("mov %%cr2, %0" : "=r" (address));
+    // CR2 holds the linear address that caused the fault.
+
+    // Error code bits: 0 = protection violation (else not present), 1 = write, 2 = user mode.
+    bool notPresent = !(cpu->error & 0x1);
+    bool fromKernel = !(cpu->error & 0x4);
+    bool isRam = address >= kernelLimit && (address >> 12) < pmm->EndFrame();
+
+    uint32_t* entry = PageTableEntry(address, false);
+    bool guard = entry != 0 && (*entry & PageGuard);
+    // Removed with UnmapPage on purpose.
+
+    if(notPresent && fromKernel && isRam && !guard && pmm->InUse(address))
+    {
+        if(MapPage(address, address, PageWritable | globalFlag))
+        {
+            demandFaults++;
+            return esp;
+        }
+    }
+
+    kprintf("\nPAGE FAULT at %p (%s, %s, %s) eip %p\n", (void*)address,
+            notPresent ? "not present" : "protection",
+            (cpu->error & 0x2) ? "write" : "read",
+            fromKernel ? "kernel" : "user",
+            (void*)cpu->eip);
+
+    if((cpu->cs & 3) && TaskManager::Current() != 0)
+    {
+        kprintf("Task terminated\n");
+        return (unsigned int)TaskManager::Current()->Terminate(cpu);
+    }
+    // A user task only takes itself down; a kernel fault is fatal.
+
+    if(VgaConsole::ActiveConsole != 0)
+        VgaConsole::ActiveConsole->Flush();
+
+    while(1)
+        __asm__ volatile("cli; hlt");
+}
@@ -0,0 +1,98 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "types.h"
+#include "interrupts.h"
+#include "pmm.h"
+#include "spinlock.h"
+
+class PageManager : public InterruptHandler
+// Two-level i386 paging.
+// The kernel image (everything from 0 up to `kernel_end`, rounded up) is identity
+// mapped with 4 MiB PSE pages, so it costs a handful of TLB entries. All other
+// memory uses 4 KiB pages: RAM is identity mapped on demand by the page fault
+// handler the first time it is touched (if the PMM has handed out or reserved
+// the frame; free frames and unmapped pages fault for real), and drivers map MMIO explicitly with
+// `MapPage`. The last page directory slot points at the directory itself, which
+// makes every page table visible at 0xFFC00000 + index * 4 KiB, so page tables can
+// live in any physical frame without being mapped separately.
+{
+public:
+    static const uint32_t PagePresent = 0x001;
+    static const uint32_t PageWritable = 0x002;
+    static const uint32_t PageUser = 0x004;
+    static const uint32_t PageWriteThrough = 0x008;
+    static const uint32_t PageCacheDisable = 0x010;
+    static const uint32_t PageLarge = 0x080;        // PSE: the directory entry maps 4 MiB directly.
+    static const uint32_t PageGlobal = 0x100;       // Kept in the TLB across CR3 reloads (needs CR4.PGE).
+    static const uint32_t PageGuard = 0x200;        // Left in a non-present entry by UnmapPage: never mapped on demand.
+
+    static const uint32_t PageSize = 4096;
+    static const uint32_t LargePageSize = 4 * 1024 * 1024;
+
+private:
+    static uint32_t pageDirectory[1024] __attribute__((aligned(4096)));
+
+    PhysicalMemoryManager* pmm;
+
+    uint32_t kernelLimit;
+    // End of the PSE-mapped kernel region.
+
+    uint32_t globalFlag;
+    // PageGlobal when the CPU supports global pages, else 0.
+
+    uint32_t demandFaults;
+    // Pages mapped by the fault handler.
+
+    SpinLock lock;
+    // Serializes changes to the page tables across CPUs. Held with interrupts off:
+    // the fault handler maps pages too.
+
+    static uint32_t* PageTable(uint32_t directoryIndex);
+    // Address of a page table through the recursive mapping.
+
+    uint32_t* PageTableEntry(uint32_t virtualAddress, bool create);
+    // Returns the entry mapping `virtualAddress`, creating the page table if needed.
+    // Returns 0 if there is no table (and `create` is false), the address lies in a
+    // 4 MiB page, or no frame was available.
+
+public:
+    static PageManager* ActivePageManager;
+
+    PageManager(InterruptManager* manager, PhysicalMemoryManager* pmm);
+    // Builds the page directory, registers the page fault handler (exception 0x0E)
+    // and turns paging on.
+
+    ~PageManager();
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+    // Page fault handler: maps untouched RAM on demand, reports anything else and halts.
+
+    bool MapPage(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags);
+    // Maps one 4 KiB page. Replacing an existing mapping invalidates just that page.
+
+    bool MapRange(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t length, uint32_t flags);
+    // Maps every page touching [virtualAddress, virtualAddress + length).
+
+    void UnmapPage(uint32_t virtualAddress);
+    // Removes a 4 KiB mapping (e.g. to create a guard page). The frame is not freed.
+    // Touching the page afterwards is a fatal fault, even if it is RAM.
+
+    void ReleasePage(uint32_t address);
+    // Drops the on-demand identity mapping of a frame that is being freed, so
+    // stale pointers into it fault until the frame is allocated again.
+
+    uint32_t Translate(uint32_t virtualAddress);
+    // Physical address behind `virtualAddress`, or 0 if it is not mapped.
+
+    uint32_t DemandFaults();
+    // Number of pages mapped on demand so far.
+
+    static inline void InvalidatePage(uint32_t virtualAddress)
+    {
+        __asm__ volatile("invlpg (%0)" : : "r" (virtualAddress) : "memory");
+        // Drops the TLB entry for one page instead of flushing the whole TLB with a CR3 reload.
+    }
+};
+
+#endif
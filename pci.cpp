@@ -0,0 +1,334 @@
+#include "pci.h"
+#include "kprintf.h"
+
+PciController* PciController::ActivePciController = 0;
+
+static inline uint32_t ConfigAddress(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset)
+{
+    return 0x80000000
+         | ((uint32_t)bus << 16)
+         | ((uint32_t)(device & 0x1F) << 11)
+         | ((uint32_t)(function & 0x07) << 8)
+         | (offset & 0xFC);
+}
+
+PciDriver::PciDriver(uint16_t vendorId, uint16_t deviceId, uint16_t classCode, uint16_t subclass)
+{
+    this->vendorId = vendorId;
+    this->deviceId = deviceId;
+    this->classCode = classCode;
+    this->subclass = subclass;
+}
+
+PciDriver::~PciDriver()
+{
+}
+
+bool PciDriver::Matches(const PciDevice* device)
+{
+    return (vendorId == PciAny || vendorId == device->vendorId)
+        && (deviceId == PciAny || deviceId == device->deviceId)
+        && (classCode == PciAny || classCode == device->classCode)
+        && (subclass == PciAny || subclass == device->subclass);
+}
+
+bool PciDriver::Probe(PciDevice* device)
+{
+    return false;
+}
+
+PciController::PciController()
+: configLock("pci config"),
+  tableLock("pci devices")
+{
+    deviceCount = 0;
+    driverCount = 0;
+    enumerated = false;
+    ActivePciController = this;
+}
+
+PciController::~PciController()
+{
+    if(ActivePciController == this)
+        ActivePciController = 0;
+}
+
+uint32_t PciController::Read(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset)
+{
+    IrqSpinLockGuard guard(&configLock);
+    ConfigAddressPort::Write(ConfigAddress(bus, device, function, offset));
+    return ConfigDataPort::Read();
+}
+
+void PciController::Write(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value)
+{
+    IrqSpinLockGuard guard(&configLock);
+    ConfigAddressPort::Write(ConfigAddress(bus, device, function, offset));
+    ConfigDataPort::Write(value);
+}
+
+uint16_t PciController::Read16(const PciDevice* device, uint8_t offset)
+{
+    return Read(device->bus, device->device, device->function, offset) >> ((offset & 2) * 8);
+}
+
+uint8_t PciController::Read8(const PciDevice* device, uint8_t offset)
+{
+    return Read(device->bus, device->device, device->function, offset) >> ((offset & 3) * 8);
+}
+
+void PciController::Write16(const PciDevice* device, uint8_t offset, uint16_t value)
+{
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t dword = Read(device->bus, device->device, device->function, offset);
+    dword = (dword & ~(0xFFFFu << shift)) | ((uint32_t)value << shift);
+    Write(device->bus, device->device, device->function, offset, dword);
+}
+
+void PciController::Enumerate()
+{
+    WriteLockGuard guard(&tableLock);
+    deviceCount = 0;
+
+    uint8_t headerType = Read(0, 0, 0, HeaderTypeRegister) >> 16;
+    if(!(headerType & 0x80))
+        ScanBus(0);
+    else
+    {
+        // Several host bridges: function n of device 0:0 is the bridge for bus n.
+        for(uint8_t function = 0; function < 8; ++function)
+        {
+            if((Read(0, 0, function, VendorIdRegister) & 0xFFFF) == 0xFFFF)
+                continue;
+            // The functions needn't be contiguous; keep looking past a gap.
+            ScanBus(function);
+        }
+    }
+
+    enumerated = true;
+    for(uint32_t i = 0; i < deviceCount; ++i)
+        Bind(&devices[i]);
+}
+
+void PciController::ScanBus(uint8_t bus)
+{
+    for(uint8_t device = 0; device < 32; ++device)
+        ScanDevice(bus, device);
+}
+
+void PciController::ScanDevice(uint8_t bus, uint8_t device)
+{
+    if((Read(bus, device, 0, VendorIdRegister) & 0xFFFF) == 0xFFFF)
+        return;
+    // No device answers in this slot.
+
+    ScanFunction(bus, device, 0);
+
+    uint8_t headerType = Read(bus, device, 0, HeaderTypeRegister) >> 16;
+    if(!(headerType & 0x80))
+        return;
+    for(uint8_t function = 1; function < 8; ++function)
+    {
+        if((Read(bus, device, function, VendorIdRegister) & 0xFFFF) != 0xFFFF)
+            ScanFunction(bus, device, function);
+    }
+}
+
+void PciController::ScanFunction(uint8_t bus, uint8_t device, uint8_t function)
+{
+    uint32_t id = Read(bus, device, function, VendorIdRegister);
+    uint32_t classes = Read(bus, device, function, ClassRegister);
+    uint8_t headerType = (Read(bus, device, function, HeaderTypeRegister) >> 16) & 0x7F;
+
+    if(deviceCount < MaxDevices)
+    {
+        PciDevice* entry = &devices[deviceCount++];
+        entry->bus = bus;
+        entry->device = device;
+        entry->function = function;
+        entry->headerType = headerType;
+        entry->vendorId = id & 0xFFFF;
+        entry->deviceId = id >> 16;
+        entry->revision = classes & 0xFF;
+        entry->progIf = (classes >> 8) & 0xFF;
+        entry->subclass = (classes >> 16) & 0xFF;
+        entry->classCode = classes >> 24;
+        entry->driver = 0;
+
+        uint32_t interrupt = Read(bus, device, function, InterruptLineRegister);
+        entry->interruptLine = interrupt & 0xFF;
+        entry->interruptPin = (interrupt >> 8) & 0xFF;
+
+        for(uint32_t i = 0; i < 6; ++i)
+        {
+            entry->bars[i].address = 0;
+            entry->bars[i].size = 0;
+            entry->bars[i].isIo = false;
+            entry->bars[i].prefetchable = false;
+        }
+        if(headerType == 0)
+            ReadBars(entry, 6);
+        else if(headerType == 1)
+            ReadBars(entry, 2);
+    }
+
+    // Follow PCI-to-PCI bridges (class 06, subclass 04) to the bus behind them.
+    if((classes >> 16) == 0x0604 && headerType == 1)
+    {
+        uint8_t secondary = Read(bus, device, function, SecondaryBusRegister) >> 8;
+        if(secondary > bus)
+            ScanBus(secondary);
+        // Bus numbers below a bridge are always higher, which also rules out loops.
+    }
+}
+
+void PciController::ReadBars(PciDevice* entry, uint32_t count)
+{
+    uint8_t bus = entry->bus, device = entry->device, function = entry->function;
+
+    // Writing all ones briefly moves the BAR to the top of the address space, so
+    // decoding is off while the BARs are probed.
+    uint32_t command = Read(bus, device, function, CommandRegister);
+    Write(bus, device, function, CommandRegister, command & ~(uint32_t)(CommandIoSpace | CommandMemorySpace));
+
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        uint8_t offset = BarRegister + i * 4;
+        uint32_t original = Read(bus, device, function, offset);
+        Write(bus, device, function, offset, 0xFFFFFFFF);
+        uint32_t mask = Read(bus, device, function, offset);
+        Write(bus, device, function, offset, original);
+
+        if(mask == 0)
+            continue;
+        // Not implemented.
+
+        PciBar* bar = &entry->bars[i];
+        if(original & 0x1)
+        {
+            bar->isIo = true;
+            bar->address = original & ~0x3u;
+            bar->size = (~(mask & ~0x3u) + 1) & 0xFFFF;
+            continue;
+        }
+
+        bar->prefetchable = original & 0x8;
+        bar->address = original & ~0xFu;
+        bar->size = ~(mask & ~0xFu) + 1;
+
+        if(((original >> 1) & 0x3) == 0x2)
+        {
+            // 64-bit BAR: the next register holds the upper half. Without PAE a
+            // region above 4 GiB is unreachable, so it is left out.
+            if(i + 1 < count && Read(bus, device, function, offset + 4) != 0)
+            {
+                bar->address = 0;
+                bar->size = 0;
+            }
+            ++i;
+        }
+    }
+
+    Write(bus, device, function, CommandRegister, command);
+}
+
+void PciController::Bind(PciDevice* device)
+{
+    if(device->driver != 0)
+        return;
+    for(uint32_t i = 0; i < driverCount; ++i)
+    {
+        if(drivers[i]->Matches(device) && drivers[i]->Probe(device))
+        {
+            device->driver = drivers[i];
+            return;
+        }
+    }
+}
+
+bool PciController::RegisterDriver(PciDriver* driver)
+{
+    WriteLockGuard guard(&tableLock);
+    if(driverCount == MaxDrivers)
+        return false;
+    drivers[driverCount++] = driver;
+
+    if(enumerated)
+    {
+        for(uint32_t i = 0; i < deviceCount; ++i)
+        {
+            if(devices[i].driver == 0 && driver->Matches(&devices[i]) && driver->Probe(&devices[i]))
+                devices[i].driver = driver;
+        }
+    }
+    return true;
+}
+
+void PciController::EnableBusMastering(const PciDevice* device)
+{
+    uint16_t command = Read16(device, CommandRegister);
+    Write16(device, CommandRegister, command | CommandIoSpace | CommandMemorySpace | CommandBusMaster);
+}
+
+uint32_t PciController::DeviceCount()
+{
+    ReadLockGuard guard(&tableLock);
+    return deviceCount;
+}
+
+bool PciController::Device(uint32_t index, PciDevice* result)
+{
+    ReadLockGuard guard(&tableLock);
+    if(index >= deviceCount)
+        return false;
+    *result = devices[index];
+    return true;
+}
+
+uint32_t PciController::FindClass(uint8_t classCode, uint8_t subclass, PciDevice* result, uint32_t start)
+{
+    ReadLockGuard guard(&tableLock);
+    for(uint32_t i = start; i < deviceCount; ++i)
+    {
+        if(devices[i].classCode == classCode && devices[i].subclass == subclass)
+        {
+            *result = devices[i];
+            return i;
+        }
+    }
+    return NotFound;
+}
+
+bool PciController::FindDevice(uint16_t vendorId, uint16_t deviceId, PciDevice* result)
+{
+    ReadLockGuard guard(&tableLock);
+    for(uint32_t i = 0; i < deviceCount; ++i)
+    {
+        if(devices[i].vendorId == vendorId && devices[i].deviceId == deviceId)
+        {
+            *result = devices[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void PciController::Dump()
+{
+    ReadLockGuard guard(&tableLock);
+    for(uint32_t i = 0; i < deviceCount; ++i)
+    {
+        PciDevice* d = &devices[i];
+        kprintf("PCI %02x:%02x.%x %04x:%04x class %02x:%02x:%02x",
+                d->bus, d->device, d->function, d->vendorId, d->deviceId,
+                d->classCode, d->subclass, d->progIf);
+        if(d->interruptPin != 0)
+            kprintf(" irq %u", d->interruptLine);
+        for(uint32_t b = 0; b < 6; ++b)
+        {
+            if(d->bars[b].size != 0)
+                kprintf(" %s%x+%x", d->bars[b].isIo ? "io:" : "", d->bars[b].address, d->bars[b].size);
+        }
+        kprintf(d->driver != 0 ? " (bound)\n" : "\n");
+    }
+}
@@ -0,0 +1,185 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "types.h"
+#include "staticport.h"
+#include "spinlock.h"
+
+struct PciBar
+// One decoded base address register.
+{
+    uint32_t address;
+    // Base address with the flag bits stripped (0 if the BAR is unused).
+
+    uint32_t size;
+    // Size of the region in bytes, found by the usual write-all-ones probe.
+
+    bool isIo;
+    // I/O port range rather than memory.
+
+    bool prefetchable;
+    // Memory BAR without read side effects (may be mapped write-combining).
+};
+
+class PciDriver;
+
+struct PciDevice
+// Cached copy of the parts of a function's configuration header the kernel uses,
+// read once at enumeration so drivers don't go back to configuration space.
+{
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+    uint8_t headerType;         // Without the multi-function bit.
+
+    uint16_t vendorId;
+    uint16_t deviceId;
+
+    uint8_t classCode;
+    uint8_t subclass;
+    uint8_t progIf;
+    uint8_t revision;
+
+    uint8_t interruptLine;      // Legacy PIC IRQ assigned by the firmware (0xFF: none).
+    uint8_t interruptPin;       // INTA#..INTD# as 1..4, 0 if the function doesn't interrupt.
+
+    PciBar bars[6];
+    // Only header type 0 has six BARs; bridges use the first two.
+
+    PciDriver* driver;
+    // Driver bound to the function, 0 if none.
+};
+
+class PciDriver
+// A driver that can be bound to PCI functions. Matching is by vendor/device ID
+// and/or class/subclass; fields set to `PciAny` are not compared. When a match is
+// found `Probe` is called and the driver claims the function by returning true.
+{
+public:
+    static const uint16_t PciAny = 0xFFFF;
+
+    uint16_t vendorId;
+    uint16_t deviceId;
+    uint16_t classCode;
+    uint16_t subclass;
+
+    PciDriver(uint16_t vendorId, uint16_t deviceId, uint16_t classCode = PciAny, uint16_t subclass = PciAny);
+    virtual ~PciDriver();
+
+    bool Matches(const PciDevice* device);
+    // Compares the IDs and class codes of `device` with this driver's.
+
+    virtual bool Probe(PciDevice* device);
+    // Brings up the device; returns false to leave it unbound.
+};
+
+class PciController
+// Configuration space access through mechanism #1 (address at 0xCF8, data at 0xCFC)
+// and a one-time enumeration of every function into a fixed table. Only buses that
+// are actually reached through host and PCI-to-PCI bridges are scanned, instead of
+// probing all 256 x 32 x 8 addresses.
+{
+    typedef StaticPort<0xCF8, uint32_t> ConfigAddressPort;
+    // Selects bus/device/function/register; bit 31 enables the configuration cycle.
+
+    typedef StaticPort<0xCFC, uint32_t> ConfigDataPort;
+    // The selected dword.
+
+public:
+    static const uint32_t MaxDevices = 64;
+    static const uint32_t MaxDrivers = 16;
+    static const uint32_t NotFound = 0xFFFFFFFF;
+
+private:
+    PciDevice devices[MaxDevices];
+    uint32_t deviceCount;
+
+    PciDriver* drivers[MaxDrivers];
+    uint32_t driverCount;
+
+    bool enumerated;
+
+    SpinLock configLock;
+    // The address/data port pair must not be interleaved with another configuration
+    // access, from an interrupt handler or another CPU.
+
+    ReadWriteLock tableLock;
+    // The device and driver tables: looked up from any CPU, changed only by
+    // `Enumerate` and `RegisterDriver`. Not for interrupt handlers.
+
+    void ScanBus(uint8_t bus);
+    // Scans all 32 device slots of a bus.
+
+    void ScanDevice(uint8_t bus, uint8_t device);
+    // Adds function 0 and, for multi-function devices, functions 1-7.
+
+    void ScanFunction(uint8_t bus, uint8_t device, uint8_t function);
+    // Records one function and descends into the secondary bus of a PCI-to-PCI bridge.
+
+    void ReadBars(PciDevice* entry, uint32_t count);
+    // Fills `entry->bars`, sizing each BAR with decoding switched off.
+
+    void Bind(PciDevice* device);
+    // Offers an unbound device to each registered driver until one claims it.
+
+public:
+    static PciController* ActivePciController;
+
+    // Configuration header offsets.
+    static const uint8_t VendorIdRegister = 0x00;
+    static const uint8_t CommandRegister = 0x04;
+    static const uint8_t ClassRegister = 0x08;           // Revision, prog IF, subclass, class.
+    static const uint8_t HeaderTypeRegister = 0x0E;
+    static const uint8_t BarRegister = 0x10;
+    static const uint8_t SecondaryBusRegister = 0x19;    // PCI-to-PCI bridges.
+    static const uint8_t InterruptLineRegister = 0x3C;
+
+    // Command register bits.
+    static const uint16_t CommandIoSpace = 0x0001;
+    static const uint16_t CommandMemorySpace = 0x0002;
+    static const uint16_t CommandBusMaster = 0x0004;
+
+    PciController();
+    ~PciController();
+
+    uint32_t Read(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+    // Reads the configuration dword containing `offset`.
+
+    void Write(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
+    // Writes the configuration dword containing `offset`.
+
+    uint16_t Read16(const PciDevice* device, uint8_t offset);
+    uint8_t Read8(const PciDevice* device, uint8_t offset);
+    void Write16(const PciDevice* device, uint8_t offset, uint16_t value);
+    // Narrow accesses within a dword (read-modify-write for Write16).
+
+    void Enumerate();
+    // Walks the bus hierarchy from bus 0, fills the device table and binds drivers.
+
+    bool RegisterDriver(PciDriver* driver);
+    // Adds a driver to the registry. After `Enumerate` it is offered the unbound
+    // devices right away. Returns false if the registry is full. `Probe` runs with
+    // the tables write-locked, so it must not look up other devices.
+
+    void EnableBusMastering(const PciDevice* device);
+    // Turns on memory and I/O decoding and bus mastering (needed for DMA).
+
+    // The lookups copy the entry into `result` under the read lock: `Enumerate`
+    // may rewrite the table at any time, so a pointer into it would be unsafe.
+
+    uint32_t DeviceCount();
+    bool Device(uint32_t index, PciDevice* result);
+    // False if `index` is out of range.
+
+    uint32_t FindClass(uint8_t classCode, uint8_t subclass, PciDevice* result, uint32_t start = 0);
+    // Index of the first device of the given class at or after `start`, NotFound
+    // if none. Pass the index plus one to find the next.
+
+    bool FindDevice(uint16_t vendorId, uint16_t deviceId, PciDevice* result);
+    // First device with the given IDs; false if none.
+
+    void Dump();
+    // Lists the devices with kprintf.
+};
+
+#endif
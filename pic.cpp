@@ -0,0 +1,165 @@
+#include "pic.h"
+
+InterruptController::InterruptController()
+{
+}
+
+InterruptController::~InterruptController()
+{
+}
+
+void InterruptController::Mask(uint8_t irq)
+{
+}
+
+void InterruptController::Unmask(uint8_t irq)
+{
+}
+
+bool InterruptController::IsSpurious(uint8_t irq)
+{
+    return false;
+}
+
+void InterruptController::EndOfInterrupt(uint8_t irq)
+{
+}
+
+ProgrammableInterruptController::ProgrammableInterruptController(uint8_t vectorOffset, bool autoEoi)
+{
+    this->vectorOffset = vectorOffset;
+    this->autoEoi = autoEoi;
+    mask = 0xFFFF;
+    spuriousMaster = 0;
+    spuriousSlave = 0;
+    Initialize();
+}
+
+ProgrammableInterruptController::~ProgrammableInterruptController()
+{
+}
+
+void ProgrammableInterruptController::Initialize()
+{
+    // The initialisation sequence goes through the slow variants, old 8259s need time between writes.
+    SlowPort<MasterCommand>::Write(0x11);               // ICW1: edge triggered, cascade, ICW4 follows.
+    SlowPort<SlaveCommand>::Write(0x11);
+    SlowPort<MasterData>::Write(vectorOffset);          // ICW2: vector base.
+    SlowPort<SlaveData>::Write(vectorOffset + 8);
+    SlowPort<MasterData>::Write(1 << CascadeLine);      // ICW3: the slave hangs off IRQ2...
+    SlowPort<SlaveData>::Write(CascadeLine);            // ...and knows its cascade identity.
+    uint8_t icw4 = autoEoi ? 0x03 : 0x01;               // ICW4: 8086 mode, optionally auto-EOI.
+    SlowPort<MasterData>::Write(icw4);
+    SlowPort<SlaveData>::Write(icw4);
+
+    MasterData::Write(mask & 0xFF);
+    SlaveData::Write(mask >> 8);
+}
+
+void ProgrammableInterruptController::WriteMask(uint16_t newMask)
+{
+    if((newMask & 0xFF00) != 0xFF00)
+        newMask &= ~(1 << CascadeLine);
+    else
+        newMask |= 1 << CascadeLine;
+    // The cascade line is open exactly when some slave line is.
+
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+    uint16_t changed = newMask ^ mask;
+    mask = newMask;
+    if(changed & 0x00FF)
+        MasterData::Write(mask & 0xFF);
+    if(changed & 0xFF00)
+        SlaveData::Write(mask >> 8);
+    __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+}
+
+void ProgrammableInterruptController::Mask(uint8_t irq)
+{
+    if(irq < Lines && irq != CascadeLine)
+        WriteMask(mask | (1 << irq));
+}
+
+void ProgrammableInterruptController::Unmask(uint8_t irq)
+{
+    if(irq < Lines && irq != CascadeLine)
+        WriteMask(mask & ~(1 << irq));
+}
+
+bool ProgrammableInterruptController::IsMasked(uint8_t irq)
+{
+    return irq >= Lines || (mask & (1 << irq));
+}
+
+uint16_t ProgrammableInterruptController::MaskBits()
+{
+    return mask;
+}
+
+void ProgrammableInterruptController::MaskAll()
+{
+    WriteMask(0xFFFF);
+}
+
+bool ProgrammableInterruptController::IsSpurious(uint8_t irq)
+{
+    if(autoEoi)
+        return false;
+
+    if(irq == 7)
+    {
+        MasterCommand::Write(0x0B);                     // OCW3: next read returns the ISR.
+        bool inService = MasterCommand::Read() & 0x80;
+        if(inService)
+            return false;
+        spuriousMaster++;
+        return true;
+    }
+
+    if(irq == 15)
+    {
+        SlaveCommand::Write(0x0B);
+        bool inService = SlaveCommand::Read() & 0x80;
+        if(inService)
+            return false;
+        spuriousSlave++;
+        MasterCommand::Write(0x20);
+        // The master did see a real request on the cascade line.
+        return true;
+    }
+
+    return false;
+}
+
+void ProgrammableInterruptController::EndOfInterrupt(uint8_t irq)
+{
+    if(autoEoi)
+        return;
+    if(irq >= 8)
+        SlaveCommand::Write(0x20);
+    MasterCommand::Write(0x20);
+}
+
+void ProgrammableInterruptController::SetAutoEoi(bool enabled)
+{
+    if(enabled == autoEoi)
+        return;
+    autoEoi = enabled;
+    Initialize();
+}
+
+bool ProgrammableInterruptController::AutoEoi()
+{
+    return autoEoi;
+}
+
+uint32_t ProgrammableInterruptController::SpuriousMaster()
+{
+    return spuriousMaster;
+}
+
+uint32_t ProgrammableInterruptController::SpuriousSlave()
+{
+    return spuriousSlave;
+}
@@ -0,0 +1,82 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include "types.h"
+#include "staticport.h"
+#include "interruptcontroller.h"
+
+class ProgrammableInterruptController : public InterruptController
+// The two cascaded 8259A PICs (master IRQ0-7, slave IRQ8-15 on the master's IRQ2).
+// Every line starts out masked; `InterruptHandler` unmasks a line when a handler
+// is registered for it and masks it again when the handler goes away, so lines
+// nobody claimed can't interrupt. The interrupt mask is shadowed in memory so
+// changing one line is a single write without reading the IMR back.
+// IRQ7 and IRQ15 are also what the PIC reports when a request disappears before
+// it is acknowledged; `IsSpurious` tells those apart by reading the in-service
+// register. In auto-EOI mode the PIC ends each interrupt itself at acknowledge
+// time, which saves the EOI write per interrupt but gives up spurious detection
+// (the in-service bit is already clear when the handler runs).
+{
+    // Compile-time ports, so masking and the EOI are a single `outb` each.
+    typedef StaticPort<0x20> MasterCommand;
+    typedef StaticPort<0x21> MasterData;
+    typedef StaticPort<0xA0> SlaveCommand;
+    typedef StaticPort<0xA1> SlaveData;
+
+    static const uint8_t CascadeLine = 2;
+
+    uint8_t vectorOffset;
+    // Vector of IRQ0; IRQ n arrives as vectorOffset + n.
+
+    uint16_t mask;
+    // Shadow of both IMRs, bit n set = IRQ n masked.
+
+    bool autoEoi;
+
+    uint32_t spuriousMaster;
+    uint32_t spuriousSlave;
+
+    void Initialize();
+    // Runs the ICW1-ICW4 sequence with the current offset and EOI mode, then restores the mask.
+
+    void WriteMask(uint16_t newMask);
+    // Updates the IMRs, writing only the chips whose byte changed.
+
+public:
+    static const uint8_t Lines = 16;
+
+    ProgrammableInterruptController(uint8_t vectorOffset, bool autoEoi = false);
+    // Remaps IRQ0-15 to vectorOffset..vectorOffset+15 with every line masked.
+
+    ~ProgrammableInterruptController();
+
+    virtual void Mask(uint8_t irq);
+    virtual void Unmask(uint8_t irq);
+    // Unmasking a slave line also opens the cascade line on the master.
+
+    bool IsMasked(uint8_t irq);
+    uint16_t MaskBits();
+
+    void MaskAll();
+    // Silences the PICs completely (e.g. when the APIC takes over).
+
+    virtual bool IsSpurious(uint8_t irq);
+    // For IRQ7/IRQ15: true if the line isn't actually in service, in which case the
+    // interrupt must be ignored and not acknowledged (a spurious IRQ15 still needs
+    // an EOI on the master, which this sends). Always false for other lines and in
+    // auto-EOI mode.
+
+    virtual void EndOfInterrupt(uint8_t irq);
+    // Non-specific EOI to the slave (for IRQ8-15) and the master; nothing in auto-EOI mode.
+
+    void SetAutoEoi(bool enabled);
+    // Reprograms both chips with or without auto-EOI (interrupts must be off).
+
+    bool AutoEoi();
+
+    uint32_t SpuriousMaster();
+    uint32_t SpuriousSlave();
+    // Spurious IRQ7 and IRQ15 counts.
+};
+
+#endif
@@ -0,0 +1,283 @@
+#include "pmm.h"
+#include "paging.h"
+
+extern "C" uint8_t kernel_start;
+extern "C" uint8_t kernel_end;
+// Defined by linker.ld around the loaded image (including .bss and the boot stack).
+
+uint32_t PhysicalMemoryManager::level0[MaxFrames / 32];
+uint32_t PhysicalMemoryManager::level1[MaxFrames / 32 / 32];
+uint32_t PhysicalMemoryManager::level2[MaxFrames / 32 / 32 / 32];
+uint32_t PhysicalMemoryManager::level3 = 0;
+
+PhysicalMemoryManager* PhysicalMemoryManager::ActivePhysicalMemoryManager = 0;
+
+static inline uint32_t LowestSetBit(uint32_t value)
+{
+    uint32_t index;
+    __asm__("bsfl %1, %0" : "=r" (index) : "rm" (value));
+    return index;
+}
+
+PhysicalMemoryManager::PhysicalMemoryManager(const multiboot_info* info)
+: lock("pmm")
+{
+    totalFrames = 0;
+    freeFrames = 0;
+    endFrame = 0;
+    // Everything starts out used (the bitmaps are zeroed .bss); only RAM the
+    // boot loader reports as available is released.
+
+    if(info != 0 && (info->flags & MULTIBOOT_INFO_MEM_MAP))
+    {
+        uint32_t address = info->mmap_addr;
+        uint32_t end = info->mmap_addr + info->mmap_length;
+        while(address < end)
+        {
+            const multiboot_mmap_entry* entry = (const multiboot_mmap_entry*)address;
+            if(entry->type == MULTIBOOT_MEMORY_AVAILABLE)
+                ReleaseRange(entry->base_addr, entry->length);
+            address += entry->size + sizeof(entry->size);
+        }
+    }
+    else if(info != 0 && (info->flags & MULTIBOOT_INFO_MEMORY))
+    {
+        ReleaseRange(0, (uint64_t)info->mem_lower * 1024);
+        ReleaseRange(0x100000, (uint64_t)info->mem_upper * 1024);
+    }
+    totalFrames = freeFrames;
+
+    // The first MiB holds the IVT, BIOS data, EBDA, VGA memory and ROMs.
+    ReserveRange(0, 0x100000);
+
+    uint32_t kernelStart = (uint32_t)&kernel_start;
+    ReserveRange(kernelStart, (uint32_t)&kernel_end - kernelStart);
+
+    if(info != 0)
+    {
+        ReserveRange((uint32_t)info, sizeof(multiboot_info));
+        if(info->flags & MULTIBOOT_INFO_MEM_MAP)
+            ReserveRange(info->mmap_addr, info->mmap_length);
+    }
+
+    ActivePhysicalMemoryManager = this;
+}
+
+PhysicalMemoryManager::~PhysicalMemoryManager()
+{
+    if(ActivePhysicalMemoryManager == this)
+        ActivePhysicalMemoryManager = 0;
+}
+
+void PhysicalMemoryManager::MarkFree(uint32_t frame)
+{
+    uint32_t i0 = frame / 32;
+    bool wasEmpty = level0[i0] == 0;
+    level0[i0] |= 1u << (frame % 32);
+    if(!wasEmpty)
+        return;
+
+    uint32_t i1 = i0 / 32;
+    wasEmpty = level1[i1] == 0;
+    level1[i1] |= 1u << (i0 % 32);
+    if(!wasEmpty)
+        return;
+
+    uint32_t i2 = i1 / 32;
+    level2[i2] |= 1u << (i1 % 32);
+    level3 |= 1u << i2;
+}
+
+void PhysicalMemoryManager::MarkUsed(uint32_t frame)
+{
+    uint32_t i0 = frame / 32;
+    level0[i0] &= ~(1u << (frame % 32));
+    if(level0[i0] != 0)
+        return;
+
+    uint32_t i1 = i0 / 32;
+    level1[i1] &= ~(1u << (i0 % 32));
+    if(level1[i1] != 0)
+        return;
+
+    uint32_t i2 = i1 / 32;
+    level2[i2] &= ~(1u << (i1 % 32));
+    if(level2[i2] != 0)
+        return;
+
+    level3 &= ~(1u << i2);
+}
+
+bool PhysicalMemoryManager::IsFree(uint32_t frame)
+{
+    return level0[frame / 32] & (1u << (frame % 32));
+}
+
+void PhysicalMemoryManager::ReleaseRange(uint64_t base, uint64_t length)
+{
+    uint64_t end = base + length;
+    if(end > (uint64_t)MaxFrames * FrameSize)
+        end = (uint64_t)MaxFrames * FrameSize;
+    // Memory above 4 GiB can't be addressed without PAE.
+
+    uint64_t first = (base + FrameSize - 1) / FrameSize;
+    uint64_t last = end / FrameSize;
+    // Division by a power of two is a shift, so this doesn't need __udivdi3.
+
+    if(first < last && last > endFrame)
+        endFrame = (uint32_t)last;
+
+    for(uint32_t frame = (uint32_t)first; frame < last; ++frame)
+    {
+        if(!IsFree(frame))
+        {
+            MarkFree(frame);
+            freeFrames++;
+        }
+    }
+}
+
+void PhysicalMemoryManager::ReserveRange(uint32_t base, uint32_t length)
+{
+    if(length == 0)
+        return;
+    uint32_t first = base / FrameSize;
+    uint32_t last = (uint32_t)(((uint64_t)base + length + FrameSize - 1) / FrameSize);
+    for(uint32_t frame = first; frame < last && frame < MaxFrames; ++frame)
+    {
+        if(IsFree(frame))
+        {
+            MarkUsed(frame);
+            freeFrames--;
+        }
+    }
+}
+
+uint32_t PhysicalMemoryManager::AllocateFrame()
+{
+    IrqSpinLockGuard guard(&lock);
+    if(level3 == 0)
+        return 0;
+
+    uint32_t i2 = LowestSetBit(level3);
+    uint32_t i1 = i2 * 32 + LowestSetBit(level2[i2]);
+    uint32_t i0 = i1 * 32 + LowestSetBit(level1[i1]);
+    uint32_t frame = i0 * 32 + LowestSetBit(level0[i0]);
+
+    MarkUsed(frame);
+    freeFrames--;
+    return frame * FrameSize;
+}
+
+void PhysicalMemoryManager::FreeFrame(uint32_t address)
+{
+    uint32_t frame = address / FrameSize;
+    if(PageManager::ActivePageManager != 0)
+        PageManager::ActivePageManager->ReleasePage(address);
+    // Before the frame is free: once it is, another CPU may allocate and map it.
+
+    IrqSpinLockGuard guard(&lock);
+    if(address != 0 && !IsFree(frame))
+    {
+        MarkFree(frame);
+        freeFrames++;
+    }
+}
+
+uint32_t PhysicalMemoryManager::AllocateFrames(uint32_t count, uint32_t alignFrames)
+{
+    if(count == 0)
+        return 0;
+    if(count == 1 && alignFrames <= 1)
+        return AllocateFrame();
+    if(alignFrames == 0)
+        alignFrames = 1;
+
+    IrqSpinLockGuard guard(&lock);
+
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+    uint32_t frame = 0;
+    while(frame < MaxFrames)
+    {
+        uint32_t i0 = frame / 32;
+        if(frame % 32 == 0 && level0[i0] == 0)
+        {
+            // A whole 32-frame group is used; also skip 1024 frames at once
+            // when the level 1 word says none of them is free.
+            runLength = 0;
+            if(i0 % 32 == 0 && level1[i0 / 32] == 0)
+                frame += 32 * 32;
+            else
+                frame += 32;
+            continue;
+        }
+
+        if(IsFree(frame))
+        {
+            if(runLength == 0)
+            {
+                if(frame % alignFrames != 0)
+                {
+                    frame++;
+                    continue;
+                }
+                runStart = frame;
+            }
+            if(++runLength == count)
+            {
+                for(uint32_t f = runStart; f < runStart + count; ++f)
+                    MarkUsed(f);
+                freeFrames -= count;
+                return runStart * FrameSize;
+            }
+        }
+        else
+            runLength = 0;
+        frame++;
+    }
+    return 0;
+}
+
+void PhysicalMemoryManager::FreeFrames(uint32_t address, uint32_t count)
+{
+    uint32_t first = address / FrameSize;
+    if(PageManager::ActivePageManager != 0)
+    {
+        for(uint32_t i = 0; i < count; ++i)
+            PageManager::ActivePageManager->ReleasePage(address + i * FrameSize);
+    }
+
+    IrqSpinLockGuard guard(&lock);
+    for(uint32_t frame = first; frame < first + count && frame < MaxFrames; ++frame)
+    {
+        if(frame != 0 && !IsFree(frame))
+        {
+            MarkFree(frame);
+            freeFrames++;
+        }
+    }
+}
+
+bool PhysicalMemoryManager::InUse(uint32_t address)
+{
+    uint32_t frame = address / FrameSize;
+    return frame < MaxFrames && !IsFree(frame);
+    // One bit, read without the lock: a frame being allocated or freed concurrently
+    // is the caller's race either way.
+}
+
+uint32_t PhysicalMemoryManager::TotalFrames()
+{
+    return totalFrames;
+}
+
+uint32_t PhysicalMemoryManager::FreeFrameCount()
+{
+    return freeFrames;
+}
+
+uint32_t PhysicalMemoryManager::EndFrame()
+{
+    return endFrame;
+}
@@ -0,0 +1,85 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "types.h"
+#include "multiboot.h"
+#include "spinlock.h"
+
+class PhysicalMemoryManager
+// Allocator for 4 KiB physical page frames.
+// Free frames are tracked in a bitmap (bit set = frame free) with three summary
+// levels on top of it: a bit in level n+1 is set when the corresponding 32-bit word
+// of level n has any free frame. Finding a free frame is therefore four `bsf`
+// instructions, and allocating or freeing touches at most one word per level.
+{
+public:
+    static const uint32_t FrameSize = 4096;
+    static const uint32_t MaxFrames = 1024 * 1024;
+    // 4 GiB of 4 KiB frames, the whole 32-bit physical address space.
+
+private:
+    static uint32_t level0[MaxFrames / 32];
+    static uint32_t level1[MaxFrames / 32 / 32];
+    static uint32_t level2[MaxFrames / 32 / 32 / 32];
+    static uint32_t level3;
+    // The bitmap and its summaries. They are static so they live in .bss (132 KiB).
+
+    uint32_t totalFrames;
+    // Frames of usable RAM reported by the boot loader.
+
+    uint32_t freeFrames;
+    // Frames currently available.
+
+    uint32_t endFrame;
+    // One past the highest frame of usable RAM.
+
+    SpinLock lock;
+    // Guards the bitmap. Held with interrupts off: handlers allocate too.
+
+    void MarkFree(uint32_t frame);
+    void MarkUsed(uint32_t frame);
+    // Flip one frame's bit and keep the summary levels consistent.
+
+    bool IsFree(uint32_t frame);
+
+    void ReleaseRange(uint64_t base, uint64_t length);
+    // Marks every whole frame inside [base, base + length) free.
+
+    void ReserveRange(uint32_t base, uint32_t length);
+    // Marks every frame touching [base, base + length) used.
+
+public:
+    static PhysicalMemoryManager* ActivePhysicalMemoryManager;
+    // The allocator used by the rest of the kernel, set by the constructor.
+
+    PhysicalMemoryManager(const multiboot_info* info);
+    // Builds the free map from the Multiboot memory map (or mem_upper when there is
+    // none), then reserves the first MiB, the kernel image and the boot information.
+
+    ~PhysicalMemoryManager();
+
+    uint32_t AllocateFrame();
+    // Returns the physical address of a free frame, or 0 when memory is exhausted.
+
+    void FreeFrame(uint32_t address);
+    // Returns a frame obtained from `AllocateFrame`.
+
+    uint32_t AllocateFrames(uint32_t count, uint32_t alignFrames = 1);
+    // Returns the address of `count` physically contiguous frames whose first frame
+    // number is a multiple of `alignFrames`, or 0. This scans the bitmap, skipping
+    // full 32-frame groups via the summary level.
+
+    void FreeFrames(uint32_t address, uint32_t count);
+    // Returns a range obtained from `AllocateFrames`.
+
+    bool InUse(uint32_t address);
+    // Whether the frame holding `address` is allocated or reserved.
+
+    uint32_t TotalFrames();
+    uint32_t FreeFrameCount();
+
+    uint32_t EndFrame();
+    // One past the highest usable frame number; RAM is below EndFrame() * FrameSize.
+};
+
+#endif
@@ -12,10 +12,17 @@ Port8BitSlow Class:
     Inherits from Port8Bit and introduces a slower variant of writing to an 8-bit port.
     Uses Write8Slow for the write operation, which presumably adds delay or ensures compatibility with slower hardware.
 
+Port16Bit / Port32Bit Classes:
+    Inherit from IOPort and provide 16-bit and 32-bit reads and writes, needed for
+    ATA data registers, PCI configuration space and similar devices.
+    ReadString/WriteString move a whole buffer with one `rep ins`/`rep outs` instruction
+    instead of one call per word.
+
 Inheritance Hierarchy:
     IOPort is the base class, handling basic port number initialization.
     Port8Bit extends IOPort to add read/write methods for 8-bit ports.
     Port8BitSlow further extends Port8Bit for slower write operations.
+    Port16Bit and Port32Bit extend IOPort for wider accesses.
 */
 
 
@@ -60,3 +67,59 @@ void Port8BitSlow::Write(unsigned char data)
     // Writes an 8-bit value (`data`) to the port with additional delay or slow processing.
     // The `Write8Slow` function (likely implemented elsewhere) manages the actual write operation with the slowdown.
 }
+
+Port16Bit::Port16Bit(unsigned short int portnumber): IOPort(portnumber) {}
+
+Port16Bit::~Port16Bit() {}
+
+void Port16Bit::Write(unsigned short int data)
+{
+    Write16(portnumber, data);
+    // Writes a 16-bit value (`data`) to the specified port number.
+}
+
+unsigned short int Port16Bit::Read()
+{
+    return Read16(portnumber);
+    // Reads a 16-bit value from the specified port number.
+}
+
+void Port16Bit::ReadString(void* buffer, unsigned int count)
+{
+    ReadString16(portnumber, buffer, count);
+    // Transfers `count` words into `buffer` with one `rep insw`.
+}
+
+void Port16Bit::WriteString(const void* buffer, unsigned int count)
+{
+    WriteString16(portnumber, buffer, count);
+    // Transfers `count` words from `buffer` with one `rep outsw`.
+}
+
+Port32Bit::Port32Bit(unsigned short int portnumber): IOPort(portnumber) {}
+
+Port32Bit::~Port32Bit() {}
+
+void Port32Bit::Write(unsigned int data)
+{
+    Write32(portnumber, data);
+    // Writes a 32-bit value (`data`) to the specified port number.
+}
+
+unsigned int Port32Bit::Read()
+{
+    return Read32(portnumber);
+    // Reads a 32-bit value from the specified port number.
+}
+
+void Port32Bit::ReadString(void* buffer, unsigned int count)
+{
+    ReadString32(portnumber, buffer, count);
+    // Transfers `count` double words into `buffer` with one `rep insl`.
+}
+
+void Port32Bit::WriteString(const void* buffer, unsigned int count)
+{
+    WriteString32(portnumber, buffer, count);
+    // Transfers `count` double words from `buffer` with one `rep outsl`.
+}
@@ -75,5 +75,100 @@ protected:
     }
 };
 
+class Port16Bit : public IOPort {
+public:
+    Port16Bit(unsigned short int portnumber);
+    // Constructor for the `Port16Bit` class, passes the port number to the base class `IOPort`.
+
+    ~Port16Bit();
+    // Destructor for the `Port16Bit` class.
+
+    virtual unsigned short int Read();
+    // Reads a 16-bit value from the I/O port.
+
+    virtual void Write(unsigned short int data);
+    // Writes a 16-bit value to the I/O port.
+
+    void ReadString(void* buffer, unsigned int count);
+    // Reads `count` 16-bit words from the port into `buffer` with a single `rep insw`
+    // (e.g. one 512-byte ATA sector is `ReadString(buffer, 256)`).
+
+    void WriteString(const void* buffer, unsigned int count);
+    // Writes `count` 16-bit words from `buffer` to the port with a single `rep outsw`.
+
+protected:
+    static inline unsigned short int Read16(unsigned short int _port) {
+        unsigned short int result;
+        __asm__ volatile("inw %1, %0" : "=a" (result) : "Nd" (_port));
+        // Same as `Read8`, but `inw` transfers a 16-bit word into `AX`.
+        return result;
+    }
+
+    static inline void Write16(unsigned short int _port, unsigned short int _data) {
+        __asm__ volatile("outw %0, %1" : : "a" (_data), "Nd" (_port));
+        // Same as `Write8`, but `outw` transfers the 16-bit word in `AX`.
+    }
+
+    static inline void ReadString16(unsigned short int _port, void* _buffer, unsigned int _count) {
+        __asm__ volatile("cld; rep insw" : "+D" (_buffer), "+c" (_count) : "d" (_port) : "memory");
+        // Block input of 16-bit words:
+        // - `rep insw` reads a word from the port in `DX` into `ES:EDI`, advances `EDI` by 2
+        //   and repeats until `ECX` reaches zero, all as one instruction.
+        // - `"+D" (_buffer)`, `"+c" (_count)`: `EDI` and `ECX` are modified by the instruction.
+        // - `"d" (_port)`: string I/O only accepts the port number in `DX`.
+        // - `"memory"`: the buffer is written behind the compiler's back.
+    }
+
+    static inline void WriteString16(unsigned short int _port, const void* _buffer, unsigned int _count) {
+        __asm__ volatile("cld; rep outsw" : "+S" (_buffer), "+c" (_count) : "d" (_port) : "memory");
+        // Block output of 16-bit words: `rep outsw` writes the word at `DS:ESI` to the port
+        // in `DX`, advances `ESI` by 2 and repeats `ECX` times.
+    }
+};
+
+class Port32Bit : public IOPort {
+public:
+    Port32Bit(unsigned short int portnumber);
+    // Constructor for the `Port32Bit` class, passes the port number to the base class `IOPort`.
+
+    ~Port32Bit();
+    // Destructor for the `Port32Bit` class.
+
+    virtual unsigned int Read();
+    // Reads a 32-bit value from the I/O port.
+
+    virtual void Write(unsigned int data);
+    // Writes a 32-bit value to the I/O port.
+
+    void ReadString(void* buffer, unsigned int count);
+    // Reads `count` 32-bit double words from the port into `buffer` with a single `rep insl`.
+
+    void WriteString(const void* buffer, unsigned int count);
+    // Writes `count` 32-bit double words from `buffer` to the port with a single `rep outsl`.
+
+protected:
+    static inline unsigned int Read32(unsigned short int _port) {
+        unsigned int result;
+        __asm__ volatile("inl %1, %0" : "=a" (result) : "Nd" (_port));
+        // Same as `Read8`, but `inl` transfers a 32-bit double word into `EAX`.
+        return result;
+    }
+
+    static inline void Write32(unsigned short int _port, unsigned int _data) {
+        __asm__ volatile("outl %0, %1" : : "a" (_data), "Nd" (_port));
+        // Same as `Write8`, but `outl` transfers the 32-bit double word in `EAX`.
+    }
+
+    static inline void ReadString32(unsigned short int _port, void* _buffer, unsigned int _count) {
+        __asm__ volatile("cld; rep insl" : "+D" (_buffer), "+c" (_count) : "d" (_port) : "memory");
+        // Block input of 32-bit double words, see `ReadString16`.
+    }
+
+    static inline void WriteString32(unsigned short int _port, const void* _buffer, unsigned int _count) {
+        __asm__ volatile("cld; rep outsl" : "+S" (_buffer), "+c" (_count) : "d" (_port) : "memory");
+        // Block output of 32-bit double words, see `WriteString16`.
+    }
+};
+
 #endif
 // End of the header guard.
@@ -0,0 +1,204 @@
+#include "profiler.h"
+#include "heap.h"
+#include "paging.h"
+#include "smp.h"
+
+extern "C" uint8_t kernel_start;
+extern "C" uint8_t kernel_end;
+
+Profiler* Profiler::ActiveProfiler = 0;
+
+Profiler::Profiler(uint32_t capacity, uint32_t interval, bool walkStack)
+{
+    SmpManager* smp = SmpManager::ActiveSmpManager;
+    bufferCount = smp != 0 ? smp->CpuCount() : 1;
+    this->capacity = capacity / bufferCount;
+    this->interval = interval == 0 ? 1 : interval;
+    this->walkStack = walkStack;
+    running = false;
+
+    buffers = new ProfileBuffer[bufferCount];
+    if(buffers == 0)
+        bufferCount = 0;
+    for(uint32_t i = 0; i < bufferCount; ++i)
+    {
+        buffers[i].samples = new Sample[this->capacity];
+        buffers[i].count = 0;
+        buffers[i].dropped = 0;
+        buffers[i].ticksLeft = this->interval;
+        if(buffers[i].samples == 0)
+            this->capacity = 0;
+        // Without memory for every buffer, every sample counts as dropped.
+
+        Cpu* cpu = smp != 0 ? smp->GetCpu(i) : 0;
+        if(cpu != 0)
+            cpu->profile = &buffers[i];
+    }
+    ActiveProfiler = this;
+}
+
+Profiler::~Profiler()
+{
+    running = false;
+    if(ActiveProfiler == this)
+        ActiveProfiler = 0;
+
+    SmpManager* smp = SmpManager::ActiveSmpManager;
+    for(uint32_t i = 0; i < bufferCount; ++i)
+    {
+        Cpu* cpu = smp != 0 ? smp->GetCpu(i) : 0;
+        if(cpu != 0 && cpu->profile == &buffers[i])
+            cpu->profile = 0;
+        delete[] buffers[i].samples;
+    }
+    delete[] buffers;
+}
+
+bool Profiler::Readable(uint32_t address)
+{
+    if(address >= (uint32_t)&kernel_start && address + 4 <= (uint32_t)&kernel_end)
+        return true;
+    // The image, including the boot stack in .bss, is always mapped.
+
+    if(PageManager::ActivePageManager == 0)
+        return false;
+    return PageManager::ActivePageManager->Translate(address) != 0
+        && PageManager::ActivePageManager->Translate(address + 3) != 0;
+    // Task stacks elsewhere are only followed if they are mapped already; the walk
+    // must not page fault inside the timer interrupt.
+}
+
+void Profiler::Record(CPUState* cpu)
+{
+    if(!running)
+        return;
+    Cpu* current = Cpu::Current();
+    ProfileBuffer* buffer = current != 0 ? current->profile : bufferCount != 0 ? &buffers[0] : 0;
+    if(buffer == 0 || --buffer->ticksLeft != 0)
+        return;
+    // A CPU that came up after the profiler has no buffer and isn't sampled.
+    buffer->ticksLeft = interval;
+
+    if(buffer->count >= capacity)
+    {
+        buffer->dropped++;
+        return;
+    }
+
+    Sample* sample = &buffer->samples[buffer->count];
+    sample->frames[0] = cpu->eip;
+    uint32_t depth = 1;
+
+    if(walkStack && (cpu->cs & 3) == 0)
+    {
+        // Each frame starts with the caller's ebp followed by the return address.
+        uint32_t ebp = cpu->ebp;
+        while(depth < MaxDepth && ebp != 0 && (ebp & 3) == 0 && Readable(ebp) && Readable(ebp + 4))
+        {
+            uint32_t* frame = (uint32_t*)ebp;
+            uint32_t returnAddress = frame[1];
+            if(returnAddress == 0)
+                break;
+            sample->frames[depth++] = returnAddress;
+
+            uint32_t next = frame[0];
+            if(next <= ebp || next - ebp > 0x10000)
+                break;
+            // Stacks grow down, so callers' frames are above; anything else is garbage.
+            ebp = next;
+        }
+    }
+
+    sample->depth = depth;
+    buffer->count++;
+}
+
+void Profiler::Start()
+{
+    for(uint32_t i = 0; i < bufferCount; ++i)
+        buffers[i].ticksLeft = interval;
+    running = true;
+}
+
+void Profiler::Stop()
+{
+    running = false;
+}
+
+bool Profiler::Running()
+{
+    return running;
+}
+
+void Profiler::Reset()
+{
+    bool wasRunning = running;
+    running = false;
+    for(uint32_t i = 0; i < bufferCount; ++i)
+    {
+        buffers[i].count = 0;
+        buffers[i].dropped = 0;
+    }
+    running = wasRunning;
+}
+
+void Profiler::SetInterval(uint32_t ticks)
+{
+    interval = ticks == 0 ? 1 : ticks;
+    for(uint32_t i = 0; i < bufferCount; ++i)
+        buffers[i].ticksLeft = interval;
+}
+
+void Profiler::SetStackWalk(bool enabled)
+{
+    walkStack = enabled;
+}
+
+uint32_t Profiler::SampleCount()
+{
+    uint32_t total = 0;
+    for(uint32_t i = 0; i < bufferCount; ++i)
+        total += buffers[i].count;
+    return total;
+}
+
+uint32_t Profiler::Dropped()
+{
+    uint32_t total = 0;
+    for(uint32_t i = 0; i < bufferCount; ++i)
+        total += buffers[i].dropped;
+    return total;
+}
+
+void Profiler::Dump(SerialDriver* serial)
+{
+    bool wasRunning = running;
+    running = false;
+
+    char line[16 + MaxDepth * 9];
+    int length = ksnprintf(line, sizeof(line), "\nPROFILE BEGIN %u %u\n", SampleCount(), Dropped());
+    serial->Write(line, length);
+
+    uint32_t written = 0;
+    for(uint32_t c = 0; c < bufferCount; ++c)
+    {
+        ProfileBuffer* buffer = &buffers[c];
+        for(uint32_t i = 0; i < buffer->count; ++i)
+        {
+            if(written++ % 16 == 0)
+                serial->Drain();
+            // The whole dump is far larger than the transmit ring.
+
+            Sample* sample = &buffer->samples[i];
+            length = ksnprintf(line, sizeof(line), "S %u", c);
+            for(uint32_t d = 0; d < sample->depth; ++d)
+                length += ksnprintf(line + length, sizeof(line) - length, " %08x", sample->frames[d]);
+            length += ksnprintf(line + length, sizeof(line) - length, "\n");
+            serial->Write(line, length);
+        }
+    }
+
+    serial->Write("PROFILE END\n");
+    serial->Drain();
+    running = wasRunning;
+}
@@ -0,0 +1,88 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "types.h"
+#include "interrupts.h"
+#include "serial.h"
+
+struct ProfileBuffer;
+
+class Profiler
+// Statistical profiler driven by the timer interrupts of every CPU.
+// Every `interval` ticks of a CPU it records the EIP the tick interrupted and, following
+// the saved frame pointers, the return addresses of the callers (the kernel is
+// built without -O, so every function keeps its frame pointer). Samples go into
+// the CPU's own buffer (Cpu::profile), allocated up front, so sampling neither
+// allocates nor shares anything with the other CPUs. `Dump` prints
+// the raw addresses; symbolize.py turns them into flat and folded-stack profiles
+// using the symbols of mykernel.bin.
+{
+public:
+    static const uint32_t MaxDepth = 16;
+
+    struct Sample
+    {
+        uint32_t depth;                 // Valid entries in `frames`.
+        uint32_t frames[MaxDepth];      // frames[0] is the interrupted EIP, then the callers.
+    };
+
+private:
+    ProfileBuffer* buffers;
+    uint32_t bufferCount;
+    // One per CPU that was online at construction; buffers[0] is the boot processor's.
+
+    uint32_t capacity;
+    // Samples per buffer.
+
+    uint32_t interval;
+    bool walkStack;
+    volatile bool running;
+
+    static bool Readable(uint32_t address);
+    // Whether a stack word can be read without taking a fatal page fault.
+
+public:
+    static Profiler* ActiveProfiler;
+
+    Profiler(uint32_t capacity = 4096, uint32_t interval = 1, bool walkStack = true);
+    // Allocates room for `capacity` samples, split evenly between the CPUs online
+    // now. One sample is taken every `interval` timer ticks of each CPU (at 1 kHz
+    // the default samples every millisecond).
+
+    ~Profiler();
+
+    void Record(CPUState* cpu);
+    // Called by each CPU's timer interrupt with the interrupted frame.
+
+    void Start();
+    void Stop();
+    bool Running();
+    void Reset();
+    // Discards all samples.
+
+    void SetInterval(uint32_t ticks);
+    void SetStackWalk(bool enabled);
+
+    uint32_t SampleCount();
+    uint32_t Dropped();
+    // Totals over all CPUs.
+
+    void Dump(SerialDriver* serial);
+    // Writes the samples of every CPU to the serial port between "PROFILE BEGIN"
+    // and "PROFILE END" lines, one "S cpu eip caller ..." line per sample.
+    // Sampling is paused while dumping.
+};
+
+struct ProfileBuffer
+// One CPU's samples; only that CPU's timer interrupt adds to them.
+{
+    Profiler::Sample* samples;
+    volatile uint32_t count;
+
+    volatile uint32_t dropped;
+    // Samples lost because the buffer was full.
+
+    uint32_t ticksLeft;
+};
+
+#endif
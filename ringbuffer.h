@@ -0,0 +1,79 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include "types.h"
+
+template<typename T, uint32_t Size>
+class RingBuffer
+// Fixed-size, lock-free single-producer/single-consumer queue.
+// The producer (typically an interrupt handler) only writes `head`, the consumer
+// (typically a bottom half) only writes `tail`, so neither side needs to disable
+// interrupts or take a lock. x86 doesn't reorder stores with other stores or loads
+// with other loads, so compiler barriers are enough to publish the slots in order.
+{
+    static_assert(Size != 0 && (Size & (Size - 1)) == 0, "RingBuffer size must be a power of two");
+
+    T buffer[Size];
+    // Storage; indices are reduced with `& (Size - 1)`.
+
+    volatile uint32_t head;
+    // Free-running count of pushed elements, written by the producer only.
+
+    volatile uint32_t tail;
+    // Free-running count of popped elements, written by the consumer only.
+
+public:
+    RingBuffer()
+    {
+        head = 0;
+        tail = 0;
+    }
+
+    bool Push(const T& value)
+    // Producer side. Returns false, leaving the buffer unchanged, when it is full.
+    {
+        uint32_t h = head;
+        if(h - tail == Size)
+            return false;
+        buffer[h & (Size - 1)] = value;
+        __asm__ volatile("" : : : "memory");
+        // The slot must be written before the new head becomes visible.
+        head = h + 1;
+        return true;
+    }
+
+    bool Pop(T* value)
+    // Consumer side. Returns false when the buffer is empty.
+    {
+        uint32_t t = tail;
+        if(t == head)
+            return false;
+        *value = buffer[t & (Size - 1)];
+        __asm__ volatile("" : : : "memory");
+        // The slot must be read before it is handed back to the producer.
+        tail = t + 1;
+        return true;
+    }
+
+    uint32_t Count()
+    {
+        return head - tail;
+    }
+
+    bool Empty()
+    {
+        return head == tail;
+    }
+
+    bool Full()
+    {
+        return head - tail == Size;
+    }
+
+    static uint32_t Capacity()
+    {
+        return Size;
+    }
+};
+
+#endif
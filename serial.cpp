@@ -0,0 +1,207 @@
+#include "serial.h"
+
+SerialDriver::SerialDriver(InterruptManager* manager, uint32_t baudRate, uint16_t portBase, uint8_t irq)
+: InterruptHandler(manager, manager->HardwareInterruptOffset() + irq),
+  dataPort(portBase),
+  interruptEnablePort(portBase + 1),
+  fifoControlPort(portBase + 2),
+  lineControlPort(portBase + 3),
+  modemControlPort(portBase + 4),
+  lineStatusPort(portBase + 5),
+  modemStatusPort(portBase + 6),
+  transmitLock("serial tx"),
+  drained("serial drain")
+{
+    transmitDropped = 0;
+    receiveDropped = 0;
+
+    interruptEnable = 0;
+    interruptEnablePort.Write(0x00);    // No interrupts while we set things up.
+
+    SetBaudRate(baudRate);
+    lineControlPort.Write(0x03);        // 8 data bits, no parity, 1 stop bit, DLAB off.
+    fifoControlPort.Write(0xC7);        // Enable and clear both FIFOs, receive trigger at 14 bytes.
+
+    // Loopback self test: a byte written to the transmitter must come back on the receiver.
+    modemControlPort.Write(0x1E);       // Loopback, OUT1, OUT2, RTS.
+    dataPort.Write(0xAE);
+    present = false;
+    for(int i = 0; i < 1000 && !present; ++i)
+        present = lineStatusPort.Read() & 0x01;
+    present = present && dataPort.Read() == 0xAE;
+
+    modemControlPort.Write(0x0B);       // Normal operation: DTR, RTS, and OUT2 to route the IRQ to the PIC.
+
+    if(present)
+    {
+        interruptEnable = 0x01;         // Received data available.
+        interruptEnablePort.Write(interruptEnable);
+    }
+}
+
+SerialDriver::~SerialDriver()
+{
+    interruptEnablePort.Write(0x00);
+}
+
+void SerialDriver::SetBaudRate(uint32_t baudRate)
+{
+    if(baudRate == 0 || baudRate > BaseBaudRate)
+        baudRate = BaseBaudRate;
+    uint32_t divisor = BaseBaudRate / baudRate;
+
+    uint8_t lineControl = lineControlPort.Read();
+    lineControlPort.Write(lineControl | 0x80);      // DLAB on: ports 0 and 1 become the divisor latch.
+    dataPort.Write(divisor & 0xFF);
+    interruptEnablePort.Write((divisor >> 8) & 0xFF);
+    lineControlPort.Write(lineControl & ~0x80);
+}
+
+void SerialDriver::FillTransmitFifo()
+{
+    uint8_t byte;
+    for(int i = 0; i < 16; ++i)
+    {
+        if(!transmitBuffer.Pop(&byte))
+        {
+            interruptEnable &= ~0x02;
+            interruptEnablePort.Write(interruptEnable);
+            drained.WakeAll();
+            // Nothing left to send, stop the THRE interrupt until the next Write.
+            // The wake-up takes `drained`'s lock, so it can't fall between a
+            // waiter's check and its sleep.
+            return;
+        }
+        dataPort.Write(byte);
+    }
+}
+
+unsigned int SerialDriver::HandleInterrupt(unsigned int esp)
+{
+    uint8_t identification;
+    while(!((identification = fifoControlPort.Read()) & 0x01))
+    {
+        // Bit 0 clear means an interrupt is pending; bits 1-3 say which.
+        switch(identification & 0x0E)
+        {
+            case 0x06:                  // Receiver line status (overrun, parity, framing, break).
+                lineStatusPort.Read();
+                break;
+
+            case 0x04:                  // Received data available.
+            case 0x0C:                  // Character timeout, data sits in the FIFO below the trigger level.
+                while(lineStatusPort.Read() & 0x01)
+                {
+                    uint8_t byte = dataPort.Read();
+                    if(!receiveBuffer.Push(byte))
+                        receiveDropped++;
+                }
+                break;
+
+            case 0x02:                  // Transmitter holding register empty: the FIFO can take 16 bytes.
+            {
+                SpinLockGuard guard(&transmitLock);
+                FillTransmitFifo();
+                break;
+            }
+
+            case 0x00:                  // Modem status change.
+                modemStatusPort.Read();
+                break;
+        }
+    }
+    return esp;
+}
+
+void SerialDriver::Enqueue(uint8_t byte)
+{
+    if(!transmitBuffer.Push(byte))
+        transmitDropped++;
+}
+
+void SerialDriver::Write(const char* str, uint32_t length)
+{
+    if(!present)
+        return;
+
+    // Several tasks, CPUs and interrupt handlers may write, but the ring has a single
+    // producer, so producers take turns.
+    IrqSpinLockGuard guard(&transmitLock);
+
+    for(uint32_t i = 0; i < length; ++i)
+    {
+        if(str[i] == '\n')
+            Enqueue('\r');
+        Enqueue(str[i]);
+    }
+
+    if(!(interruptEnable & 0x02) && !transmitBuffer.Empty())
+    {
+        interruptEnable |= 0x02;
+        interruptEnablePort.Write(interruptEnable);
+        // Enabling the THRE interrupt while the transmitter is idle raises it right away,
+        // so the handler starts draining the ring.
+    }
+}
+
+void SerialDriver::Write(const char* str)
+{
+    uint32_t length = 0;
+    while(str[length] != '\0')
+        length++;
+    Write(str, length);
+}
+
+bool SerialDriver::TransmitEmpty(void* driver)
+{
+    return ((SerialDriver*)driver)->transmitBuffer.Empty();
+}
+
+void SerialDriver::Drain()
+{
+    if(!present)
+        return;
+
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0" : "=r" (eflags));
+    if(eflags & 0x200)
+    {
+        drained.Wait(&TransmitEmpty, this);
+        return;
+    }
+
+    while(!transmitBuffer.Empty())
+    {
+        if(lineStatusPort.Read() & 0x20)
+        {
+            SpinLockGuard guard(&transmitLock);
+            FillTransmitFifo();
+        }
+    }
+    // Nothing drains the ring with interrupts off, so feed the FIFO whenever it is empty.
+}
+
+bool SerialDriver::Read(uint8_t* byte)
+{
+    return receiveBuffer.Pop(byte);
+}
+
+uint32_t SerialDriver::Available()
+{
+    return receiveBuffer.Count();
+}
+
+bool SerialDriver::Present()
+{
+    return present;
+}
+
+uint32_t SerialDriver::TransmitDropped()
+{
+    return transmitDropped;
+}
+
+uint32_t SerialDriver::ReceiveDropped()
+{
+    return receiveDropped;
+}
@@ -0,0 +1,113 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "types.h"
+#include "interrupts.h"
+#include "port.h"
+#include "ringbuffer.h"
+#include "kprintf.h"
+#include "spinlock.h"
+#include "waitqueue.h"
+
+class SerialDriver : public InterruptHandler, public KPrintfSink
+// Interrupt-driven driver for a 16550 UART (COM1 on IRQ4 by default).
+// Writers only append to a transmit ring; the UART's "transmitter holding register
+// empty" interrupt drains it 16 bytes (one FIFO load) at a time, so nobody polls the
+// line status register. Received bytes are queued by the interrupt handler for `Read`.
+{
+    Port8Bit dataPort;
+    // Transmit/receive buffer (base + 0), divisor latch low byte while DLAB is set.
+
+    Port8Bit interruptEnablePort;
+    // Interrupt enable register (base + 1), divisor latch high byte while DLAB is set.
+
+    Port8Bit fifoControlPort;
+    // Interrupt identification (read) / FIFO control (write) register (base + 2).
+
+    Port8Bit lineControlPort;
+    // Line control register (base + 3): word length, parity, stop bits, DLAB.
+
+    Port8Bit modemControlPort;
+    // Modem control register (base + 4): DTR, RTS, OUT2 (gates the IRQ line), loopback.
+
+    Port8Bit lineStatusPort;
+    // Line status register (base + 5).
+
+    Port8Bit modemStatusPort;
+    // Modem status register (base + 6).
+
+    RingBuffer<uint8_t, 4096> transmitBuffer;
+    // Bytes waiting to be sent; drained by the interrupt handler.
+
+    RingBuffer<uint8_t, 256> receiveBuffer;
+    // Bytes received and not yet read.
+
+    uint8_t interruptEnable;
+    // Shadow of the interrupt enable register.
+
+    SpinLock transmitLock;
+    // Writers on every CPU and the interrupt handler take turns on the transmit
+    // ring (it has a single producer and consumer) and on `interruptEnable`.
+
+    WaitQueue drained;
+    // Tasks in `Drain`; woken when `FillTransmitFifo` finds the ring empty.
+
+    bool present;
+    // Whether the loopback test at initialisation found a working UART.
+
+    volatile uint32_t transmitDropped;
+    // Bytes discarded because the transmit ring was full.
+
+    volatile uint32_t receiveDropped;
+    // Bytes discarded because nobody read them in time.
+
+    void FillTransmitFifo();
+    // Moves up to 16 bytes from the ring into the UART; disables the THRE interrupt
+    // and wakes `drained` when the ring is empty. `transmitLock` must be held.
+
+    static bool TransmitEmpty(void* driver);
+    // `drained`'s condition.
+
+    void Enqueue(uint8_t byte);
+    // Appends one byte to the transmit ring (`transmitLock` must be held).
+
+public:
+    static const uint16_t COM1 = 0x3F8;
+    static const uint32_t BaseBaudRate = 115200;
+
+    SerialDriver(InterruptManager* manager, uint32_t baudRate = 115200, uint16_t portBase = COM1, uint8_t irq = 4);
+    // Programs the UART for `baudRate` 8N1 with 16-byte FIFOs and enables the receive interrupt.
+
+    ~SerialDriver();
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+    // Services receive, transmit and status interrupts.
+
+    virtual void Write(const char* str, uint32_t length);
+    // Queues `length` bytes for transmission ('\n' is sent as "\r\n"). Never waits
+    // for the UART; bytes that don't fit in the ring are dropped and counted.
+
+    void Write(const char* str);
+    // Queues a NUL-terminated string.
+
+    void Drain();
+    // Waits until the transmit ring is empty, for writers with more output than
+    // the ring holds. A task sleeps in `drained` until the THRE interrupt has sent
+    // the last byte; the idle loop halts until then, and with interrupts off the
+    // FIFO is fed by polling.
+
+    bool Read(uint8_t* byte);
+    // Takes one received byte, returns false if none is waiting.
+
+    uint32_t Available();
+    // Number of received bytes waiting.
+
+    void SetBaudRate(uint32_t baudRate);
+    // Reprograms the divisor latch.
+
+    bool Present();
+    uint32_t TransmitDropped();
+    uint32_t ReceiveDropped();
+};
+
+#endif
@@ -0,0 +1,269 @@
+#include "smp.h"
+#include "apic.h"
+#include "timer.h"
+#include "multitasking.h"
+#include "heap.h"
+#include "arith.h"
+#include "syscall.h"
+#include "fpu.h"
+#include "paging.h"
+#include "profiler.h"
+
+extern "C" uint8_t smp_trampoline_start;
+extern "C" uint8_t smp_trampoline_parameters;
+extern "C" uint8_t smp_trampoline_end;
+
+SmpManager* SmpManager::ActiveSmpManager = 0;
+
+Cpu::Cpu(uint32_t index)
+{
+    self = this;
+    this->index = index;
+    apicId = 0;
+    gdt = 0;
+    scheduler = 0;
+    stack = 0;
+    shootdown = false;
+    fpuOwner = 0;
+    fpuDirty = false;
+    online = false;
+    interruptStatistics = 0;
+    profile = 0;
+    ticks = 0;
+    nextTickTsc = 0;
+}
+
+Cpu* Cpu::Current()
+{
+    if(SmpManager::ActiveSmpManager == 0)
+        return 0;
+    Cpu* cpu;
+    __asm__ volatile("movl %%gs:0, %0" : "=r" (cpu));
+    return cpu;
+}
+
+SmpManager::SmpManager(InterruptManager* manager, GDT* gdt)
+: InterruptHandler(manager, manager->HardwareInterruptOffset() + TimerVector),
+  bootCpu(0),
+  shootdownHandler(manager)
+{
+    shootdownAddress = 0;
+    shootdownsPending = 0;
+    bootCpu.gdt = gdt;
+    bootCpu.online = true;
+    gdt->SetPerCpuBase((uint32_t)&bootCpu, sizeof(Cpu));
+    bootCpu.tss.ss0 = gdt->DSS();
+    gdt->SetTaskStateSegment(&bootCpu.tss);
+    cpus[0] = &bootCpu;
+    cpuCount = 1;
+    localApic = 0;
+    tscPerTick = 0;
+    timeSlice = 10;
+    ActiveSmpManager = this;
+}
+
+SmpManager::~SmpManager()
+{
+    if(ActiveSmpManager == this)
+        ActiveSmpManager = 0;
+}
+
+uint32_t SmpManager::StartProcessors(Madt* madt, LocalApic* localApic, TimerDriver* timer, uint32_t timeSliceTicks)
+{
+    if(localApic == 0 || timer->TscFrequency() < timer->Frequency())
+        return cpuCount;
+    // The APs' ticks come from their APIC timers, which need the calibrated TSC.
+
+    this->localApic = localApic;
+    tscPerTick = DivU64(timer->TscFrequency(), timer->Frequency());
+    timeSlice = timeSliceTicks;
+    bootCpu.apicId = localApic->Id();
+
+    uint8_t* trampoline = (uint8_t*)TrampolineBase;
+    for(uint8_t* source = &smp_trampoline_start; source < &smp_trampoline_end; ++source)
+        *trampoline++ = *source;
+
+    for(uint32_t i = 0; i < madt->processorCount && cpuCount < MaxCpus; ++i)
+    {
+        if(madt->processors[i].apicId == bootCpu.apicId)
+            continue;
+
+        Cpu* cpu = new Cpu(cpuCount);
+        cpu->apicId = madt->processors[i].apicId;
+        cpu->stack = new uint8_t[StackSize];
+        if(cpu->stack == 0)
+        {
+            delete cpu;
+            break;
+        }
+        for(uint32_t j = 0; j < StackSize; j += 4)
+            *(volatile uint32_t*)(cpu->stack + j) = 0;
+        // Touch the stack so it is mapped now: the AP has no IDT yet when it first
+        // pushes, and a page fault there would reset it.
+
+        cpu->interruptStatistics = InterruptManager::CreateStatistics();
+
+        if(StartProcessor(cpu, timer))
+            cpus[cpuCount++] = cpu;
+        else
+        {
+            delete[] cpu->interruptStatistics;
+            delete[] cpu->stack;
+            delete cpu;
+        }
+    }
+    return cpuCount;
+}
+
+bool SmpManager::StartProcessor(Cpu* cpu, TimerDriver* timer)
+{
+    TrampolineParameters* parameters = (TrampolineParameters*)
+        (TrampolineBase + (&smp_trampoline_parameters - &smp_trampoline_start));
+    __asm__ volatile("mov %%cr0, %0" : "=r" (parameters->cr0));
+    __asm__ volatile("mov %%cr3, %0" : "=r" (parameters->cr3));
+    __asm__ volatile("mov %%cr4, %0" : "=r" (parameters->cr4));
+    parameters->stack = (uint32_t)(cpu->stack + StackSize);
+    parameters->entry = (uint32_t)&ApplicationProcessorMain;
+    parameters->cpu = (uint32_t)cpu;
+
+    localApic->SendIpi(cpu->apicId, 0x4500);
+    // INIT, level assert.
+    timer->SleepNs(10000000);
+
+    for(int attempt = 0; attempt < 2; ++attempt)
+    {
+        localApic->SendIpi(cpu->apicId, 0x4600 | (TrampolineBase >> 12));
+        // Startup IPI; the vector is the page the CPU starts executing at.
+        timer->SleepNs(200000);
+        if(cpu->online)
+            return true;
+    }
+    // Intel's sequence sends the Startup IPI twice; a CPU that already runs ignores the second.
+
+    uint64_t deadline = timer->NowNs() + 100000000;
+    while(!cpu->online && timer->NowNs() < deadline)
+        __asm__ volatile("pause");
+    return cpu->online;
+}
+
+void SmpManager::ApplicationProcessorMain(Cpu* cpu)
+{
+    SmpManager* smp = ActiveSmpManager;
+    smp->interruptManager->Load();
+    // First, so faults from here on are reported instead of resetting the CPU.
+
+    cpu->gdt = new GDT();
+    cpu->gdt->LoadSegments();
+    cpu->gdt->SetPerCpuBase((uint32_t)cpu, sizeof(Cpu));
+    // The trampoline's GDT only lives in low memory; switch to one of our own.
+    cpu->tss.ss0 = cpu->gdt->DSS();
+    cpu->tss.esp0 = (uint32_t)(cpu->stack + StackSize);
+    cpu->gdt->SetTaskStateSegment(&cpu->tss);
+    if(SyscallManager::ActiveSyscallManager != 0)
+        SyscallManager::ActiveSyscallManager->InitializeCpu(cpu);
+    if(FpuManager::ActiveFpuManager != 0)
+        FpuManager::ActiveFpuManager->InitializeCpu();
+    // The sysenter MSRs and the FPU setup are per CPU too.
+
+    smp->localApic->Enable();
+    new TaskManager(smp->timeSlice, true);
+    // This context becomes the CPU's idle task.
+
+    if(smp->localApic->StartTimer(smp->interruptManager->HardwareInterruptOffset() + TimerVector,
+                                  TimerDriver::ActiveTimer->TscFrequency()))
+    {
+        cpu->nextTickTsc = TimerDriver::ReadTSC();
+        cpu->nextTickTsc += smp->tscPerTick;
+        smp->localApic->ArmTimer(cpu->nextTickTsc);
+    }
+
+    cpu->online = true;
+    while(true)
+        __asm__ volatile("sti; hlt" : : : "memory");
+    // Woken by every tick, which runs ready tasks from the other CPUs' queues.
+}
+
+unsigned int SmpManager::HandleInterrupt(unsigned int esp)
+{
+    Cpu* cpu = Cpu::Current();
+    cpu->ticks++;
+
+    uint64_t now = TimerDriver::ReadTSC();
+    cpu->nextTickTsc += tscPerTick;
+    if(cpu->nextTickTsc <= now)
+        cpu->nextTickTsc = now + tscPerTick;
+    localApic->ArmTimer(cpu->nextTickTsc);
+    localApic->EndOfInterrupt();
+    // Not an IRQ line, so the InterruptManager doesn't acknowledge it; do it
+    // before the scheduler may switch to another task's frame.
+
+    if(Profiler::ActiveProfiler != 0)
+        Profiler::ActiveProfiler->Record((CPUState*)esp);
+    if(cpu->scheduler != 0)
+        esp = (unsigned int)cpu->scheduler->Tick((CPUState*)esp);
+    return esp;
+}
+
+void SmpManager::InvalidatePage(uint32_t virtualAddress)
+{
+    if(cpuCount <= 1 || localApic == 0)
+        return;
+
+    Cpu* self = Cpu::Current();
+    uint32_t targets = 0;
+    for(uint32_t i = 0; i < cpuCount; ++i)
+    {
+        if(cpus[i] != self && cpus[i]->online)
+            targets++;
+    }
+    if(targets == 0)
+        return;
+
+    shootdownAddress = virtualAddress;
+    shootdownsPending = targets;
+    for(uint32_t i = 0; i < cpuCount; ++i)
+    {
+        if(cpus[i] == self || !cpus[i]->online)
+            continue;
+        cpus[i]->shootdown = true;
+        localApic->SendIpi(cpus[i]->apicId, 0x4400);
+        // NMI delivery, level assert; the vector field is ignored.
+    }
+
+    while(shootdownsPending != 0)
+        __asm__ volatile("pause" : : : "memory");
+}
+
+uint32_t SmpManager::CpuCount()
+{
+    return cpuCount;
+}
+
+Cpu* SmpManager::GetCpu(uint32_t index)
+{
+    return index < cpuCount ? cpus[index] : 0;
+}
+
+
+TlbShootdownHandler::TlbShootdownHandler(InterruptManager* manager)
+: InterruptHandler(manager, 0x02)   // NMI.
+{
+}
+
+TlbShootdownHandler::~TlbShootdownHandler()
+{
+}
+
+unsigned int TlbShootdownHandler::HandleInterrupt(unsigned int esp)
+{
+    Cpu* cpu = Cpu::Current();
+    SmpManager* smp = SmpManager::ActiveSmpManager;
+    if(cpu != 0 && smp != 0 && cpu->shootdown)
+    {
+        PageManager::InvalidatePage(smp->shootdownAddress);
+        cpu->shootdown = false;
+        AtomicFetchAdd(&smp->shootdownsPending, (uint32_t)-1);
+    }
+    // Any other NMI (e.g. a hardware error) is ignored.
+    return esp;
+}
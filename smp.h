@@ -0,0 +1,154 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "acpi.h"
+
+class TaskManager;
+class Task;
+class TimerDriver;
+class LocalApic;
+struct ProfileBuffer;
+
+class Cpu
+// Per-CPU data block. Each CPU's GDT has a segment over its own block, loaded
+// into %gs, so code that runs on any CPU finds its block with one load from %gs:0.
+{
+public:
+    Cpu* self;
+    // Must stay first: `Current` reads it through %gs.
+
+    uint32_t index;
+    // 0 for the boot processor, then in start-up order.
+
+    uint8_t apicId;
+
+    GDT* gdt;
+
+    TaskManager* scheduler;
+    // This CPU's scheduler, set by the TaskManager constructor.
+
+    uint8_t* stack;
+    // Kernel stack the CPU started on (the boot processor's is kernel_stack in loader.s).
+
+    TaskStateSegment tss;
+    // Kernel stack for entries from ring 3 (interrupts and sysenter), switched with the running task.
+
+    Task* fpuOwner;
+    bool fpuDirty;
+    // Task whose state is in this CPU's FPU registers, and whether they changed
+    // since it was last saved (see FpuManager).
+
+    volatile bool shootdown;
+    // Set by SmpManager::InvalidatePage until this CPU has flushed the page.
+
+    volatile bool online;
+    // Set by the CPU itself once it takes interrupts.
+
+    InterruptStatistics* interruptStatistics;
+    // Per-vector counters of an application processor, updated only by it; the
+    // boot processor's are InterruptManager::statistics.
+
+    ProfileBuffer* profile;
+    // Where the Profiler puts this CPU's samples, 0 while none is attached.
+
+    uint64_t ticks;
+    uint64_t nextTickTsc;
+    // Local APIC timer of the application processors.
+
+    Cpu(uint32_t index);
+
+    static Cpu* Current();
+    // The calling CPU's block, 0 before SmpManager has set up the boot processor's.
+};
+
+class TlbShootdownHandler : public InterruptHandler
+// NMI handler that flushes the page SmpManager::InvalidatePage asks for. An NMI
+// gets through even while the CPU spins with interrupts off (e.g. for the lock
+// the requesting CPU holds), so a shootdown can't deadlock.
+{
+public:
+    TlbShootdownHandler(InterruptManager* manager);
+    ~TlbShootdownHandler();
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+};
+
+class SmpManager : public InterruptHandler
+// Brings up the application processors (APs) the MADT lists, using the
+// INIT-SIPI-SIPI sequence and the real-mode trampoline in smptrampoline.s. Each
+// AP gets its own stack, GDT and per-CPU block, loads the shared IDT, enables
+// its local APIC and becomes the idle task of its own TaskManager, ticked by its
+// APIC timer on vector offset + 0x20. Work reaches it by stealing from the
+// other CPUs' run queues. IRQs stay routed to the boot processor.
+{
+public:
+    static const uint32_t MaxCpus = Madt::MaxProcessors;
+    static const uint32_t StackSize = 16 * 1024;
+    static const uint32_t TrampolineBase = 0x8000;
+    // Below 1 MiB, page aligned, reserved by the PMM and identity mapped.
+    static const uint8_t TimerVector = 0x20;
+    // Relative to the hardware interrupt offset; the 8259/IOAPIC lines end at 0x0F.
+
+private:
+    struct TrampolineParameters
+    // Layout of smp_trampoline_parameters.
+    {
+        uint32_t cr0;
+        uint32_t cr3;
+        uint32_t cr4;
+        uint32_t stack;
+        uint32_t entry;
+        uint32_t cpu;
+    } __attribute__((packed));
+
+    Cpu bootCpu;
+    Cpu* cpus[MaxCpus];
+    uint32_t cpuCount;
+
+    TlbShootdownHandler shootdownHandler;
+
+    volatile uint32_t shootdownAddress;
+    volatile uint32_t shootdownsPending;
+    // CPUs that haven't flushed `shootdownAddress` yet.
+
+    LocalApic* localApic;
+    uint64_t tscPerTick;
+    uint32_t timeSlice;
+
+    bool StartProcessor(Cpu* cpu, TimerDriver* timer);
+    // Sends INIT-SIPI-SIPI and waits up to 100 ms for the CPU to come online.
+
+    static void ApplicationProcessorMain(Cpu* cpu);
+    // Where the trampoline enters the kernel, on the new CPU's own stack.
+
+public:
+    static SmpManager* ActiveSmpManager;
+
+    SmpManager(InterruptManager* manager, GDT* gdt);
+    // Sets up the boot processor's per-CPU block in `gdt`. Must come before the TaskManager.
+
+    ~SmpManager();
+
+    uint32_t StartProcessors(Madt* madt, LocalApic* localApic, TimerDriver* timer, uint32_t timeSliceTicks = 10);
+    // Starts every other enabled processor of `madt`, one after the other, and
+    // returns the number of CPUs online. Interrupts must still be off: the APs
+    // use the heap while they start, and the boot processor waits for each.
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+    // APIC timer tick of an AP: re-arms it and lets the AP's scheduler run.
+
+    void InvalidatePage(uint32_t virtualAddress);
+    // Flushes a changed mapping from the other online CPUs' TLBs and waits until
+    // they have. The caller flushes its own and serializes shootdowns (PageManager
+    // holds its lock).
+
+    friend class TlbShootdownHandler;
+
+    uint32_t CpuCount();
+    Cpu* GetCpu(uint32_t index);
+};
+
+#endif
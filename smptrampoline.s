@@ -0,0 +1,75 @@
+# Real-mode entry point of the application processors.
+# A Startup IPI starts a CPU in real mode at a page-aligned address below 1 MiB,
+# so SmpManager copies everything from smp_trampoline_start to smp_trampoline_end
+# to TRAMPOLINE_BASE and fills in the parameter block at its end before each start.
+# The code only uses addresses relative to TRAMPOLINE_BASE, never its link address.
+
+.set TRAMPOLINE_BASE, 0x8000
+.set CODE_SELECTOR, 0x10                # Same layout as the kernel's GDT, so the IDT's
+.set DATA_SELECTOR, 0x18                # gates work before the kernel GDT is loaded.
+
+.section .text
+
+.code16
+.global smp_trampoline_start
+smp_trampoline_start:
+    cli
+    cld
+    xor %ax, %ax
+    mov %ax, %ds
+    lgdtl TRAMPOLINE_BASE + (trampoline_gdt_pointer - smp_trampoline_start)
+
+    mov %cr0, %eax
+    or $1, %eax                         # PE: protected mode
+    mov %eax, %cr0
+    ljmpl $CODE_SELECTOR, $(TRAMPOLINE_BASE + (trampoline_protected - smp_trampoline_start))
+
+.code32
+trampoline_protected:
+    mov $DATA_SELECTOR, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+    mov %ax, %ss
+
+    # Paging exactly like the boot processor: same page directory, PSE, PG and WP.
+    mov TRAMPOLINE_BASE + (trampoline_cr4 - smp_trampoline_start), %eax
+    mov %eax, %cr4
+    mov TRAMPOLINE_BASE + (trampoline_cr3 - smp_trampoline_start), %eax
+    mov %eax, %cr3
+    mov TRAMPOLINE_BASE + (trampoline_cr0 - smp_trampoline_start), %eax
+    mov %eax, %cr0                      # The trampoline is identity mapped, so execution continues
+
+    mov TRAMPOLINE_BASE + (trampoline_stack - smp_trampoline_start), %esp
+    pushl TRAMPOLINE_BASE + (trampoline_cpu - smp_trampoline_start)
+    mov TRAMPOLINE_BASE + (trampoline_entry - smp_trampoline_start), %eax
+    call *%eax                          # entry(cpu), never returns
+
+trampoline_stop:
+    cli
+    hlt
+    jmp trampoline_stop
+
+.align 8
+trampoline_gdt:
+    .quad 0                             # null
+    .quad 0                             # unused
+    .quad 0x00CF9A000000FFFF            # flat 4 GiB code
+    .quad 0x00CF92000000FFFF            # flat 4 GiB data
+trampoline_gdt_pointer:
+    .word trampoline_gdt_pointer - trampoline_gdt - 1
+    .long TRAMPOLINE_BASE + (trampoline_gdt - smp_trampoline_start)
+
+.align 4
+.global smp_trampoline_parameters
+smp_trampoline_parameters:              # Filled in by SmpManager, see `TrampolineParameters`
+trampoline_cr0:   .long 0
+trampoline_cr3:   .long 0
+trampoline_cr4:   .long 0
+trampoline_stack: .long 0
+trampoline_entry: .long 0
+trampoline_cpu:   .long 0
+
+.global smp_trampoline_end
+smp_trampoline_end:
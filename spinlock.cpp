@@ -0,0 +1,208 @@
+#include "spinlock.h"
+#include "timer.h"
+#include "kprintf.h"
+#include "arith.h"
+
+#if LOCK_STATISTICS
+static const uint32_t MaxNamedLocks = 64;
+static LockStatistics* namedLocks[MaxNamedLocks];
+static volatile uint32_t namedLockCount = 0;
+// Locks live inside the objects they protect, so they register here instead of
+// being found through some global table.
+
+static void Register(LockStatistics* statistics, const char* name)
+{
+    statistics->name = name;
+    statistics->acquisitions = 0;
+    statistics->contended = 0;
+    statistics->spinCycles = 0;
+    statistics->maxSpinCycles = 0;
+    if(name == 0)
+        return;
+
+    uint32_t slot = AtomicFetchAdd(&namedLockCount, 1);
+    if(slot < MaxNamedLocks)
+        namedLocks[slot] = statistics;
+}
+
+static void Unregister(LockStatistics* statistics)
+{
+    for(uint32_t i = 0; i < namedLockCount && i < MaxNamedLocks; ++i)
+    {
+        if(namedLocks[i] == statistics)
+            namedLocks[i] = 0;
+    }
+}
+
+static void AddSpin(LockStatistics* statistics, uint64_t start)
+{
+    uint64_t elapsed = TimerDriver::ReadTSC() - start;
+    uint32_t cycles = (elapsed >> 32) ? 0xFFFFFFFF : (uint32_t)elapsed;
+    statistics->contended++;
+    statistics->spinCycles += cycles;
+    if(cycles > statistics->maxSpinCycles)
+        statistics->maxSpinCycles = cycles;
+}
+#endif
+
+SpinLock::SpinLock(const char* name)
+{
+    next = 0;
+    serving = 0;
+#if LOCK_STATISTICS
+    Register(&statistics, name);
+#endif
+}
+
+SpinLock::~SpinLock()
+{
+#if LOCK_STATISTICS
+    Unregister(&statistics);
+#endif
+}
+
+void SpinLock::Wait(uint32_t ticket)
+{
+#if LOCK_STATISTICS
+    uint64_t start = TimerDriver::ReadTSC();
+#endif
+    uint32_t ahead;
+    while((ahead = ticket - serving) != 0)
+    {
+        for(uint32_t i = 0; i < ahead * BackoffPauses; ++i)
+            CpuRelax();
+    }
+#if LOCK_STATISTICS
+    AddSpin(&statistics, start);
+    // We hold the lock now, so the counters are ours to update.
+#endif
+}
+
+void SpinLock::SetName(const char* name)
+{
+#if LOCK_STATISTICS
+    if(statistics.name == 0)
+        Register(&statistics, name);
+#endif
+}
+
+bool SpinLock::TryLock()
+{
+    uint32_t ticket = serving;
+    if(!AtomicCompareAndSwap(&next, ticket, ticket + 1))
+        return false;
+    // `next == serving` means nobody holds the lock or waits for it.
+#if LOCK_STATISTICS
+    statistics.acquisitions++;
+#endif
+    return true;
+}
+
+bool SpinLock::IsLocked()
+{
+    return next != serving;
+}
+
+const LockStatistics* SpinLock::Statistics()
+{
+#if LOCK_STATISTICS
+    return &statistics;
+#else
+    return 0;
+#endif
+}
+
+ReadWriteLock::ReadWriteLock(const char* name)
+{
+    state = 0;
+    writersWaiting = 0;
+#if LOCK_STATISTICS
+    Register(&statistics, name);
+#endif
+}
+
+ReadWriteLock::~ReadWriteLock()
+{
+#if LOCK_STATISTICS
+    Unregister(&statistics);
+#endif
+}
+
+void ReadWriteLock::ReadLock()
+{
+    bool waited = false;
+    while(true)
+    {
+        uint32_t current = state;
+        if(!(current & Writer) && writersWaiting == 0
+           && AtomicCompareAndSwap(&state, current, current + 1))
+            break;
+        waited = true;
+        CpuRelax();
+    }
+#if LOCK_STATISTICS
+    AtomicFetchAdd(&statistics.acquisitions, 1);
+    if(waited)
+        AtomicFetchAdd(&statistics.contended, 1);
+    // Readers are inside together, so they count atomically.
+#endif
+}
+
+void ReadWriteLock::ReadUnlock()
+{
+    AtomicFetchAdd(&state, (uint32_t)-1);
+}
+
+void ReadWriteLock::WriteLock()
+{
+    AtomicFetchAdd(&writersWaiting, 1);
+#if LOCK_STATISTICS
+    uint64_t start = TimerDriver::ReadTSC();
+#endif
+    bool waited = false;
+    while(!AtomicCompareAndSwap(&state, 0, Writer))
+    {
+        waited = true;
+        CpuRelax();
+    }
+    AtomicFetchAdd(&writersWaiting, (uint32_t)-1);
+#if LOCK_STATISTICS
+    statistics.acquisitions++;
+    if(waited)
+        AddSpin(&statistics, start);
+#endif
+}
+
+void ReadWriteLock::WriteUnlock()
+{
+    __asm__ volatile("" : : : "memory");
+    state = 0;
+}
+
+const LockStatistics* ReadWriteLock::Statistics()
+{
+#if LOCK_STATISTICS
+    return &statistics;
+#else
+    return 0;
+#endif
+}
+
+void DumpLockStatistics()
+{
+#if LOCK_STATISTICS
+    kprintf("\nlock                acquired  contended  avg wait  max wait (cycles)\n");
+    for(uint32_t i = 0; i < namedLockCount && i < MaxNamedLocks; ++i)
+    {
+        LockStatistics* statistics = namedLocks[i];
+        if(statistics == 0)
+            continue;
+        kprintf("  %-16s %10u %10u %9u %9u\n", statistics->name,
+                statistics->acquisitions, statistics->contended,
+                statistics->contended == 0 ? 0 : (uint32_t)DivU64(statistics->spinCycles, statistics->contended),
+                statistics->maxSpinCycles);
+    }
+#else
+    kprintf("\nLock statistics are disabled (LOCK_STATISTICS=0)\n");
+#endif
+}
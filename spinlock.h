@@ -0,0 +1,193 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "types.h"
+#include "atomic.h"
+
+#ifndef LOCK_STATISTICS
+#define LOCK_STATISTICS 1
+#endif
+// Contention counters for every named lock, see `DumpLockStatistics`. An
+// uncontended acquisition only bumps one counter; build with -DLOCK_STATISTICS=0
+// to take them out.
+
+// Counters of one lock. Updated by the CPU that holds the lock (or, for the
+// reader side of a ReadWriteLock, atomically).
+struct LockStatistics {
+    const char* name;
+    uint32_t acquisitions;  // Times the lock was taken (read and write side together).
+    uint32_t contended;     // Of those, times the CPU had to wait.
+    uint64_t spinCycles;    // TSC ticks spent waiting, in total.
+    uint32_t maxSpinCycles; // Longest single wait.
+};
+
+class SpinLock
+// Ticket lock: every CPU draws a ticket and waits until `serving` reaches it,
+// so the lock is handed out in arrival order and no CPU starves. Waiters back
+// off with `pause` in proportion to their place in line, which keeps the cache
+// line holding `serving` from bouncing between them on every poll.
+// Does not disable interrupts; a lock that an interrupt handler also takes must
+// be held through IrqSpinLockGuard.
+{
+    volatile uint32_t next;
+    // Next ticket to hand out.
+
+    volatile uint32_t serving;
+    // Ticket that owns the lock; only the holder advances it.
+
+#if LOCK_STATISTICS
+    LockStatistics statistics;
+#endif
+
+    void Wait(uint32_t ticket);
+    // Slow path of `Lock`.
+
+public:
+    static const uint32_t BackoffPauses = 32;
+    // `pause`s per waiter ahead of us between two looks at `serving`.
+
+    SpinLock(const char* name = 0);
+    // Named locks are listed by `DumpLockStatistics`.
+
+    ~SpinLock();
+
+    void SetName(const char* name);
+    // Names a lock that was constructed without one (e.g. one in an array).
+
+    inline void Lock()
+    {
+        uint32_t ticket = AtomicFetchAdd(&next, 1);
+        if(serving != ticket)
+            Wait(ticket);
+#if LOCK_STATISTICS
+        statistics.acquisitions++;
+#endif
+    }
+
+    bool TryLock();
+    // Takes the lock only if nobody holds or waits for it.
+
+    inline void Unlock()
+    {
+        __asm__ volatile("" : : : "memory");
+        // x86 keeps stores in order, so everything written in the critical section
+        // is visible before the next ticket is.
+        serving = serving + 1;
+    }
+
+    bool IsLocked();
+
+    const LockStatistics* Statistics();
+};
+
+class SpinLockGuard
+// Holds a lock for the lifetime of the guard.
+{
+    SpinLock* lock;
+
+public:
+    inline SpinLockGuard(SpinLock* lock)
+    {
+        this->lock = lock;
+        lock->Lock();
+    }
+
+    inline ~SpinLockGuard()
+    {
+        lock->Unlock();
+    }
+};
+
+class IrqSpinLockGuard
+// Disables interrupts on this CPU and holds a lock, for data that interrupt
+// handlers use as well. Restores the previous interrupt flag afterwards, so it
+// nests and works in handlers. Other CPUs keep taking interrupts.
+{
+    SpinLock* lock;
+    uint32_t eflags;
+
+public:
+    inline IrqSpinLockGuard(SpinLock* lock)
+    {
+        __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+        this->lock = lock;
+        lock->Lock();
+    }
+
+    inline ~IrqSpinLockGuard()
+    {
+        lock->Unlock();
+        __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+    }
+};
+
+class ReadWriteLock
+// Any number of readers or one writer. A waiting writer keeps new readers out,
+// so a steady stream of readers can't starve it. Readers don't write any shared
+// line but `state`, which makes read-mostly data (tables that are looked up all
+// the time and changed rarely) scale better than with a SpinLock.
+// Does not disable interrupts. The wait times in its statistics are the writers'.
+{
+    static const uint32_t Writer = 0x80000000;
+
+    volatile uint32_t state;
+    // Writer bit plus the number of readers inside.
+
+    volatile uint32_t writersWaiting;
+
+#if LOCK_STATISTICS
+    LockStatistics statistics;
+#endif
+
+public:
+    ReadWriteLock(const char* name = 0);
+    ~ReadWriteLock();
+
+    void ReadLock();
+    void ReadUnlock();
+    void WriteLock();
+    void WriteUnlock();
+
+    const LockStatistics* Statistics();
+};
+
+class ReadLockGuard
+// Holds the read side of a ReadWriteLock for the lifetime of the guard.
+{
+    ReadWriteLock* lock;
+
+public:
+    inline ReadLockGuard(ReadWriteLock* lock)
+    {
+        this->lock = lock;
+        lock->ReadLock();
+    }
+
+    inline ~ReadLockGuard()
+    {
+        lock->ReadUnlock();
+    }
+};
+
+class WriteLockGuard
+// Holds the write side of a ReadWriteLock for the lifetime of the guard.
+{
+    ReadWriteLock* lock;
+
+public:
+    inline WriteLockGuard(ReadWriteLock* lock)
+    {
+        this->lock = lock;
+        lock->WriteLock();
+    }
+
+    inline ~WriteLockGuard()
+    {
+        lock->WriteUnlock();
+    }
+};
+
+void DumpLockStatistics();
+// Prints the counters of every named lock through kprintf.
+
+#endif
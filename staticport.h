@@ -0,0 +1,106 @@
+#ifndef STATICPORT_H
+#define STATICPORT_H
+
+#include "types.h"
+
+// Compile-time I/O ports.
+// `Port8Bit` and friends keep the port number in the object and dispatch through
+// a vtable, which is right for ports only known at run time (e.g. a UART base
+// chosen by the caller). For fixed legacy ports the number is a template argument
+// instead: there is no object, no vptr and no call, and each access compiles to a
+// single `in`/`out` with the port as an immediate (for ports below 0x100) even at -O0.
+
+#define STATIC_PORT_INLINE static inline __attribute__((always_inline))
+// always_inline so that the accessors disappear even in unoptimised builds.
+
+struct NoDelay
+// Access the port back to back.
+{
+    STATIC_PORT_INLINE void Wait() {}
+};
+
+struct IoDelay
+// Give slow legacy devices (e.g. the 8259 during initialisation) time to settle,
+// using the same pair of short jumps as `Port8BitSlow`.
+{
+    STATIC_PORT_INLINE void Wait()
+    {
+        __asm__ volatile("jmp 1f\n1: jmp 1f\n1:");
+    }
+};
+
+template<uint16_t Port, typename Width = uint8_t, typename Delay = NoDelay>
+struct StaticPort
+{
+    static_assert(sizeof(Width) == 1 || sizeof(Width) == 2 || sizeof(Width) == 4,
+                  "StaticPort width must be 8, 16 or 32 bits");
+
+    typedef Width ValueType;
+    static const uint16_t Number = Port;
+
+    STATIC_PORT_INLINE Width Read()
+    {
+        Width result;
+        if constexpr(sizeof(Width) == 1)
+            __asm__ volatile("inb %1, %0" : "=a" (result) : "Nd" (Port));
+        else if constexpr(sizeof(Width) == 2)
+            __asm__ volatile("inw %1, %0" : "=a" (result) : "Nd" (Port));
+        else
+            __asm__ volatile("inl %1, %0" : "=a" (result) : "Nd" (Port));
+        // "Nd": an immediate when the port fits in 8 bits, otherwise DX.
+        return result;
+    }
+
+    STATIC_PORT_INLINE void Write(Width data)
+    {
+        if constexpr(sizeof(Width) == 1)
+            __asm__ volatile("outb %0, %1" : : "a" (data), "Nd" (Port));
+        else if constexpr(sizeof(Width) == 2)
+            __asm__ volatile("outw %0, %1" : : "a" (data), "Nd" (Port));
+        else
+            __asm__ volatile("outl %0, %1" : : "a" (data), "Nd" (Port));
+        Delay::Wait();
+    }
+};
+
+template<typename Port>
+using SlowPort = StaticPort<Port::Number, typename Port::ValueType, IoDelay>;
+// The same port with settle time after writes, e.g. `SlowPort<MasterCommand>::Write(0x11)` for the 8259.
+
+template<typename Register, uint8_t Shift, uint8_t Bits = 1>
+struct RegisterField
+// A bit field of a register, e.g. `RegisterField<KeyboardStatus, 0>` for the
+// "output buffer full" bit of the keyboard controller's status register.
+{
+    typedef typename Register::ValueType ValueType;
+
+    static const ValueType Mask = (ValueType)(((1u << Bits) - 1) << Shift);
+
+    STATIC_PORT_INLINE ValueType Extract(ValueType registerValue)
+    {
+        return (registerValue & Mask) >> Shift;
+    }
+
+    STATIC_PORT_INLINE ValueType Insert(ValueType registerValue, ValueType fieldValue)
+    {
+        return (registerValue & ~Mask) | ((fieldValue << Shift) & Mask);
+    }
+
+    STATIC_PORT_INLINE ValueType Read()
+    {
+        return Extract(Register::Read());
+    }
+
+    STATIC_PORT_INLINE bool IsSet()
+    {
+        return (Register::Read() & Mask) != 0;
+    }
+
+    STATIC_PORT_INLINE void Modify(ValueType fieldValue)
+    // Read-modify-write of just this field.
+    {
+        Register::Write(Insert(Register::Read(), fieldValue));
+    }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# Turns the samples the kernel profiler dumps over serial (F11) into profiles.
+#
+#   qemu-system-i386 -kernel mykernel.bin -serial file:serial.log
+#   python3 symbolize.py serial.log              # flat profile
+#   python3 symbolize.py --folded serial.log     # input for flamegraph.pl
+#   python3 symbolize.py --cpu 1 serial.log       # one CPU only
+#
+# Addresses are resolved against the symbols of mykernel.bin (read with `nm`).
+
+import argparse
+import bisect
+import subprocess
+import sys
+from collections import Counter
+
+
+def load_symbols(binary):
+    output = subprocess.run(["nm", "-n", "-C", "--defined-only", binary],
+                            check=True, capture_output=True, text=True).stdout
+    addresses, names = [], []
+    for line in output.splitlines():
+        parts = line.split(" ", 2)
+        if len(parts) == 3 and parts[1] in "TtWw":
+            addresses.append(int(parts[0], 16))
+            names.append(parts[2])
+    return addresses, names
+
+
+def resolve(address, addresses, names):
+    i = bisect.bisect_right(addresses, address) - 1
+    return names[i] if i >= 0 else "0x%08x" % address
+
+
+def read_samples(stream, cpu=None):
+    # Only the last complete dump in the log is used. Each sample line starts
+    # with the number of the CPU that took it.
+    samples, current = [], None
+    for line in stream:
+        line = line.strip()
+        if line.startswith("PROFILE BEGIN"):
+            current = []
+        elif line == "PROFILE END" and current is not None:
+            samples, current = current, None
+        elif line.startswith("S ") and current is not None:
+            words = line.split()
+            if cpu is None or int(words[1]) == cpu:
+                current.append([int(word, 16) for word in words[2:]])
+    return samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Symbolize kernel profiler samples.")
+    parser.add_argument("log", nargs="?", help="serial log (default: stdin)")
+    parser.add_argument("--kernel", default="mykernel.bin")
+    parser.add_argument("--folded", action="store_true",
+                        help="print folded stacks (caller;...;callee count)")
+    parser.add_argument("--cpu", type=int, help="only the samples of this CPU (default: all)")
+    args = parser.parse_args()
+
+    addresses, names = load_symbols(args.kernel)
+    stream = open(args.log, errors="replace") if args.log else sys.stdin
+    samples = read_samples(stream, args.cpu)
+    if not samples:
+        sys.exit("no complete PROFILE BEGIN/END block found")
+
+    def frame_names(sample):
+        # frames[0] is the interrupted EIP; the rest are return addresses, which
+        # point after the call, so look up the byte before them.
+        return [resolve(sample[0], addresses, names)] + \
+               [resolve(ret - 1, addresses, names) for ret in sample[1:]]
+
+    if args.folded:
+        stacks = Counter(";".join(reversed(frame_names(s))) for s in samples)
+        for stack, count in stacks.most_common():
+            print(stack, count)
+        return
+
+    self_counts, total_counts = Counter(), Counter()
+    for sample in samples:
+        frames = frame_names(sample)
+        self_counts[frames[0]] += 1
+        for name in set(frames):
+            total_counts[name] += 1
+        # Recursion counts once per sample.
+
+    total = len(samples)
+    print("%d samples" % total)
+    print("%7s %7s  %s" % ("self%", "total%", "function"))
+    for name, count in self_counts.most_common():
+        print("%6.2f%% %6.2f%%  %s" % (100.0 * count / total, 100.0 * total_counts[name] / total, name))
+
+
+if __name__ == "__main__":
+    main()
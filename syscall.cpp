@@ -0,0 +1,198 @@
+#include "syscall.h"
+#include "smp.h"
+#include "multitasking.h"
+#include "paging.h"
+#include "pmm.h"
+#include "kprintf.h"
+#include "arith.h"
+
+extern "C" void sysenter_entry();
+extern "C" uint8_t user_benchmark_start;
+extern "C" uint8_t user_benchmark_sysenter;
+extern "C" uint8_t user_benchmark_end;
+
+static inline void WriteMsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr" : : "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)) : "memory");
+}
+
+static const uint32_t SysenterCsMsr = 0x174;
+static const uint32_t SysenterEspMsr = 0x175;
+static const uint32_t SysenterEipMsr = 0x176;
+
+SyscallFunction SyscallManager::table[SyscallManager::MaxSyscalls];
+SyscallManager* SyscallManager::ActiveSyscallManager = 0;
+
+SyscallManager::SyscallManager(InterruptManager* manager, GDT* gdt)
+: InterruptHandler(manager, SoftwareVector)
+{
+    this->gdt = gdt;
+    benchmarkPaging = 0;
+    benchmarkPmm = 0;
+    benchmarkBase = 0;
+    benchmarkCode = 0;
+    benchmarkStack = 0;
+    for(uint32_t i = 0; i < MaxSyscalls; ++i)
+        table[i] = 0;
+    Register(SyscallNull, &Null);
+    Register(SyscallExit, &Exit);
+    Register(SyscallYield, &Yield);
+    Register(SyscallBenchmarkResult, &BenchmarkResult);
+
+    fastPath = SysenterSupported();
+    InitializeCpu(Cpu::Current());
+    ActiveSyscallManager = this;
+}
+
+SyscallManager::~SyscallManager()
+{
+    if(ActiveSyscallManager == this)
+        ActiveSyscallManager = 0;
+}
+
+bool SyscallManager::SysenterSupported()
+{
+    unsigned int eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    if(!(edx & (1 << 11)))
+        return false;
+
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    return !(family == 6 && model < 3 && stepping < 3);
+    // The Pentium Pro sets SEP but has no sysenter.
+}
+
+bool SyscallManager::FastPath()
+{
+    return fastPath;
+}
+
+void SyscallManager::InitializeCpu(Cpu* cpu)
+{
+    if(!fastPath || cpu == 0)
+        return;
+    WriteMsr(SysenterCsMsr, gdt->CSS());
+    // sysenter loads ss from the next descriptor, sysexit the user segments 16 and 24 bytes on.
+    WriteMsr(SysenterEspMsr, (uint32_t)&cpu->tss);
+    // The entry takes the kernel stack from tss.esp0, which follows the running task.
+    WriteMsr(SysenterEipMsr, (uint32_t)&sysenter_entry);
+}
+
+bool SyscallManager::Register(uint32_t number, SyscallFunction function)
+{
+    if(number >= MaxSyscalls || table[number] != 0)
+        return false;
+    table[number] = function;
+    return true;
+}
+
+uint32_t SyscallManager::Dispatch(uint32_t number, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+    if(number >= MaxSyscalls || table[number] == 0)
+        return 0xFFFFFFFF;
+    return table[number](arg1, arg2, arg3);
+}
+
+unsigned int SyscallManager::HandleInterrupt(unsigned int esp)
+{
+    CPUState* cpu = (CPUState*)esp;
+    cpu->eax = Dispatch(cpu->eax, cpu->ebx, cpu->esi, cpu->edi);
+    return esp;
+}
+
+uint32_t SyscallManager::Null(uint32_t, uint32_t, uint32_t)
+{
+    return 0;
+}
+
+uint32_t SyscallManager::Exit(uint32_t, uint32_t, uint32_t)
+{
+    __asm__ volatile("cli");
+    TaskManager::Current()->CurrentTask()->state = Task::Finished;
+    while(true)
+        __asm__ volatile("int %0" : : "i" (TaskManager::YieldVector) : "memory");
+    // Schedule drops a finished task, so this only loops if its queue was full.
+    return 0;
+}
+
+uint32_t SyscallManager::Yield(uint32_t, uint32_t, uint32_t)
+{
+    __asm__ volatile("int %0" : : "i" (TaskManager::YieldVector) : "memory");
+    return 0;
+}
+
+uint32_t SyscallManager::BenchmarkResult(uint32_t path, uint32_t cyclesLow, uint32_t cyclesHigh)
+{
+    uint64_t cycles = ((uint64_t)cyclesHigh << 32) | cyclesLow;
+    kprintf("Syscall: %s round trip %u cycles\n", path == 0 ? "int 0x80" : "sysenter",
+            (uint32_t)DivU64(cycles, BenchmarkIterations));
+    return 0;
+}
+
+Task* SyscallManager::CreateBenchmarkTask(PageManager* paging, PhysicalMemoryManager* pmm)
+{
+    if(benchmarkBase != 0)
+        return 0;
+
+    uint32_t base = ((pmm->EndFrame() + 1023) & ~1023) << 12;
+    if(base == 0 || base >= 0xC0000000)
+        return 0;
+    // The first 4 MiB boundary above RAM, where no identity mapping will ever go.
+    // The top of the address space holds MMIO and the page tables.
+
+    uint32_t code = pmm->AllocateFrame();
+    uint32_t stack = pmm->AllocateFrame();
+    if(code == 0 || stack == 0
+       || !paging->MapPage(base, code, PageManager::PageWritable | PageManager::PageUser)
+       || !paging->MapPage(base + PageManager::PageSize, stack, PageManager::PageWritable | PageManager::PageUser))
+    {
+        paging->UnmapPage(base);
+        paging->UnmapPage(base + PageManager::PageSize);
+        // Either mapping may have gone in before the other failed.
+        if(code != 0)
+            pmm->FreeFrame(code);
+        if(stack != 0)
+            pmm->FreeFrame(stack);
+        return 0;
+    }
+
+    uint8_t* target = (uint8_t*)base;
+    for(uint8_t* source = &user_benchmark_start; source < &user_benchmark_end; ++source)
+        *target++ = *source;
+    *(uint32_t*)(base + (&user_benchmark_sysenter - &user_benchmark_start)) = fastPath ? 1 : 0;
+    // The code is position independent and finds this flag relative to itself.
+
+    Task* task = new Task(gdt, base, base + 2 * PageManager::PageSize);
+    if(task == 0)
+    {
+        paging->UnmapPage(base);
+        paging->UnmapPage(base + PageManager::PageSize);
+        pmm->FreeFrame(code);
+        pmm->FreeFrame(stack);
+        return 0;
+    }
+    task->retire = &RetireBenchmarkTask;
+
+    benchmarkPaging = paging;
+    benchmarkPmm = pmm;
+    benchmarkBase = base;
+    benchmarkCode = code;
+    benchmarkStack = stack;
+    return task;
+}
+
+void SyscallManager::RetireBenchmarkTask(Task* task)
+{
+    SyscallManager* self = ActiveSyscallManager;
+    if(self != 0 && self->benchmarkBase != 0)
+    {
+        self->benchmarkPaging->UnmapPage(self->benchmarkBase);
+        self->benchmarkPaging->UnmapPage(self->benchmarkBase + PageManager::PageSize);
+        self->benchmarkPmm->FreeFrame(self->benchmarkCode);
+        self->benchmarkPmm->FreeFrame(self->benchmarkStack);
+        self->benchmarkBase = 0;
+    }
+    delete task;
+}
@@ -0,0 +1,98 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "types.h"
+#include "gdt.h"
+#include "interrupts.h"
+
+class Cpu;
+class Task;
+class PageManager;
+class PhysicalMemoryManager;
+
+typedef uint32_t (*SyscallFunction)(uint32_t arg1, uint32_t arg2, uint32_t arg3);
+// A system call. Runs in ring 0 on the calling task's kernel stack; the return
+// value goes back to the caller in eax.
+
+class SyscallManager : public InterruptHandler
+// System call table and both ways into it. User code puts the call number in
+// eax and up to three arguments in ebx, esi and edi, and gets the result back in
+// eax. `int 0x80` always works. Where CPUID reports SEP, `sysenter` does the
+// same without the IDT lookup, the gate's privilege checks and the interrupt
+// frame; the caller passes its stack in ecx and where to resume in edx, which
+// are therefore not preserved (see syscallstubs.s).
+{
+public:
+    static const uint8_t SoftwareVector = 0x80;
+    static const uint32_t MaxSyscalls = 64;
+    static const uint32_t BenchmarkIterations = 10000;
+    // Round trips per path timed by the benchmark task.
+
+    enum Number
+    {
+        SyscallNull,            // Does nothing; returns 0.
+        SyscallExit,            // Retires the calling task.
+        SyscallYield,           // Gives up the rest of the time slice.
+        SyscallBenchmarkResult  // (path, cycles low, cycles high) from the benchmark task.
+    };
+
+private:
+    static SyscallFunction table[MaxSyscalls];
+
+    GDT* gdt;
+
+    bool fastPath;
+    // Whether sysenter is used (SEP present); set up on every CPU by InitializeCpu.
+
+    PageManager* benchmarkPaging;
+    PhysicalMemoryManager* benchmarkPmm;
+    uint32_t benchmarkBase;
+    uint32_t benchmarkCode;
+    uint32_t benchmarkStack;
+    // The benchmark task's pages and frames, released when it exits.
+
+    static uint32_t Null(uint32_t, uint32_t, uint32_t);
+    static uint32_t Exit(uint32_t, uint32_t, uint32_t);
+    static uint32_t Yield(uint32_t, uint32_t, uint32_t);
+    static uint32_t BenchmarkResult(uint32_t path, uint32_t cyclesLow, uint32_t cyclesHigh);
+
+    static void RetireBenchmarkTask(Task* task);
+    // Unmaps and frees the benchmark's pages and deletes the task (Task::retire).
+
+public:
+    static SyscallManager* ActiveSyscallManager;
+
+    SyscallManager(InterruptManager* manager, GDT* gdt);
+    // Registers the `int 0x80` handler and the built-in calls, and sets up
+    // sysenter on the calling CPU. Must come after the SmpManager, before the
+    // other processors start.
+
+    ~SyscallManager();
+
+    static bool SysenterSupported();
+    // CPUID's SEP bit, minus the Pentium Pro models that report it without having it.
+
+    bool FastPath();
+
+    void InitializeCpu(Cpu* cpu);
+    // Points the calling CPU's sysenter MSRs at the kernel code segment, its TSS
+    // (for the kernel stack) and the entry in syscallstubs.s.
+
+    bool Register(uint32_t number, SyscallFunction function);
+    // Installs a call; false if `number` is out of range or taken.
+
+    static uint32_t Dispatch(uint32_t number, uint32_t arg1, uint32_t arg2, uint32_t arg3);
+    // Runs call `number`; unknown numbers return 0xFFFFFFFF. Called by both entry paths.
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+    // `int 0x80`.
+
+    Task* CreateBenchmarkTask(PageManager* paging, PhysicalMemoryManager* pmm);
+    // Maps the ring 3 benchmark from syscallstubs.s above the end of RAM and
+    // returns a user task running it, or 0 without memory. It times
+    // BenchmarkIterations null calls through each available path and the
+    // cycles per round trip are printed with kprintf. Its memory is given back
+    // once it exits. Only one benchmark task can exist at a time.
+};
+
+#endif
@@ -0,0 +1,117 @@
+# System call entry through sysenter, and the ring 3 benchmark that times it
+# against int 0x80 (see SyscallManager).
+#
+# Calling sequence for sysenter, from ring 3:
+#   eax = call number, ebx/esi/edi = arguments
+#   ecx = esp to resume with, edx = eip to resume at
+#   sysenter
+# The result comes back in eax; ecx and edx are lost, everything else is kept.
+
+.set KERNEL_DATA_SELECTOR, 0x18         # GDT::DSS()
+.set PER_CPU_SELECTOR, 0x30             # GDT::PSS()
+
+.set SYSCALL_NULL, 0                    # SyscallManager::Number
+.set SYSCALL_EXIT, 1
+.set SYSCALL_BENCHMARK_RESULT, 3
+.set BENCHMARK_ITERATIONS, 10000        # SyscallManager::BenchmarkIterations
+
+.section .text
+
+.extern _ZN14SyscallManager8DispatchEjjjj
+
+# sysenter lands here with interrupts off, cs/ss from the SYSENTER_CS MSR and esp
+# pointing at this CPU's TSS (SYSENTER_ESP), whose esp0 is the top of the running
+# task's kernel stack, the same stack an interrupt from ring 3 would use.
+.global sysenter_entry
+sysenter_entry:
+    movl 4(%esp), %esp                  # TSS.esp0
+    pushl %ecx                          # User esp and eip, for sysexit
+    pushl %edx
+    pushl %ds
+    pushl %es
+    pushl %gs
+
+    mov $KERNEL_DATA_SELECTOR, %edx
+    mov %edx, %ds
+    mov %edx, %es
+    mov $PER_CPU_SELECTOR, %edx
+    mov %edx, %gs
+    cld
+    sti                                 # The call may block or be preempted like any kernel code
+
+    pushl %edi                          # Dispatch(number, arg1, arg2, arg3); it keeps ebx, esi, edi and ebp
+    pushl %esi
+    pushl %ebx
+    pushl %eax
+    call _ZN14SyscallManager8DispatchEjjjj
+    add $16, %esp
+
+    cli                                 # No interrupt between restoring the user segments and leaving
+    popl %gs
+    popl %es
+    popl %ds
+    popl %edx
+    popl %ecx
+    sti                                 # Takes effect after sysexit, like the sti;hlt idiom
+    sysexit
+
+
+# Ring 3 benchmark. SyscallManager::CreateBenchmarkTask copies everything from
+# user_benchmark_start to user_benchmark_end into a user page and sets
+# user_benchmark_sysenter in the copy, so the code only addresses itself
+# relative to %ebp. It reports the TSC cycles of BENCHMARK_ITERATIONS null calls
+# per path (0 = int 0x80, 1 = sysenter) and exits.
+.global user_benchmark_start
+user_benchmark_start:
+    call 1f
+1:  popl %ebp                           # ebp = address of 1b in the copy
+
+    rdtsc
+    mov %eax, %esi                      # Start in edi:esi, which system calls keep
+    mov %edx, %edi
+    mov $BENCHMARK_ITERATIONS, %ecx
+2:  mov $SYSCALL_NULL, %eax
+    int $0x80
+    dec %ecx
+    jnz 2b
+    rdtsc
+    sub %esi, %eax
+    sbb %edi, %edx
+    mov %eax, %esi
+    mov %edx, %edi
+    mov $0, %ebx
+    mov $SYSCALL_BENCHMARK_RESULT, %eax
+    int $0x80
+
+    cmpl $0, (user_benchmark_sysenter - 1b)(%ebp)
+    je 4f
+
+    rdtsc
+    mov %eax, %esi
+    mov %edx, %edi
+    pushl $BENCHMARK_ITERATIONS         # The counter lives on the stack: sysenter takes ecx and edx
+3:  mov $SYSCALL_NULL, %eax
+    mov %esp, %ecx
+    lea (5f - 1b)(%ebp), %edx
+    sysenter
+5:  decl (%esp)
+    jnz 3b
+    add $4, %esp
+    rdtsc
+    sub %esi, %eax
+    sbb %edi, %edx
+    mov %eax, %esi
+    mov %edx, %edi
+    mov $1, %ebx
+    mov $SYSCALL_BENCHMARK_RESULT, %eax
+    int $0x80
+
+4:  mov $SYSCALL_EXIT, %eax
+    int $0x80
+6:  jmp 6b
+
+.global user_benchmark_sysenter
+user_benchmark_sysenter:
+    .long 0                             # Non-zero when the CPU has sysenter
+.global user_benchmark_end
+user_benchmark_end:
@@ -0,0 +1,295 @@
+#include "timer.h"
+#include "arith.h"
+#include "profiler.h"
+#include "apic.h"
+
+TimerDriver* TimerDriver::ActiveTimer = 0;
+
+TimerDriver::TimerDriver(InterruptManager* manager, uint32_t frequency)
+: InterruptHandler(manager, manager->HardwareInterruptOffset() + 0x00) // IRQ0.
+{
+    ticks = 0;
+    scheduler = 0;
+    profiler = 0;
+    tscBase = 0;
+    tscFrequency = 0;
+    tscMult = 0;
+    tscShift = 0;
+    tickless = false;
+    ticklessStartNs = 0;
+    wakeupNs = 0;
+    localApic = 0;
+    tscPerTick = 0;
+    nextTickTsc = 0;
+
+    if(frequency == 0)
+        frequency = 1000;
+
+    // The PIT counts down from `divisor` at 1.193182 MHz; 0 stands for 65536.
+    divisor = (BaseFrequency + frequency / 2) / frequency;
+    if(divisor < 1)
+        divisor = 1;
+    if(divisor > 65536)
+        divisor = 65536;
+
+    this->frequency = BaseFrequency / divisor;
+    nanosecondsPerTick = (uint32_t)DivU64((uint64_t)divisor * 1000000000, BaseFrequency);
+
+    CommandPort::Write(0x34);                         // Channel 0, lobyte/hibyte, mode 2 (rate generator).
+    Channel0DataPort::Write(divisor & 0xFF);          // Low byte of the divisor.
+    Channel0DataPort::Write((divisor >> 8) & 0xFF);   // High byte of the divisor.
+
+    CalibrateTSC();
+
+    ActiveTimer = this;
+}
+
+TimerDriver::~TimerDriver()
+{
+    if(ActiveTimer == this)
+        ActiveTimer = 0;
+}
+
+void TimerDriver::CalibrateTSC()
+{
+    unsigned int eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    if(!(edx & (1 << 4)))
+        return;
+    // CPUID.01h:EDX bit 4 reports the time stamp counter.
+
+    // Count about 10 ms on channel 2 and see how far the TSC moves in that time.
+    const uint32_t count = BaseFrequency / 100;
+
+    SpeakerPort::Write((SpeakerPort::Read() & ~0x02) | 0x01);  // Raise the gate of channel 2, keep the speaker off.
+    CommandPort::Write(0xB0);                               // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count).
+    Channel2DataPort::Write(count & 0xFF);
+    Channel2DataPort::Write((count >> 8) & 0xFF);           // Counting starts once the high byte is written.
+
+    uint64_t start = ReadTSC();
+    while(!Channel2Output::IsSet());               // Output of channel 2 goes high at terminal count.
+    uint64_t end = ReadTSC();
+
+    uint64_t delta = end - start;
+    if(delta == 0 || (delta >> 32) != 0)
+        return;
+
+    uint64_t windowNs = DivU64((uint64_t)count * 1000000000, BaseFrequency);
+    tscFrequency = DivU64(delta * BaseFrequency, count);
+
+    // Pick the largest shift for which the multiplier still fits in 32 bits,
+    // this keeps the most precision in `NowNs()`.
+    uint8_t shift = 32;
+    uint64_t mult = DivU64(windowNs << shift, (uint32_t)delta);
+    while((mult >> 32) != 0 && shift > 0)
+    {
+        --shift;
+        mult = DivU64(windowNs << shift, (uint32_t)delta);
+    }
+
+    tscShift = shift;
+    tscMult = (uint32_t)mult;
+    tscBase = end;
+}
+
+unsigned int TimerDriver::HandleInterrupt(unsigned int esp)
+{
+    if(tickless)
+        ExitTickless();
+    // The one-shot of a tickless halt fired.
+    else if(localApic != 0)
+        ArmNextTick();
+
+    ticks++;
+    if(wakeupNs != 0 && NowNs() >= wakeupNs)
+        wakeupNs = 0;
+
+    if(profiler != 0)
+        profiler->Record((CPUState*)esp);
+    // Before the scheduler, which may switch to another task's frame.
+    if(scheduler != 0)
+        esp = (unsigned int)scheduler->Tick((CPUState*)esp);
+    return esp;
+}
+
+void TimerDriver::SetScheduler(TaskManager* scheduler)
+{
+    this->scheduler = scheduler;
+}
+
+void TimerDriver::SetProfiler(Profiler* profiler)
+{
+    this->profiler = profiler;
+}
+
+uint64_t TimerDriver::Ticks()
+{
+    // A 64-bit load is two instructions on i386; retry if IRQ0 slipped in between.
+    uint64_t result;
+    do
+    {
+        result = ticks;
+    } while(result != ticks);
+    return result;
+}
+
+uint32_t TimerDriver::Frequency()
+{
+    return frequency;
+}
+
+uint64_t TimerDriver::TscFrequency()
+{
+    return tscFrequency;
+}
+
+uint64_t TimerDriver::NowNs()
+{
+    if(tscMult != 0)
+        return MulShift64(ReadTSC() - tscBase, tscMult, tscShift);
+    return Ticks() * nanosecondsPerTick;
+}
+
+void TimerDriver::RequestWakeup(uint64_t deadlineNs)
+{
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+    if(wakeupNs == 0 || deadlineNs < wakeupNs)
+        wakeupNs = deadlineNs;
+    __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+}
+
+bool TimerDriver::UseLocalApicTimer(LocalApic* localApic)
+{
+    if(tscMult == 0)
+        return false;
+
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+
+    if(!localApic->StartTimer(interruptManager->HardwareInterruptOffset() + 0x00, tscFrequency))
+    {
+        __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+        return false;
+    }
+
+    CommandPort::Write(0x30);
+    interruptManager->Controller()->Mask(0);
+    // Stop the PIT (mode 0 without a count) and close its line.
+
+    this->localApic = localApic;
+    tscPerTick = DivU64(tscFrequency, frequency);
+    nextTickTsc = ReadTSC();
+    ArmNextTick();
+
+    __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+    return true;
+}
+
+void TimerDriver::ArmNextTick()
+{
+    nextTickTsc += tscPerTick;
+    uint64_t now = ReadTSC();
+    if(nextTickTsc <= now)
+        nextTickTsc = now + tscPerTick;
+    // Fell behind (e.g. interrupts were off for a while): skip ahead rather than fire a burst.
+    localApic->ArmTimer(nextTickTsc);
+}
+
+bool TimerDriver::EnterTickless()
+{
+    if(tickless)
+        return true;
+    if(tscMult == 0)
+        return false;
+    // Without the TSC the tick counter is the clock.
+    if(scheduler != 0 && scheduler->HasReadyTasks())
+        return false;
+    if(profiler != 0 && profiler->Running())
+        return false;
+
+    uint64_t now = NowNs();
+    if(localApic != 0)
+    {
+        if(wakeupNs == 0)
+            localApic->StopTimer();
+        else
+        {
+            if(wakeupNs <= now)
+                return false;
+            uint64_t delta = wakeupNs - now;
+            if(delta > 1000000000)
+                delta = 1000000000;
+            localApic->ArmTimer(ReadTSC() + DivU64(delta * DivU64(tscFrequency, 1000), 1000000));
+            // ns -> TSC ticks; capped at a second so the product stays within 64 bits.
+        }
+    }
+    else if(wakeupNs == 0)
+    {
+        CommandPort::Write(0x30);
+        // Channel 0, mode 0, and no count: the counter waits for a count that never
+        // comes, so IRQ0 stays quiet until `ExitTickless` reprograms it.
+    }
+    else
+    {
+        if(wakeupNs <= now)
+            return false;
+
+        // The 16-bit counter reaches about 55 ms; a later wake-up just takes an extra round.
+        uint64_t delta = wakeupNs - now;
+        if(delta > 50000000)
+            delta = 50000000;
+        uint32_t count = (uint32_t)DivU64(delta * BaseFrequency, 1000000000);
+        if(count == 0)
+            count = 1;
+
+        CommandPort::Write(0x30);                       // Channel 0, lobyte/hibyte, mode 0 (one-shot).
+        Channel0DataPort::Write(count & 0xFF);
+        Channel0DataPort::Write((count >> 8) & 0xFF);
+    }
+
+    ticklessStartNs = now;
+    tickless = true;
+    return true;
+}
+
+void TimerDriver::ExitTickless()
+{
+    if(!tickless)
+        return;
+    tickless = false;
+
+    if(localApic != 0)
+    {
+        nextTickTsc = ReadTSC();
+        ArmNextTick();
+    }
+    else
+    {
+        CommandPort::Write(0x34);                       // Back to mode 2 (rate generator).
+        Channel0DataPort::Write(divisor & 0xFF);
+        Channel0DataPort::Write((divisor >> 8) & 0xFF);
+    }
+
+    ticks += DivU64(NowNs() - ticklessStartNs, nanosecondsPerTick);
+    // Keep `Ticks()` in step with the time that passed without interrupts.
+}
+
+void TimerDriver::SleepNs(uint64_t nanoseconds)
+{
+    uint64_t deadline = NowNs() + nanoseconds;
+    RequestWakeup(deadline);
+
+    unsigned int eflags;
+    __asm__ volatile("pushf; pop %0" : "=r" (eflags));
+    bool interruptsEnabled = eflags & 0x200;
+    // With IF clear nothing would ever wake us from `hlt`.
+
+    while(NowNs() < deadline)
+    {
+        if(interruptsEnabled)
+            __asm__ volatile("hlt");
+        else
+            __asm__ volatile("pause");
+    }
+}
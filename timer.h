@@ -0,0 +1,150 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+#include "interrupts.h"
+#include "port.h"
+#include "staticport.h"
+#include "multitasking.h"
+
+class Profiler;
+class LocalApic;
+
+class TimerDriver : public InterruptHandler
+// Driver for the 8254 Programmable Interval Timer (PIT) on IRQ0.
+// Channel 0 generates the periodic tick; channel 2 is used once at boot to
+// calibrate the CPU's time stamp counter (TSC), which then provides the
+// high-resolution monotonic clock.
+{
+    typedef StaticPort<0x40> Channel0DataPort;
+    // Data port of PIT channel 0 (I/O port 0x40), wired to IRQ0.
+
+    typedef StaticPort<0x42> Channel2DataPort;
+    // Data port of PIT channel 2 (I/O port 0x42), normally used for the PC speaker.
+
+    typedef StaticPort<0x43> CommandPort;
+    // Mode/command register of the PIT (I/O port 0x43).
+
+    typedef StaticPort<0x61> SpeakerPort;
+    // System control port B (I/O port 0x61): gate of channel 2 (bit 0) and its output (bit 5).
+
+    typedef RegisterField<SpeakerPort, 5> Channel2Output;
+    // Output of PIT channel 2 as seen through port 0x61.
+
+    volatile uint64_t ticks;
+    // Number of timer interrupts since the driver was constructed.
+
+    uint32_t frequency;
+    // Actual tick rate in Hz after rounding the divisor.
+
+    uint32_t nanosecondsPerTick;
+    // Tick period in nanoseconds, used when no TSC is available.
+
+    uint32_t divisor;
+    // Channel 0 reload value of the periodic tick.
+
+    bool tickless;
+    // Whether the periodic tick is stopped (see `EnterTickless`).
+
+    uint64_t ticklessStartNs;
+    // Time the tick was stopped at, to account for the missed ticks.
+
+    volatile uint64_t wakeupNs;
+    // Earliest time somebody asked to be woken at, 0 if none.
+
+    LocalApic* localApic;
+    // When set, ticks come from this CPU's APIC timer instead of PIT channel 0.
+
+    uint64_t tscPerTick;
+    uint64_t nextTickTsc;
+    // Tick period and next tick as TSC values for the APIC timer; deadlines are
+    // absolute, so the tick doesn't drift by the time spent re-arming.
+
+    void ArmNextTick();
+    // Re-arms the APIC timer one period after the last tick.
+
+    uint64_t tscBase;
+    // TSC value at calibration time; `NowNs()` counts from here.
+
+    uint64_t tscFrequency;
+    // Calibrated TSC frequency in Hz (0 if the CPU has no usable TSC).
+
+    uint32_t tscMult;
+    uint8_t tscShift;
+    // Fixed-point conversion factor: ns = (tsc * tscMult) >> tscShift.
+
+    TaskManager* scheduler;
+    // Scheduler to drive from IRQ0, if any.
+
+    Profiler* profiler;
+    // Profiler sampling the interrupted code, if any.
+
+    void CalibrateTSC();
+    // Measures the TSC against a one-shot count of PIT channel 2.
+
+public:
+    static const uint32_t BaseFrequency = 1193182;
+    // Input clock of the PIT in Hz.
+
+    static TimerDriver* ActiveTimer;
+    // The timer providing the system clock, set by the constructor.
+
+    TimerDriver(InterruptManager* manager, uint32_t frequency = 1000);
+    // Programs channel 0 to fire at `frequency` Hz and calibrates the TSC.
+
+    ~TimerDriver();
+
+    virtual unsigned int HandleInterrupt(unsigned int esp);
+    // Counts a tick, feeds the profiler and lets the scheduler preempt the current task.
+
+    void SetScheduler(TaskManager* scheduler);
+    // Attaches the scheduler that gets a `Tick` on every timer interrupt.
+
+    void SetProfiler(Profiler* profiler);
+    // Attaches a profiler that sees the interrupted frame on every tick.
+
+    uint64_t Ticks();
+    // Returns the 64-bit tick counter.
+
+    uint32_t Frequency();
+    // Returns the tick rate in Hz.
+
+    uint64_t TscFrequency();
+    // Returns the calibrated TSC frequency in Hz, or 0 when the clock falls back to ticks.
+
+    uint64_t NowNs();
+    // Monotonic time in nanoseconds since boot. Uses the TSC when it is calibrated,
+    // otherwise the tick counter (with tick granularity).
+
+    void RequestWakeup(uint64_t deadlineNs);
+    // Makes sure a timer interrupt happens at `deadlineNs` (NowNs time) even while
+    // the tick is stopped. Only the earliest request is kept.
+
+    bool UseLocalApicTimer(LocalApic* localApic);
+    // Moves the tick from the PIT to the local APIC timer (TSC-deadline or one-shot
+    // mode), on the same vector; the PIT and its IRQ0 line are stopped. Needs the
+    // calibrated TSC; returns false (and keeps the PIT) without it.
+
+    bool EnterTickless();
+    // Called by the idle loop with interrupts off before halting. Stops the periodic
+    // tick, or programs a one-shot interrupt for the pending wake-up, and returns
+    // true. Keeps ticking (returns false) when it can't keep time without ticks
+    // (no TSC), when other tasks are ready to run or the profiler is sampling.
+
+    void ExitTickless();
+    // Restarts the periodic tick and adds the ticks that were skipped (interrupts off).
+
+    void SleepNs(uint64_t nanoseconds);
+    // Waits at least `nanoseconds`. With interrupts enabled the CPU halts between
+    // ticks instead of spinning.
+
+    static inline uint64_t ReadTSC()
+    {
+        uint32_t low, high;
+        __asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+        // `rdtsc` loads the 64-bit time stamp counter into edx:eax.
+        return ((uint64_t)high << 32) | low;
+    }
+};
+
+#endif
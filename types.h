@@ -0,0 +1,28 @@
+#ifndef TYPES_H
+#define TYPES_H
+// Fixed-width integer types for the kernel.
+// GCC's freestanding <stdint.h> would do (-nostdlib only affects linking), but
+// the kernel keeps its own so that it never picks up a hosted header by accident.
+// They match the i386 System V ABI (char = 8, short = 16, int/long = 32,
+// long long = 64 bits).
+
+typedef signed char int8_t;
+// Plain `char` is a distinct type whose signedness is up to the compiler.
+typedef unsigned char uint8_t;
+
+typedef short int16_t;
+typedef unsigned short uint16_t;
+
+typedef int int32_t;
+typedef unsigned int uint32_t;
+
+typedef long long int int64_t;
+typedef unsigned long long int uint64_t;
+
+typedef unsigned int size_t;
+// `size_t` must be `unsigned int` on i386 so that `operator new(size_t)` has the expected signature.
+
+typedef unsigned int uintptr_t;
+// Integer type wide enough to hold a pointer.
+
+#endif
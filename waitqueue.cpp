@@ -0,0 +1,116 @@
+#include "waitqueue.h"
+
+WaitQueue::WaitQueue(const char* name)
+: lock(name)
+{
+    head = 0;
+    tail = 0;
+}
+
+WaitQueue::~WaitQueue()
+{
+}
+
+void WaitQueue::Enqueue(Task* task)
+{
+    task->waitNext = 0;
+    if(tail != 0)
+        tail->waitNext = task;
+    else
+        head = task;
+    tail = task;
+}
+
+Task* WaitQueue::Dequeue()
+{
+    Task* task = head;
+    if(task != 0)
+    {
+        head = task->waitNext;
+        if(head == 0)
+            tail = 0;
+        task->waitNext = 0;
+    }
+    return task;
+}
+
+void WaitQueue::Remove(Task* task)
+{
+    Task* before = 0;
+    for(Task* t = head; t != 0; before = t, t = t->waitNext)
+    {
+        if(t != task)
+            continue;
+        if(before != 0)
+            before->waitNext = t->waitNext;
+        else
+            head = t->waitNext;
+        if(tail == t)
+            tail = before;
+        t->waitNext = 0;
+        return;
+    }
+}
+
+void WaitQueue::Wait(bool (*condition)(void* argument), void* argument)
+{
+    while(true)
+    {
+        uint32_t eflags;
+        __asm__ volatile("pushf; pop %0; cli" : "=r" (eflags) : : "memory");
+        lock.Lock();
+
+        if(condition(argument))
+        {
+            lock.Unlock();
+            __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+            return;
+        }
+
+        TaskManager* manager = TaskManager::Current();
+        // Asked again every round: the task may run on another CPU after sleeping.
+        if(manager == 0 || !manager->CanBlock())
+        {
+            lock.Unlock();
+            if(eflags & 0x200)
+                __asm__ volatile("sti; hlt" : : : "memory");
+            else
+                CpuRelax();
+            // Not a task that can sleep: wait for the next interrupt instead.
+        }
+        else
+        {
+            Task* task = manager->CurrentTask();
+            Enqueue(task);
+            manager->Block(&lock);
+
+            lock.Lock();
+            Remove(task);
+            lock.Unlock();
+            // Normally the waker has dequeued it already; not if Block returned early.
+        }
+
+        __asm__ volatile("push %0; popf" : : "r" (eflags) : "memory", "cc");
+    }
+}
+
+void WaitQueue::WakeOne()
+{
+    IrqSpinLockGuard guard(&lock);
+    Task* task = Dequeue();
+    if(task != 0)
+        TaskManager::Wake(task);
+}
+
+void WaitQueue::WakeAll()
+{
+    IrqSpinLockGuard guard(&lock);
+    Task* task;
+    while((task = Dequeue()) != 0)
+        TaskManager::Wake(task);
+}
+
+SpinLock* WaitQueue::Lock()
+{
+    return &lock;
+}
@@ -0,0 +1,47 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include "types.h"
+#include "spinlock.h"
+#include "multitasking.h"
+
+class WaitQueue
+// Tasks sleeping until a condition becomes true, e.g. until data arrives or a
+// resource is released. A waiting task gives its CPU to the scheduler instead
+// of spinning; whoever changes the condition calls `WakeOne`/`WakeAll`, from a
+// task or an interrupt handler, on any CPU. The condition is checked under the
+// queue's lock, and so must be changed under it too (see `Lock`), or a wake-up
+// could slip in between a waiter's check and its sleep.
+// The boot task of a CPU is its idle loop and never sleeps; there `Wait` halts
+// until the next interrupt and checks again.
+{
+    SpinLock lock;
+
+    Task* head;
+    Task* tail;
+    // Sleeping tasks in FIFO order, linked through `Task::waitNext`.
+
+    void Enqueue(Task* task);
+    Task* Dequeue();
+    void Remove(Task* task);
+
+public:
+    WaitQueue(const char* name = 0);
+    // Named queues show up in the lock statistics.
+
+    ~WaitQueue();
+
+    void Wait(bool (*condition)(void* argument), void* argument);
+    // Returns once `condition(argument)` is true. It is called with the lock held
+    // and interrupts off, so it must be short and must not sleep.
+
+    void WakeOne();
+    // Wakes the task that has waited longest.
+
+    void WakeAll();
+
+    SpinLock* Lock();
+    // Held (with IrqSpinLockGuard) while changing the condition waiters check.
+};
+
+#endif
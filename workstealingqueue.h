@@ -0,0 +1,88 @@
+#ifndef WORKSTEALINGQUEUE_H
+#define WORKSTEALINGQUEUE_H
+
+#include "types.h"
+#include "atomic.h"
+
+template<typename T, uint32_t Size>
+class WorkStealingQueue
+// Fixed-size, lock-free queue with one producer and any number of consumers on
+// different CPUs, after the array-based work-stealing deque of Chase and Lev.
+// The owner pushes at the bottom; everybody, the owner included, takes from the
+// top by advancing `top` with `lock cmpxchg`, so an element is handed out exactly
+// once and the owner gets its work back in FIFO order. Idle CPUs take from the
+// queues of busy ones without any lock and without interrupting them.
+{
+    static_assert(Size != 0 && (Size & (Size - 1)) == 0, "WorkStealingQueue size must be a power of two");
+
+    T buffer[Size];
+    // Storage; indices are reduced with `& (Size - 1)`.
+
+    volatile uint32_t top;
+    // Free-running count of taken elements, advanced by compare-and-swap only.
+
+    volatile uint32_t bottom;
+    // Free-running count of pushed elements, written by the owner only.
+
+public:
+    WorkStealingQueue()
+    {
+        top = 0;
+        bottom = 0;
+    }
+
+    bool Push(const T& value)
+    // Owner side, with interrupts off if an interrupt handler pushes too.
+    // Returns false, leaving the queue unchanged, when it is full.
+    {
+        uint32_t b = bottom;
+        if(b - top == Size)
+            return false;
+        buffer[b & (Size - 1)] = value;
+        __asm__ volatile("" : : : "memory");
+        // The slot must be written before the new bottom becomes visible.
+        bottom = b + 1;
+        return true;
+    }
+
+    bool Steal(T* value)
+    // Any CPU. Takes the oldest element; returns false when the queue is empty.
+    {
+        while(true)
+        {
+            uint32_t t = top;
+            __asm__ volatile("" : : : "memory");
+            uint32_t b = bottom;
+            if(t == b)
+                return false;
+
+            T item = buffer[t & (Size - 1)];
+
+            if(AtomicCompareAndSwap(&top, t, t + 1))
+            {
+                *value = item;
+                return true;
+            }
+            // Someone else took it first. The owner can only have reused the slot
+            // after `top` moved past it, so a successful swap means `item` was current.
+        }
+    }
+
+    uint32_t Count()
+    {
+        return bottom - top;
+    }
+
+    uint32_t Pushed()
+    {
+        return bottom;
+    }
+
+    uint32_t Taken()
+    {
+        return top;
+    }
+    // Free-running counts: element n (counting pushes from 0) has been taken once Taken() > n.
+};
+
+#endif